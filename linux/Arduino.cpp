@@ -0,0 +1,251 @@
+#include <Arduino.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+RP2040 rp2040;
+Stream Serial(STDOUT_FILENO);
+
+uint32_t micros()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+}
+
+uint32_t RP2040::getCycleCount()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+#endif
+}
+
+size_t Stream::write(uint8_t c) { return write(&c, 1); }
+size_t Stream::write(const uint8_t *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        const ssize_t len = ::write(mFd, buffer + done, size - done);
+        if (len <= 0)
+            break;
+        done += len;
+    }
+    return done;
+}
+void Stream::flush() { fsync(mFd); }
+
+SerialUART::SerialUART(const char *path, bool fast) : mFast(fast)
+{
+    strncpy(mPaths, path, sizeof(mPaths) - 1);
+    mPaths[sizeof(mPaths) - 1] = 0;
+    for (char *segment = mPaths; segment && mSegmentCount < SERIAL_SEGMENTS; ++mSegmentCount)
+    {
+        char *next = strchr(segment, ',');
+        if (next)
+            *next++ = 0;
+        char *speed = strrchr(segment, '@');
+        if (speed)
+            *speed++ = 0;
+        mSegments[mSegmentCount] = {segment, speed ? strtoul(speed, nullptr, 10) : 0};
+        segment = next;
+    }
+}
+
+bool SerialUART::open()
+{
+    if (mFd >= 0)
+        close(mFd);
+    mFd = ::open(mSegments[mSegment].path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if (mFd < 0)
+        return false;
+    mTty = isatty(mFd);
+    mMeterSpeed = mSegments[mSegment].speed ? mSegments[mSegment].speed : mSpeed;
+    mStart = millis();
+    mRead = 0;
+    // Capture header: magic "TICC", version, page size, page count (little endian)
+    uint8_t header[12];
+    mCapture = !mTty && ::read(mFd, header, sizeof(header)) == sizeof(header) && memcmp(header, "TICC", 4) == 0 &&
+               (header[6] | header[7] << 8) == sizeof(mPage);
+    if (mCapture)
+    {
+        mPages = header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24;
+        mPageUsed = mPagePos = 0;
+        mLastDue = 0;
+    }
+    else if (!mTty)
+        lseek(mFd, 0, SEEK_SET);
+    return true;
+}
+
+void SerialUART::begin(unsigned long speed, uint16_t config)
+{
+    const bool first = mSpeed == 0;
+    mSpeed = speed;
+    if (first)
+    {
+        for (unsigned int i = 0; i < mSegmentCount; ++i)
+            if (mSegments[i].speed == 0)
+                mSegments[i].speed = speed; // The meter does not follow the UART
+        if (mSegmentCount == 0 || !open())
+        {
+            mEof = true;
+            return;
+        }
+    }
+    if (!mTty)
+        return;
+    struct termios tio = {0};
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (config == SERIAL_7E1)
+    {
+        tio.c_cflag = (tio.c_cflag & ~CSIZE) | CS7 | PARENB;
+        tio.c_iflag |= ISTRIP;
+    }
+    const speed_t baud = speed == 9600 ? B9600 : B1200;
+    cfsetispeed(&tio, baud);
+    cfsetospeed(&tio, baud);
+    tcsetattr(mFd, TCSANOW, &tio);
+}
+
+void SerialUART::end() {} // The file stays open: begin() only changes the speed
+
+// Bytes sent at mMeterSpeed as seen by a UART at mSpeed: a slower UART merges several characters in one,
+// a faster one sees each start bit and stop bit as characters of their own. No CR is ever produced.
+size_t SerialUART::garble(const uint8_t *raw, size_t len)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        mGarbage = mGarbage * 31 + raw[i];
+        if (mSpeed < mMeterSpeed)
+        {
+            if (++mRead % (mMeterSpeed / mSpeed) == 0)
+                mBuffer[out++] = (mGarbage >> 3) & 0x7f;
+        }
+        else
+        {
+            ++mRead;
+            mBuffer[out++] = raw[i] & 1 ? 0x7f : 0x00;
+            mBuffer[out++] = (raw[i] >> 1) & 0x78;
+        }
+        if (out != 0 && mBuffer[out - 1] == '\x0d')
+            --mBuffer[out - 1];
+    }
+    return out;
+}
+
+// One record of the capture per call, once its recorded time is reached
+bool SerialUART::fillCapture()
+{
+    while (mPagePos + 3 > mPageUsed)
+    {
+        if (mPages == 0 || ::read(mFd, mPage, sizeof(mPage)) != (ssize_t)sizeof(mPage))
+        { // Next replay file, or end of the replay
+            mEof = ++mSegment == mSegmentCount || !open();
+            return false;
+        }
+        --mPages;
+        mPageUsed = MIN((uint16_t)(mPage[20] | mPage[21] << 8), (uint16_t)(sizeof(mPage) - 22));
+        mPagePos = 0;
+        mPageDate = (mPage[18] | mPage[19] << 8) != 0; // Year 0: device clock not set
+    }
+    const uint8_t *record = mPage + 22 + mPagePos;
+    const uint32_t time = (mPage[4] | mPage[5] << 8 | mPage[6] << 16 | (uint32_t)mPage[7] << 24) + (record[0] | record[1] << 8);
+    if (mRead == 0 || (int32_t)(time - mTimeBase - mLastDue) < 0)
+        mTimeBase = time - mLastDue; // First record, or the device timer started again (cold boot)
+    const uint32_t due = time - mTimeBase;
+    if (!mFast && millis() - mStart < due)
+        return false;
+    mLastDue = due;
+    const uint8_t length = MIN(record[2], mPageUsed - mPagePos - 3);
+    memcpy(mBuffer, record + 3, length);
+    mBufferPos = 0;
+    mBufferLen = length;
+    mFillUs = micros();
+    mRead += length + 1;
+    mPagePos += 3 + record[2];
+    return length != 0;
+}
+
+bool SerialUART::fill()
+{
+    if (mBufferPos != mBufferLen)
+        return true;
+    if (mFd < 0 || mEof)
+        return false;
+    if (mCapture)
+        return fillCapture();
+    size_t max = sizeof(mBuffer) / 2;
+    if (!mTty && !mFast)
+    { // 10 bits per character (7E1 with start and stop bits)
+        const uint64_t allowed = (uint64_t)(millis() - mStart) * mMeterSpeed / 10000;
+        if (allowed <= mRead)
+            return false;
+        max = MIN(max, (size_t)(allowed - mRead));
+    }
+    uint8_t raw[sizeof(mBuffer) / 2];
+    const ssize_t len = ::read(mFd, mTty || mMeterSpeed == mSpeed ? mBuffer : raw, max);
+    if (len <= 0)
+    {
+        if (!mTty && len == 0)
+        { // Next replay file, or end of the replay
+            mEof = ++mSegment == mSegmentCount || !open();
+        }
+        return false;
+    }
+    mBufferPos = 0;
+    if (mTty || mMeterSpeed == mSpeed)
+    {
+        mBufferLen = len;
+        mRead += len;
+    }
+    else
+        mBufferLen = garble(raw, len);
+    mFillUs = micros();
+    return mBufferLen != 0;
+}
+
+int SerialUART::available()
+{
+    if (!fill())
+        return 0;
+    int pending = 0;
+    if (mTty)
+        ioctl(mFd, FIONREAD, &pending);
+    return mBufferLen - mBufferPos + pending;
+}
+
+int SerialUART::read()
+{
+    if (!fill())
+        return -1;
+    const uint8_t c = mBuffer[mBufferPos++];
+    if (c == '\x0d')
+        mLineUs = mFillUs;
+    return c;
+}
+
+int SerialUART::fd() const { return mFd; }
+bool SerialUART::eof() const { return mEof; }
+uint32_t SerialUART::lineReceived() const { return mLineUs; }
+
+bool SerialUART::captureDate(uint16_t dateTime[6])
+{
+    if (!mCapture || !mPageDate || mPagePos == 0)
+        return false; // Not replayed yet
+    mPageDate = false;
+    for (int i = 0; i < 6; ++i)
+        dateTime[i] = mPage[8 + 2 * i] | mPage[9 + 2 * i] << 8;
+    return true;
+}
@@ -0,0 +1,111 @@
+#ifndef LINUX_ARDUINO_H
+#define LINUX_ARDUINO_H
+
+// Arduino API subset used by the firmware sources, for the Linux gateway daemon
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <functional>
+#include <knx/bits.h> // millis(), delay()
+
+uint32_t micros();
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define PROGMEM
+#define PSTR(s) (s)
+#define __no_inline_not_in_flash_func(name) name
+
+#define SERIAL_7E1 0x1
+#define SERIAL_8N1 0x2
+
+// No interrupt and a single core: flash accesses need no protection
+inline void noInterrupts() {}
+inline void interrupts() {}
+class RP2040
+{
+public:
+    void idleOtherCore() {}
+    void resumeOtherCore() {}
+    uint32_t getCycleCount(); // Time stamp counter on x86, nanoseconds elsewhere
+};
+extern RP2040 rp2040;
+
+// Output to a file descriptor
+class Stream
+{
+protected:
+    int mFd;
+
+public:
+    Stream(int fd = -1) : mFd(fd){};
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    void flush();
+};
+extern Stream Serial; // Standard output
+
+// TIC input: a tty configured at the TIC speed, or replay files paced at the meter speed.
+// A replay is a list of "file[@speed]" separated by commas, played one after the other: the meter
+// speed defaults to the first UART speed, and bytes sent at another speed than the UART one are
+// received as garbage, as on a real line. Files exported by TicCapture ("capture dump") hold the
+// bytes received by the UART: they are replayed at their recorded time, with the recorded date.
+#define SERIAL_SEGMENTS 8
+class SerialUART : public Stream
+{
+    char mPaths[256];
+    struct
+    {
+        const char *path;
+        unsigned long speed; // 0: first UART speed
+    } mSegments[SERIAL_SEGMENTS];
+    unsigned int mSegmentCount = 0;
+    unsigned int mSegment = 0;
+    bool mFast;          // Replay as fast as possible
+    bool mTty = false;
+    bool mEof = false;
+    unsigned long mSpeed = 0;      // UART
+    unsigned long mMeterSpeed = 0; // Current replay file
+    uint32_t mStart = 0;           // Replay pacing
+    uint64_t mRead = 0;
+    uint8_t mBuffer[256];
+    size_t mBufferPos = 0, mBufferLen = 0;
+    uint32_t mGarbage = 0; // Mismatched speed state
+    // Capture replay (see TicCapture::Page)
+    bool mCapture = false;
+    uint32_t mPages = 0; // Left in the file
+    uint8_t mPage[256];
+    uint16_t mPageUsed = 0, mPagePos = 0;
+    uint32_t mTimeBase = 0; // Recorded time replayed at mStart
+    uint32_t mLastDue = 0;
+    bool mPageDate = false; // Date of the page not read yet
+    uint32_t mFillUs = 0; // micros() at which the bytes of mBuffer were made available
+    uint32_t mLineUs = 0; // Same, for the last CR read
+
+    bool open();
+    bool fill();
+    bool fillCapture();
+    size_t garble(const uint8_t *raw, size_t len);
+
+public:
+    SerialUART(const char *path, bool fast = false);
+    void begin(unsigned long speed, uint16_t config);
+    void end();
+    int available();
+    int read();
+    int fd() const;
+    bool eof() const; // Replay over
+    // Capture replay: recorded date (seconds, minutes, hours, day, month 0-11, year) of the page being
+    // replayed, once per page, when the device clock was set
+    bool captureDate(uint16_t dateTime[6]);
+    // micros() at which the last CR read was made available: start of the line to telegram latency (for a tty,
+    // when the bytes were read from the kernel buffer)
+    uint32_t lineReceived() const;
+};
+
+#endif
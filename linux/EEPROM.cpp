@@ -0,0 +1,37 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <hardware/flash.h>
+
+extern "C" uint8_t _EEPROM_start[];
+
+EEPROMClass EEPROM;
+
+void EEPROMClass::begin(const char *path)
+{
+    flash_eeprom_file(path);
+    memcpy(mData, _EEPROM_start, sizeof(mData));
+    mDirty = false;
+}
+
+uint8_t EEPROMClass::read(int address) { return address >= 0 && address < EEPROM_SIZE ? mData[address] : 0xff; }
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    if (address >= 0 && address < EEPROM_SIZE && mData[address] != value)
+    {
+        mData[address] = value;
+        mDirty = true;
+    }
+}
+
+bool EEPROMClass::commit()
+{
+    if (!mDirty)
+        return true;
+    noInterrupts();
+    flash_range_erase((uintptr_t)_EEPROM_start - XIP_BASE, EEPROM_SIZE);
+    flash_range_program((uintptr_t)_EEPROM_start - XIP_BASE, mData, EEPROM_SIZE);
+    interrupts();
+    mDirty = false;
+    return true;
+}
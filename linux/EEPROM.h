@@ -0,0 +1,49 @@
+#ifndef LINUX_EEPROM_H
+#define LINUX_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define EEPROM_SIZE 4096
+
+// EEPROM emulation as on the RP2040: a RAM copy of the flash sector at _EEPROM_start, erased and programmed
+// on commit(). The sector is kept in a file (see flash_eeprom_file())
+class EEPROMClass
+{
+    uint8_t mData[EEPROM_SIZE];
+    bool mDirty = false;
+
+public:
+    void begin(const char *path);
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    bool commit();
+    size_t length() const { return EEPROM_SIZE; }
+    uint8_t *getDataPtr()
+    {
+        mDirty = true;
+        return mData;
+    }
+    const uint8_t *getConstDataPtr() const { return mData; }
+    template <typename T>
+    T &get(int address, T &t)
+    {
+        if (address >= 0 && (size_t)address + sizeof(T) <= EEPROM_SIZE)
+            memcpy(&t, mData + address, sizeof(T));
+        return t;
+    }
+    template <typename T>
+    const T &put(int address, const T &t)
+    {
+        if (address >= 0 && (size_t)address + sizeof(T) <= EEPROM_SIZE && memcmp(mData + address, &t, sizeof(T)) != 0)
+        {
+            memcpy(mData + address, &t, sizeof(T));
+            mDirty = true;
+        }
+        return t;
+    }
+};
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,35 @@
+#include <new>
+#include <stdlib.h>
+#include "HeapTrack.h"
+
+static bool armed = false;
+static uint32_t count = 0;
+static uint32_t total = 0;
+
+void HeapTrack::arm(bool on) { armed = on; }
+uint32_t HeapTrack::allocations() { return count; }
+uint32_t HeapTrack::bytes() { return total; }
+
+static void *allocate(size_t size)
+{
+    if (armed)
+    {
+        ++count;
+        total += size;
+    }
+    return malloc(size ? size : 1);
+}
+
+void *operator new(size_t size)
+{
+    if (void *ptr = allocate(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
@@ -0,0 +1,15 @@
+#ifndef HEAPTRACK_H
+#define HEAPTRACK_H
+
+#include <stdint.h>
+
+// Counts the heap allocations (operator new) made while armed, to check that the firmware loop does not allocate
+class HeapTrack
+{
+public:
+    static void arm(bool on);
+    static uint32_t allocations();
+    static uint32_t bytes();
+};
+
+#endif
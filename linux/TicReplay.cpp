@@ -0,0 +1,89 @@
+#include <vector>
+#include "TicReplay.h"
+
+#define CAPTURE_FILE_MAGIC 0x43434954 // As TicCapture.h
+#define CAPTURE_PAGE_SIZE 256U
+
+bool TicReplay::replay(FILE *file)
+{
+    uint8_t magic[4] = {0};
+    const bool captured = fread(magic, 1, 4, file) == 4 && (magic[0] | magic[1] << 8 | magic[2] << 16 | (uint32_t)magic[3] << 24) == CAPTURE_FILE_MAGIC;
+    rewind(file);
+    if (!captured)
+    {
+        raw(file);
+        return true;
+    }
+    return capture(file);
+}
+
+// Raw TIC bytes, timed at the line speed (10 bits per 7E1 byte)
+void TicReplay::raw(FILE *file)
+{
+    std::vector<char> current;
+    for (int c; (c = fgetc(file)) != EOF;)
+    {
+        mBits += 10;
+        const uint32_t time = mBits * 1000 / mSpeed;
+        c &= 0x7f;
+        if (c == '\n' || c == 0x02)
+            current.clear();
+        else if (c == '\r')
+        {
+            mHandler(mContext, current.data(), current.data() + current.size(), time);
+            current.clear();
+        }
+        else
+            current.push_back((char)c);
+    }
+}
+
+// TicCapture export: bytes with their arrival time (see TicCapture::Page)
+bool TicReplay::capture(FILE *file)
+{
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header))
+        return false;
+    const uint16_t pageSize = header[6] | header[7] << 8;
+    const uint32_t pageCount = header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24;
+    if (pageSize != CAPTURE_PAGE_SIZE)
+        return false;
+    uint32_t offset = mBits * 1000 / mSpeed;
+    std::vector<char> current;
+    uint32_t base = 0;
+    bool first = true;
+    uint8_t page[CAPTURE_PAGE_SIZE];
+    for (uint32_t p = 0; p < pageCount && fread(page, 1, sizeof(page), file) == sizeof(page); ++p)
+    {
+        const uint32_t pageTime = page[4] | page[5] << 8 | page[6] << 16 | (uint32_t)page[7] << 24;
+        const uint16_t used = page[20] | page[21] << 8;
+        if (first)
+        { // Times are made relative to the first page, after the previous files
+            base = pageTime - offset;
+            first = false;
+        }
+        for (uint16_t i = 0; i + 3 <= used && used <= sizeof(page) - 22;)
+        {
+            const uint8_t *record = page + 22 + i;
+            const uint32_t time = pageTime + (record[0] | record[1] << 8) - base;
+            const uint8_t length = record[2];
+            for (uint8_t j = 0; j < length && i + 3 + j < used; ++j)
+            {
+                const char c = record[3 + j] & 0x7f;
+                if (c == '\n' || c == 0x02)
+                    current.clear();
+                else if (c == '\r')
+                {
+                    mHandler(mContext, current.data(), current.data() + current.size(), time);
+                    current.clear();
+                }
+                else
+                    current.push_back(c);
+            }
+            offset = time;
+            i += 3 + length;
+        }
+    }
+    mBits = (uint64_t)offset * mSpeed / 1000;
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef TICREPLAY_H
+#define TICREPLAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Recorded TIC streams for the host replays (forecast, shedding): raw files timed at the line speed, or
+// TicCapture exports timed by their records. Each line is passed without its STX/LF and CR, with its time
+// in ms, continuing from the previous files
+class TicReplay
+{
+public:
+    typedef void (*LineHandler)(void *context, const char *begin, const char *end, uint32_t time);
+
+    TicReplay(unsigned long speed, LineHandler handler, void *context) : mSpeed(speed), mHandler(handler), mContext(context) {}
+    bool replay(FILE *file); // False for an unsupported capture
+
+private:
+    unsigned long mSpeed;
+    LineHandler mHandler;
+    void *mContext;
+    uint64_t mBits = 0; // Raw time, in bits at mSpeed
+
+    void raw(FILE *file);
+    bool capture(FILE *file);
+};
+
+#endif
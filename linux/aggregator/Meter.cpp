@@ -0,0 +1,152 @@
+#include "Meter.h"
+#include "TicLine.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY(label) {label, sizeof(label) - 1}
+
+// Historic energy registers, summed into the meter index
+static const struct
+{
+    const char *key;
+    uint8_t size;
+} Registers[] = {KEY("BASE "),    KEY("HCHC "),    KEY("HCHP "),    KEY("EJPHN "),   KEY("EJPHPM "), KEY("BBRHCJB "),
+                 KEY("BBRHPJB "), KEY("BBRHCJW "), KEY("BBRHPJW "), KEY("BBRHCJR "), KEY("BBRHPJR ")};
+
+// ADCO carries the emission time of the benchmark frames, in us (12 digits)
+static uint64_t timestamp(const char *address)
+{
+    uint64_t value = 0;
+    for (const char *c = address; c != address + 12 && *c >= '0' && *c <= '9'; ++c)
+        value = value * 10 + (*c - '0');
+    return value;
+}
+
+Meter::Meter(unsigned int _id, int _fd, const char *historyDir) : mRing(new uint8_t[METER_RING_SIZE]), mHistoryDir(historyDir), id(_id), fd(_fd) {}
+Meter::~Meter() { delete[] mRing; }
+
+size_t Meter::freeSpace() const { return METER_RING_SIZE - (mHead.load(std::memory_order_relaxed) - mTail.load(std::memory_order_acquire)); }
+
+uint8_t *Meter::writePtr(size_t &contiguous)
+{
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    contiguous = freeSpace();
+    if (contiguous > METER_RING_SIZE - head % METER_RING_SIZE)
+        contiguous = METER_RING_SIZE - head % METER_RING_SIZE;
+    return mRing + head % METER_RING_SIZE;
+}
+
+void Meter::commit(size_t len) { mHead.store(mHead.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+
+void Meter::parse(uint32_t day)
+{
+    const size_t head = mHead.load(std::memory_order_acquire);
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail)
+    {
+        const char c = (char)mRing[tail % METER_RING_SIZE];
+        switch (c)
+        {
+        case '\x02': // STX
+        case '\n':
+            mLineLen = 0;
+            break;
+        case '\x03': // ETX
+            mLineLen = 0;
+            endFrame(day);
+            break;
+        case '\r':
+            line(mLine, mLine + mLineLen);
+            mLineLen = 0;
+            break;
+        default:
+            if (mLineLen < METER_LINE_SIZE)
+                mLine[mLineLen++] = c;
+            break;
+        }
+    }
+    mTail.store(tail, std::memory_order_release);
+}
+
+void Meter::line(const char *begin, const char *end)
+{
+    const char separator = memchr(begin, '\t', end - begin) ? '\t' : ' ';
+    if (!(separator == '\t' ? TicLine::validStandard(begin, end) : TicLine::validHistoric(begin, end)))
+    {
+        totals.badLines.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const char *value;
+    if ((value = TicLine::value(begin, end, "ADCO ")) || (value = TicLine::value(begin, end, "ADSC\t")))
+    {
+        const char *valueEnd = (const char *)memchr(value, separator, end - value);
+        const size_t len = valueEnd - value < 12 ? valueEnd - value : 12;
+        memcpy(mAddress, value, len);
+        mAddress[len] = '\0';
+    }
+    else if ((value = TicLine::value(begin, end, "PAPP ")) || (value = TicLine::value(begin, end, "SINSTS\t")))
+        totals.power.store(TicLine::number(value, end), std::memory_order_relaxed);
+    else if ((value = TicLine::value(begin, end, "EAST\t")))
+        mEast = TicLine::number(value, end);
+    else
+    {
+        for (const auto &reg : Registers)
+        {
+            if ((value = TicLine::value(begin, end, reg.key, reg.size)))
+            {
+                mRegisters[&reg - Registers] = TicLine::number(value, end);
+                break;
+            }
+        }
+    }
+}
+
+void Meter::endFrame(uint32_t day)
+{
+    totals.frames.fetch_add(1, std::memory_order_relaxed);
+    if (benchmark)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const uint64_t us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        latencies.push_back((uint32_t)(us % 1000000000000ULL - timestamp(mAddress)));
+    }
+    uint64_t index = mEast;
+    if (index == 0)
+    {
+        for (uint32_t value : mRegisters)
+            index += value;
+    }
+    if (index == 0)
+        return;
+    totals.index.store(index, std::memory_order_relaxed);
+    if (mDay != day)
+    {
+        if (mDay != 0 && index >= mDayStart)
+        {
+            totals.yesterday.store(index - mDayStart, std::memory_order_relaxed);
+            saveDay(mDay, index - mDayStart);
+        }
+        mDay = day;
+        mDayStart = index;
+    }
+    totals.today.store(index - mDayStart, std::memory_order_relaxed);
+}
+
+// One line per day: YYYYMMDD;Wh, in a file per meter address
+void Meter::saveDay(uint32_t day, uint64_t consumption)
+{
+    if (!mHistoryDir)
+        return;
+    char path[512];
+    if (mAddress[0])
+        snprintf(path, sizeof(path), "%s/%s.csv", mHistoryDir, mAddress);
+    else
+        snprintf(path, sizeof(path), "%s/meter%u.csv", mHistoryDir, id);
+    FILE *file = fopen(path, "a");
+    if (!file)
+        return;
+    fprintf(file, "%08u;%llu\n", day, (unsigned long long)consumption);
+    fclose(file);
+}
@@ -0,0 +1,65 @@
+#ifndef METER_H
+#define METER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#define METER_RING_SIZE (64 * 1024) // Bytes read but not parsed yet
+#define METER_LINE_SIZE 64
+
+// One TIC stream: bytes are pushed by the I/O thread into a single producer/single consumer ring,
+// parsed by the worker owning the meter.
+class Meter
+{
+public:
+    struct Totals
+    {
+        std::atomic<uint32_t> power{0};      // VA (PAPP or SINSTS)
+        std::atomic<uint64_t> index{0};      // Wh, all registers (historic) or EAST (standard)
+        std::atomic<uint64_t> today{0};      // Wh since local midnight
+        std::atomic<uint64_t> yesterday{0};  // Wh
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> badLines{0};
+    };
+
+private:
+    // Ring
+    uint8_t *mRing;
+    std::atomic<size_t> mHead{0}; // Written by the I/O thread
+    std::atomic<size_t> mTail{0}; // Written by the worker
+
+    // Parser
+    char mLine[METER_LINE_SIZE];
+    size_t mLineLen = 0;
+    uint32_t mRegisters[11] = {0}; // Historic energy registers, BASE to BBRHPJR
+    uint64_t mEast = 0;
+    char mAddress[13] = {0};
+
+    // History
+    uint32_t mDay = 0; // YYYYMMDD of mDayStart
+    uint64_t mDayStart = 0;
+    const char *mHistoryDir;
+
+    void line(const char *begin, const char *end);
+    void endFrame(uint32_t day);
+    void saveDay(uint32_t day, uint64_t consumption);
+
+public:
+    const unsigned int id;
+    const int fd;
+    Totals totals;
+    std::atomic<bool> queued{false}; // Waiting in a worker queue
+    std::vector<uint32_t> latencies; // In us, benchmark only (ADCO carries the emission time)
+    bool benchmark = false;
+
+    Meter(unsigned int id, int fd, const char *historyDir);
+    ~Meter();
+    size_t freeSpace() const;
+    uint8_t *writePtr(size_t &contiguous); // I/O thread
+    void commit(size_t len);               // I/O thread
+    void parse(uint32_t day);              // Worker, day as YYYYMMDD
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "Service.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define SERVICE_EPOLL_EVENTS 64
+#define SERVICE_DAY_PERIOD 1000 // Local date refreshed every second
+
+Service::Service(unsigned int workers) : mEpoll(epoll_create1(EPOLL_CLOEXEC))
+{
+    mDay = today();
+    for (unsigned int i = 0; i < workers; ++i)
+    {
+        Worker *worker = new Worker;
+        worker->thread = std::thread(&Service::work, this, worker);
+        mWorkers.push_back(worker);
+    }
+}
+
+Service::~Service()
+{
+    mRunning = false;
+    for (Worker *worker : mWorkers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->ready.notify_one();
+        }
+        worker->thread.join();
+        delete worker;
+    }
+    close(mEpoll);
+}
+
+uint32_t Service::today()
+{
+    const time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    return (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+}
+
+void Service::add(Meter *meter)
+{
+    mMeters.push_back(meter);
+    ++mOpen;
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = meter;
+    if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, meter->fd, &event) != 0 && errno == EPERM)
+        mFiles.push_back(meter);
+}
+
+bool Service::read(Meter *meter)
+{
+    bool readData = false;
+    for (;;)
+    {
+        size_t contiguous;
+        uint8_t *ptr = meter->writePtr(contiguous);
+        if (contiguous == 0)
+        { // Ring full: the worker is behind, the kernel buffers meanwhile
+            if (readData)
+                schedule(meter);
+            return true;
+        }
+        const ssize_t len = ::read(meter->fd, ptr, contiguous);
+        if (len > 0)
+        {
+            meter->commit(len);
+            readData = true;
+            continue;
+        }
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+            break;
+        if (readData)
+            schedule(meter);
+        return false;
+    }
+    if (readData)
+        schedule(meter);
+    return true;
+}
+
+void Service::poll(Meter *meter, bool enable)
+{
+    struct epoll_event event = {0};
+    event.events = enable ? (uint32_t)EPOLLIN : 0U;
+    event.data.ptr = meter;
+    epoll_ctl(mEpoll, EPOLL_CTL_MOD, meter->fd, &event);
+}
+
+void Service::schedule(Meter *meter)
+{
+    if (meter->queued.exchange(true))
+        return;
+    ++mPending;
+    Worker *worker = mWorkers[meter->id % mWorkers.size()];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->queue.push_back(meter);
+    worker->ready.notify_one();
+}
+
+void Service::work(Worker *worker)
+{
+    for (;;)
+    {
+        Meter *meter;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->ready.wait(lock, [&]
+                               { return !worker->queue.empty() || !mRunning; });
+            if (worker->queue.empty())
+                return;
+            meter = worker->queue.front();
+            worker->queue.pop_front();
+        }
+        meter->queued = false; // Data arriving from now on queues the meter again
+        meter->parse(mDay.load(std::memory_order_relaxed));
+        --mPending;
+    }
+}
+
+void Service::run()
+{
+    struct epoll_event events[SERVICE_EPOLL_EVENTS];
+    struct timespec lastDay;
+    clock_gettime(CLOCK_MONOTONIC, &lastDay);
+    while (mRunning && mOpen != 0)
+    {
+        const int n = epoll_wait(mEpoll, events, SERVICE_EPOLL_EVENTS, !mFiles.empty() ? 0 : !mStalled.empty() ? 1 : 100);
+        for (int i = 0; i < n; ++i)
+        {
+            Meter *meter = (Meter *)events[i].data.ptr;
+            if (!read(meter))
+            {
+                epoll_ctl(mEpoll, EPOLL_CTL_DEL, meter->fd, nullptr);
+                --mOpen;
+            }
+            else if (meter->freeSpace() == 0)
+            {
+                poll(meter, false);
+                mStalled.push_back(meter);
+            }
+        }
+        for (size_t i = 0; i < mStalled.size();)
+        {
+            if (mStalled[i]->freeSpace() == 0)
+                ++i;
+            else
+            {
+                poll(mStalled[i], true);
+                mStalled.erase(mStalled.begin() + i);
+            }
+        }
+        for (size_t i = 0; i < mFiles.size();)
+        {
+            if (read(mFiles[i]))
+                ++i;
+            else
+            {
+                mFiles.erase(mFiles.begin() + i);
+                --mOpen;
+            }
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - lastDay.tv_sec) * 1000 + (now.tv_nsec - lastDay.tv_nsec) / 1000000 > SERVICE_DAY_PERIOD)
+        {
+            mDay = today();
+            lastDay = now;
+        }
+    }
+    // Let the workers finish what was read
+    while (mPending != 0)
+        usleep(1000);
+}
+
+void Service::stop() { mRunning = false; }
+const std::vector<Meter *> &Service::meters() const { return mMeters; }
@@ -0,0 +1,49 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Meter.h"
+
+// One I/O thread multiplexing every stream with epoll, and a pool of workers parsing them.
+// A meter always goes to the same worker, so its parser state is never shared.
+class Service
+{
+    struct Worker
+    {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<Meter *> queue;
+        std::thread thread;
+    };
+
+    std::vector<Meter *> mMeters;
+    std::vector<Meter *> mFiles;   // Regular files cannot be polled: read in turn
+    std::vector<Meter *> mStalled; // Ring full: not polled until the worker makes room
+    std::vector<Worker *> mWorkers;
+    int mEpoll;
+    unsigned int mOpen = 0;
+    std::atomic<bool> mRunning{true};
+    std::atomic<uint32_t> mDay{0};
+    std::atomic<unsigned int> mPending{0}; // Meters queued or being parsed
+
+    bool read(Meter *meter); // false at end of stream
+    void poll(Meter *meter, bool enable);
+    void schedule(Meter *meter);
+    void work(Worker *worker);
+    static uint32_t today();
+
+public:
+    Service(unsigned int workers);
+    ~Service();
+    void add(Meter *meter);
+    void run();  // Returns when every stream is over or stop() is called
+    void stop(); // Signal safe
+    const std::vector<Meter *> &meters() const;
+};
+
+#endif
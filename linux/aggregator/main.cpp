@@ -0,0 +1,260 @@
+/*
+ * TeleInfo multi-meter aggregator
+ *  Ingests many TIC streams (ttys, pipes or replay files) in one process and keeps per-meter
+ *  daily history and site totals.
+ *  GPL-3.0 License
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "Meter.h"
+#include "Service.h"
+#include "TicLine.h"
+
+static Service *service = nullptr;
+
+static uint64_t nowUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int openStream(const char *path, unsigned long speed)
+{
+    const int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0 || !isatty(fd))
+        return fd;
+    struct termios tio = {0};
+    cfmakeraw(&tio);
+    tio.c_cflag = (tio.c_cflag & ~CSIZE) | CS7 | PARENB | CLOCAL | CREAD; // 7E1
+    tio.c_iflag |= ISTRIP;
+    cfsetispeed(&tio, speed == 9600 ? B9600 : B1200);
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
+
+static void report(const std::vector<Meter *> &meters, double seconds, uint64_t &lastFrames)
+{
+    uint64_t power = 0, today = 0, yesterday = 0, frames = 0, bad = 0;
+    for (const Meter *meter : meters)
+    {
+        power += meter->totals.power.load(std::memory_order_relaxed);
+        today += meter->totals.today.load(std::memory_order_relaxed);
+        yesterday += meter->totals.yesterday.load(std::memory_order_relaxed);
+        frames += meter->totals.frames.load(std::memory_order_relaxed);
+        bad += meter->totals.badLines.load(std::memory_order_relaxed);
+    }
+    printf("site: %llu VA, today %llu Wh, yesterday %llu Wh, %.1f frames/s, %llu bad lines\n", (unsigned long long)power,
+           (unsigned long long)today, (unsigned long long)yesterday, (frames - lastFrames) / seconds, (unsigned long long)bad);
+    fflush(stdout);
+    lastFrames = frames;
+}
+
+// Historic frame whose ADCO carries the emission time in us, for the latency measurement
+static size_t benchFrame(char *out, uint32_t index)
+{
+    const auto line = [](char *out, const char *label, const char *value)
+    {
+        int len = sprintf(out, "\n%s %s ", label, value);
+        uint8_t sum = 0;
+        for (int i = 1; i < len - 1; ++i)
+            sum += out[i];
+        out[len++] = ((sum & 0x3F) + 0x20);
+        out[len++] = '\r';
+        return len;
+    };
+    char value[16];
+    size_t len = 0;
+    out[len++] = '\x02';
+    sprintf(value, "%09u", index);
+    len += line(out + len, "OPTARIF", "BASE");
+    len += line(out + len, "ISOUSC", "45");
+    len += line(out + len, "BASE", value);
+    len += line(out + len, "PTEC", "TH..");
+    len += line(out + len, "IINST", "012");
+    len += line(out + len, "IMAX", "090");
+    len += line(out + len, "PAPP", "02760");
+    len += line(out + len, "HHPHC", "A");
+    sprintf(value, "%012llu", (unsigned long long)(nowUs() % 1000000000000ULL));
+    len += line(out + len, "ADCO", value); // Last: stamped right before the write
+    out[len++] = '\x03';
+    return len;
+}
+
+// Streams fed by a generator thread through pipes, as fast as the service reads them
+static void bench(unsigned int maxStreams, unsigned int workers, double duration)
+{
+    printf("streams  workers  frames/s  latency p50 (us)  p99 (us)\n");
+    for (unsigned int count = 1; count <= maxStreams; count = count * 2 > maxStreams && count < maxStreams ? maxStreams : count * 2)
+    {
+        Service bench(workers);
+        std::vector<int> writers;
+        std::vector<Meter *> meters;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            int fds[2];
+            if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+                return;
+            Meter *meter = new Meter(i, fds[0], nullptr);
+            meter->benchmark = true;
+            meter->latencies.reserve(1 << 16);
+            meters.push_back(meter);
+            bench.add(meter);
+            writers.push_back(fds[1]);
+        }
+        std::atomic<bool> generating{true};
+        std::thread generator([&]
+                              {
+            char frame[512];
+            uint32_t index = 0;
+            const uint64_t end = nowUs() + (uint64_t)(duration * 1e6);
+            while (nowUs() < end)
+            {
+                ++index;
+                for (int fd : writers)
+                {
+                    const size_t len = benchFrame(frame, index);
+                    if (write(fd, frame, len) < 0)
+                        sched_yield(); // Pipe full: frame dropped, the reader is behind
+                }
+            }
+            for (int fd : writers)
+                close(fd);
+            generating = false; });
+        const uint64_t start = nowUs();
+        bench.run();
+        generator.join();
+        const double elapsed = (nowUs() - start) / 1e6;
+        uint64_t frames = 0;
+        std::vector<uint32_t> latencies;
+        for (Meter *meter : meters)
+        {
+            frames += meter->totals.frames;
+            latencies.insert(latencies.end(), meter->latencies.begin(), meter->latencies.end());
+            close(meter->fd);
+            delete meter;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        const auto percentile = [&](double p)
+        { return latencies.empty() ? 0 : latencies[(size_t)(p * (latencies.size() - 1))]; };
+        printf("%7u  %7u  %8.0f  %16u  %8u\n", count, workers, frames / elapsed, percentile(0.5), percentile(0.99));
+        fflush(stdout);
+        if (count == maxStreams)
+            break;
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] STREAM...\n"
+                    "  -w, --workers N      Parser threads (default: number of cores)\n"
+                    "  -s, --speed BAUDS    Speed of the tty streams, 1200 (default) or 9600\n"
+                    "  -H, --history DIR    Daily consumption of each meter appended to DIR/<address>.csv\n"
+                    "  -r, --report SECONDS Site totals period (default 10)\n"
+                    "  -b, --bench N        Benchmark from 1 to N generated streams instead of reading STREAMs\n"
+                    "  -d, --duration S     Duration of each benchmark step (default 5)\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int workers = std::max(1U, std::thread::hardware_concurrency());
+    unsigned long speed = 1200;
+    const char *historyDir = nullptr;
+    double reportPeriod = 10;
+    unsigned int benchStreams = 0;
+    double duration = 5;
+
+    static const struct option options[] = {{"workers", required_argument, nullptr, 'w'},
+                                            {"speed", required_argument, nullptr, 's'},
+                                            {"history", required_argument, nullptr, 'H'},
+                                            {"report", required_argument, nullptr, 'r'},
+                                            {"bench", required_argument, nullptr, 'b'},
+                                            {"duration", required_argument, nullptr, 'd'},
+                                            {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "w:s:H:r:b:d:", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 'w':
+            workers = std::max(1UL, strtoul(optarg, nullptr, 10));
+            break;
+        case 's':
+            speed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'H':
+            historyDir = optarg;
+            break;
+        case 'r':
+            reportPeriod = atof(optarg);
+            break;
+        case 'b':
+            benchStreams = strtoul(optarg, nullptr, 10);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (benchStreams != 0)
+    {
+        bench(benchStreams, workers, duration);
+        return 0;
+    }
+    if (optind == argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    service = new Service(workers);
+    for (int i = optind; i < argc; ++i)
+    {
+        const int fd = openStream(argv[i], speed);
+        if (fd < 0)
+        {
+            perror(argv[i]);
+            continue;
+        }
+        service->add(new Meter(i - optind, fd, historyDir));
+    }
+    signal(SIGINT, [](int)
+           { service->stop(); });
+    signal(SIGTERM, [](int)
+           { service->stop(); });
+
+    std::atomic<bool> running{true};
+    std::thread reporter([&]
+                         {
+        uint64_t frames = 0;
+        uint64_t last = nowUs();
+        while (running)
+        {
+            usleep(100000);
+            if (nowUs() - last >= reportPeriod * 1e6)
+            {
+                report(service->meters(), (nowUs() - last) / 1e6, frames);
+                last = nowUs();
+            }
+        } });
+    const uint64_t start = nowUs();
+    service->run();
+    running = false;
+    reporter.join();
+    uint64_t frames = 0;
+    report(service->meters(), (nowUs() - start) / 1e6, frames);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <Arduino.h>
+#include <hardware/flash.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+
+// The RP2040 linker script brackets the filesystem region with _FS_start and _FS_end, the EEPROM sector follows
+extern "C"
+{
+    __attribute__((aligned(FLASH_SECTOR_SIZE))) uint8_t linuxFlash[LINUX_FS_SIZE + FLASH_SECTOR_SIZE];
+}
+asm(".globl _FS_start\n.set _FS_start, linuxFlash\n.globl _FS_end\n.set _FS_end, linuxFlash + " TOSTRING(LINUX_FS_SIZE) "\n"
+    ".globl _EEPROM_start\n.set _EEPROM_start, linuxFlash + " TOSTRING(LINUX_FS_SIZE));
+
+static int flashFd = -1;
+static const char *eepromPath = nullptr;
+
+// Sector erase started by flash_do_cmd(): runs while not suspended, for LINUX_ERASE_TIME
+static struct
+{
+    uint32_t sector = 0xffffffff; // Offset in region, none if 0xffffffff
+    uint32_t left;                // In us
+    uint32_t resumed;             // micros() at the start or resume, 0 when suspended
+    bool writeEnabled = false;
+} erase;
+
+// TicCapture passes the region address truncated to 32 bits
+static uint32_t regionOffset(uint32_t flash_offs) { return flash_offs - (uint32_t)(uintptr_t)linuxFlash; }
+
+// Snapshot and EEPROM sectors: written aside then renamed, the previous file stays valid if the process is killed
+// meanwhile
+static void mirrorEeprom()
+{
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", eepromPath);
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    const bool written = write(fd, linuxFlash + LINUX_SNAPSHOT_SECTOR, 2 * FLASH_SECTOR_SIZE) == 2 * FLASH_SECTOR_SIZE;
+    close(fd);
+    if (written)
+        rename(tmp, eepromPath);
+}
+
+static void mirror(uint32_t offset, size_t count)
+{
+    if (offset + count > LINUX_SNAPSHOT_SECTOR)
+    {
+        if (eepromPath)
+            mirrorEeprom();
+        if (offset >= LINUX_SNAPSHOT_SECTOR)
+            return;
+        count = LINUX_SNAPSHOT_SECTOR - offset;
+    }
+    if (flashFd >= 0)
+        pwrite(flashFd, linuxFlash + offset, count, offset);
+}
+
+void flash_eeprom_file(const char *path)
+{
+    eepromPath = path;
+    memset(linuxFlash + LINUX_SNAPSHOT_SECTOR, 0xff, 2 * FLASH_SECTOR_SIZE); // Erased flash
+    const int fd = path ? open(path, O_RDONLY) : -1;
+    if (fd < 0)
+        return;
+    if (read(fd, linuxFlash + LINUX_SNAPSHOT_SECTOR, 2 * FLASH_SECTOR_SIZE) < 0)
+        memset(linuxFlash + LINUX_SNAPSHOT_SECTOR, 0xff, 2 * FLASH_SECTOR_SIZE);
+    close(fd);
+}
+
+void flash_file(const char *path)
+{
+    memset(linuxFlash, 0xff, LINUX_SNAPSHOT_SECTOR);
+    if (flashFd >= 0)
+        close(flashFd); // Loaded again: power cut of the history simulation
+    flashFd = -1;
+    if (!path)
+        return; // Capture kept in memory only
+    flashFd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flashFd < 0)
+        return;
+    if (pread(flashFd, linuxFlash, LINUX_SNAPSHOT_SECTOR, 0) != LINUX_SNAPSHOT_SECTOR)
+    { // New or truncated file
+        memset(linuxFlash, 0xff, LINUX_SNAPSHOT_SECTOR);
+        mirror(0, LINUX_SNAPSHOT_SECTOR);
+    }
+}
+
+// Completes the erase once it has run long enough
+static bool eraseBusy()
+{
+    if (erase.sector == 0xffffffff || erase.resumed == 0)
+        return false;
+    if (micros() - erase.resumed < erase.left)
+        return true;
+    memset(linuxFlash + erase.sector, 0xff, FLASH_SECTOR_SIZE);
+    mirror(erase.sector, FLASH_SECTOR_SIZE);
+    erase.sector = 0xffffffff;
+    return false;
+}
+
+extern "C" void flash_do_cmd(const uint8_t *txbuf, uint8_t *rxbuf, size_t count)
+{
+    memset(rxbuf, 0xff, count);
+    const bool busy = eraseBusy();
+    switch (txbuf[0])
+    {
+    case 0x06: // Write enable
+        erase.writeEnabled = !busy;
+        break;
+    case 0x20: // Sector erase, 24 bits address
+        if (count == 4 && erase.writeEnabled && erase.sector == 0xffffffff)
+        { // The region address wraps at 24 bits as at 32
+            const uint32_t offset = regionOffset((txbuf[1] << 16) | (txbuf[2] << 8) | txbuf[3]) & 0xffffff & ~(FLASH_SECTOR_SIZE - 1);
+            if (offset < sizeof(linuxFlash))
+                erase = {offset, LINUX_ERASE_TIME, micros() | 1, false};
+        }
+        erase.writeEnabled = false;
+        break;
+    case 0x75: // Suspend
+        if (busy)
+        {
+            erase.left -= micros() - erase.resumed;
+            erase.resumed = 0;
+        }
+        break;
+    case 0x7a: // Resume
+        if (erase.sector != 0xffffffff && erase.resumed == 0)
+            erase.resumed = micros() | 1;
+        break;
+    case 0x05: // Status register 1
+        if (count > 1)
+            rxbuf[1] = busy ? 0x01 : 0x00;
+        break;
+    case 0x35: // Status register 2
+        if (count > 1)
+            rxbuf[1] = erase.sector != 0xffffffff && erase.resumed == 0 ? 0x80 : 0x00;
+        break;
+    }
+}
+
+extern "C" void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    const uint32_t offset = regionOffset(flash_offs);
+    if (offset + count > sizeof(linuxFlash))
+        return;
+    memset(linuxFlash + offset, 0xff, count);
+    mirror(offset, count);
+}
+
+extern "C" void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    const uint32_t offset = regionOffset(flash_offs);
+    if (offset + count > sizeof(linuxFlash))
+        return;
+    for (size_t i = 0; i < count; ++i)
+        linuxFlash[offset + i] &= data[i]; // Programming only clears bits
+    mirror(offset, count);
+}
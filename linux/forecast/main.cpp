@@ -0,0 +1,172 @@
+/*
+ * TeleInfo overload forecast replay
+ *  Replays recorded TIC streams through the early overload warning (see OverloadPredictor) and measures
+ *  its lead time on ADPS and its false alarm rate.
+ *  GPL-3.0 License
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OverloadPredictor.h"
+#include "TicLine.h"
+#include "TicReplay.h"
+
+struct Stats
+{
+    uint32_t isousc = 0;
+    uint32_t amps[FORECAST_PHASES] = {0};
+    bool overload = false;
+    uint32_t warningSince = 0;
+    bool warningHit = false; // An overload started while the warning was on
+    // Results
+    unsigned overloads = 0, anticipated = 0, warnings = 0, falseAlarms = 0;
+    uint64_t leadSum = 0;
+    uint32_t leadMin = UINT32_MAX, leadMax = 0;
+    uint32_t first = 0, last = 0;
+};
+
+static OverloadPredictor predictor;
+static bool verbose = false;
+
+static void line(void *context, const char *begin, const char *end, uint32_t time)
+{
+    Stats &stats = *(Stats *)context;
+    if (!TicLine::validHistoric(begin, end))
+        return;
+    stats.last = time;
+    const char *value;
+    if ((value = TicLine::value(begin, end, "ISOUSC ")))
+    {
+        stats.isousc = TicLine::number(value, end);
+        return;
+    }
+    int phase;
+    if ((value = TicLine::value(begin, end, "IINST ")))
+        phase = 0;
+    else if ((value = TicLine::value(begin, end, "IINST1 ")) || (value = TicLine::value(begin, end, "IINST2 ")) || (value = TicLine::value(begin, end, "IINST3 ")))
+        phase = begin[5] - '0';
+    else
+        return;
+    stats.amps[phase] = TicLine::number(value, end);
+
+    if (predictor.sample(phase, stats.amps[phase], stats.isousc, time))
+    {
+        if (predictor.warning())
+        {
+            ++stats.warnings;
+            stats.warningSince = time;
+            stats.warningHit = stats.overload; // Raised during an overload: late, not false
+            if (verbose)
+                printf("%10.1f s  warning, limit in %u ms\n", time / 1000.0, predictor.timeToLimit());
+        }
+        else
+        {
+            if (!stats.warningHit)
+                ++stats.falseAlarms;
+            if (verbose)
+                printf("%10.1f s  warning cleared%s\n", time / 1000.0, stats.warningHit ? "" : " (false alarm)");
+        }
+    }
+
+    // ADPS condition, as TeleInfo::updateAdps
+    uint32_t max = 0;
+    for (int i = 0; i < FORECAST_PHASES; ++i)
+        max = stats.amps[i] > max ? stats.amps[i] : max;
+    const bool overload = stats.isousc != 0 && max > stats.isousc;
+    if (overload && !stats.overload)
+    {
+        ++stats.overloads;
+        if (predictor.warning())
+            stats.warningHit = true;
+        if (predictor.warning() && stats.warningSince < time)
+        {
+            const uint32_t lead = time - stats.warningSince;
+            ++stats.anticipated;
+            stats.leadSum += lead;
+            stats.leadMin = lead < stats.leadMin ? lead : stats.leadMin;
+            stats.leadMax = lead > stats.leadMax ? lead : stats.leadMax;
+            if (verbose)
+                printf("%10.1f s  overload %u A, lead %u ms\n", time / 1000.0, max, lead);
+        }
+        else if (verbose)
+            printf("%10.1f s  overload %u A, not anticipated\n", time / 1000.0, max);
+    }
+    stats.overload = overload;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] FILE...\n"
+                    "  Replays historic TIC files, raw or exported by \"capture dump\", one after the other\n"
+                    "  -t, --threshold PCT  Warning threshold in %% of ISOUSC (default 90)\n"
+                    "  -H, --horizon S      Forecast horizon in seconds (default 10)\n"
+                    "  -s, --speed BAUDS    Speed of the raw files (default 1200)\n"
+                    "  -v, --verbose        Print each warning and overload\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long threshold = 90, horizon = 10, speed = 1200;
+    static const struct option options[] = {{"threshold", required_argument, nullptr, 't'},
+                                            {"horizon", required_argument, nullptr, 'H'},
+                                            {"speed", required_argument, nullptr, 's'},
+                                            {"verbose", no_argument, nullptr, 'v'},
+                                            {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "t:H:s:v", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 't':
+            threshold = strtoul(optarg, nullptr, 10);
+            break;
+        case 'H':
+            horizon = strtoul(optarg, nullptr, 10);
+            break;
+        case 's':
+            speed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || threshold == 0 || speed == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    predictor.configure(threshold, horizon);
+
+    Stats stats;
+    TicReplay replay(speed, line, &stats);
+    for (int i = optind; i < argc; ++i)
+    {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        if (!replay.replay(file))
+            fprintf(stderr, "%s: unsupported capture\n", argv[i]);
+        fclose(file);
+    }
+
+    const double hours = (stats.last - stats.first) / 3600000.0;
+    printf("replayed %.2f h, threshold %lu%% of ISOUSC, horizon %lu s\n", hours, threshold, horizon);
+    printf("overloads: %u, anticipated: %u", stats.overloads, stats.anticipated);
+    if (stats.anticipated != 0)
+        printf(", lead time: mean %.1f s, min %.1f s, max %.1f s", stats.leadSum / 1000.0 / stats.anticipated, stats.leadMin / 1000.0, stats.leadMax / 1000.0);
+    printf("\nwarnings: %u, false alarms: %u", stats.warnings, stats.falseAlarms);
+    if (hours > 0)
+        printf(" (%.2f per hour)", stats.falseAlarms / hours);
+    printf("\n");
+    return 0;
+}
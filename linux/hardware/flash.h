@@ -0,0 +1,24 @@
+#ifndef LINUX_HARDWARE_FLASH_H
+#define LINUX_HARDWARE_FLASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Filesystem region (_FS_start to _FS_end) and EEPROM emulation sector (_EEPROM_start, right after as on the
+// RP2040) held in RAM. The capture ring and the archive go to a file, the snapshot sector at the end of the
+// filesystem region and the EEPROM sector to another one
+#define XIP_BASE 0
+#define FLASH_PAGE_SIZE 256u
+#define FLASH_SECTOR_SIZE 4096u
+#define LINUX_FS_SIZE (1024 * 1024) // As board_build.filesystem_size
+#define LINUX_SNAPSHOT_SECTOR (LINUX_FS_SIZE - FLASH_SECTOR_SIZE) // As SNAPSHOT_SECTOR_SIZE
+#define LINUX_ERASE_TIME 45000      // In us: typical sector erase of the W25Q flash, for the erases by commands
+
+extern "C" void flash_range_erase(uint32_t flash_offs, size_t count);
+extern "C" void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+// Write enable, sector erase, suspend and resume, status registers 1 (busy) and 2 (erase suspended)
+extern "C" void flash_do_cmd(const uint8_t *txbuf, uint8_t *rxbuf, size_t count);
+void flash_file(const char *path); // Capture ring and archive, nullptr: not persisted
+void flash_eeprom_file(const char *path); // Snapshot and EEPROM emulation sectors, written atomically
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef LINUX_HARDWARE_TIMER_H
+#define LINUX_HARDWARE_TIMER_H
+
+#include <Arduino.h>
+
+// Microsecond timer of the RP2040
+inline uint32_t time_us_32() { return micros(); }
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef LINUX_KNX_H
+#define LINUX_KNX_H
+
+// The knx library has no predefined instance on Linux: the daemon is a KNXnet/IP device (mask 0x57B0)
+#include_next <knx.h>
+#include <linux_platform.h>
+#include <knx/bau57B0.h>
+
+extern KnxFacade<LinuxPlatform, Bau57B0> knx;
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * TeleInfo KNX - Linux gateway daemon
+ *  Runs the firmware core (TeleInfo + RTCKnx) as a KNXnet/IP routing device.
+ *  TIC is read from a tty or replayed from a file, history is kept in a file.
+ *  GPL-3.0 License
+ */
+
+#include <Arduino.h>
+#include <knx.h>
+#include <EEPROM.h>
+#include <hardware/flash.h>
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "HeapTrack.h"
+#include "RTCKnx.h"
+#include "TeleInfo.h"
+#include "FlashWriter.h"
+
+#define VERSION_MAJOR 1
+#define VERSION_MINOR 0
+
+#define TELEINFO_UART_SPEED 1200
+#define TELEINFO_UART_CONFIG SERIAL_7E1
+
+KnxFacade<LinuxPlatform, Bau57B0> knx;
+
+static volatile sig_atomic_t running = true;
+static volatile sig_atomic_t progMode = false;
+static bool ready = false; // Configured with tables large enough
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "  -t, --tic PATH      TIC tty or replay files: FILE[@BAUDS][,FILE[@BAUDS]...] (default /dev/ttyUSB0),\n"
+                    "                      raw or exported by \"capture dump\" (replayed at the recorded times and dates)\n"
+                    "  -s, --speed BAUDS   First TIC speed probed, 1200 (historic, default) or 9600 (standard)\n"
+                    "  -f, --fast          Replay the file as fast as possible, not at the TIC speed or the recorded times\n"
+                    "  -H, --history FILE  History and state file (default teleinfo.bin)\n"
+                    "  -c, --capture FILE  Flash region file: TIC capture and energy archive (default: not persisted)\n"
+                    "  -k, --knx FILE      KNX configuration file (default flash.bin)\n"
+                    "  -r, --readout FILE  Bulk readout of the snapshot into FILE on exit, as a client would\n"
+                    "  -i, --import FILE   Import the history from FILE (period start indexes, 6 per tariff line: today, yesterday,\n"
+                    "                      this month, last month, this year, last year) once the meter and the clock are known\n"
+                    "  -m, --heap-check    Count the heap allocations of the TeleInfo and clock loops, fail if any\n"
+                    "  -b, --bench         Print on exit the cycles per label update (direct payload and KNXValue)\n"
+                    "                      and the longest TeleInfo and clock call, between two knx.loop(), and flash step,\n"
+                    "                      and the time from the IINST line to the overload telegram taken by the stack\n"
+                    "SIGUSR1 toggles the KNX programming mode, SIGINT/SIGTERM save the state and exit.\n",
+            name);
+}
+
+// Same exchange as a client on the bus: command, then state reads of one standard frame each
+static void readout(TeleInfo &teleinfo, const char *path)
+{
+    uint8_t result[1 + READOUT_STANDARD_SEGMENT];
+    uint8_t resultLength = sizeof(result);
+    if (!teleinfo.readoutCommand(0, nullptr, result, resultLength) || result[0] != 0)
+        return;
+    const uint16_t size = (result[1] << 8) | result[2];
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return;
+    }
+    unsigned int segments = 0;
+    for (uint16_t offset = 0; offset < size; offset += resultLength - 1, ++segments)
+    {
+        const uint8_t request[3] = {(uint8_t)(offset >> 8), (uint8_t)offset, sizeof(result) - 1};
+        resultLength = sizeof(result);
+        if (!teleinfo.readoutState(sizeof(request), request, result, resultLength) || result[0] != 0)
+            break;
+        fwrite(result + 1, 1, resultLength - 1, file);
+    }
+    fclose(file);
+    fprintf(stderr, "Readout: %u bytes in %u segments\n", size, segments);
+}
+
+// Same exchange as a client on the bus: the staged indexes are written 2 at a time (standard frames), then committed.
+// Returns the result code of the commit, TeleInfo::ImportNotReady until the meter index and the clock are known
+static uint8_t importHistory(TeleInfo &teleinfo, const uint32_t indexes[], unsigned int count)
+{
+    uint8_t request[10] = {0 /* ImportBegin */};
+    uint8_t result[1];
+    uint8_t resultLength = sizeof(result);
+    if (!teleinfo.historyImportCommand(1, request, result, resultLength) || result[0] != 0)
+        return result[0];
+    for (unsigned int slot = 0; slot < count; slot += 2)
+    {
+        const unsigned int n = MIN(2U, count - slot);
+        request[0] = 1; // ImportWrite
+        request[1] = slot;
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            request[2 + 4 * i] = indexes[slot + i] >> 24;
+            request[3 + 4 * i] = indexes[slot + i] >> 16;
+            request[4 + 4 * i] = indexes[slot + i] >> 8;
+            request[5 + 4 * i] = indexes[slot + i];
+        }
+        resultLength = sizeof(result);
+        if (!teleinfo.historyImportCommand(2 + 4 * n, request, result, resultLength) || result[0] != 0)
+            return result[0];
+    }
+    request[0] = 2; // ImportCommit
+    resultLength = sizeof(result);
+    teleinfo.historyImportCommand(1, request, result, resultLength);
+    return result[0];
+}
+
+int main(int argc, char **argv)
+{
+    const char *ticPath = "/dev/ttyUSB0";
+    const char *historyPath = "teleinfo.bin";
+    const char *capturePath = nullptr;
+    const char *knxPath = nullptr;
+    const char *readoutPath = nullptr;
+    const char *importPath = nullptr;
+    unsigned long speed = TELEINFO_UART_SPEED;
+    bool fast = false;
+    bool heapCheck = false;
+    bool bench = false;
+    uint32_t longestSlice = 0;
+    // Overload telegrams, from the CR of their IINST line to the stack taking them
+    uint32_t adpsValue = 0, adpsSince = 0, adpsCount = 0, adpsMax = 0;
+    uint64_t adpsTotal = 0;
+
+    static const struct option options[] = {{"tic", required_argument, nullptr, 't'},
+                                            {"speed", required_argument, nullptr, 's'},
+                                            {"fast", no_argument, nullptr, 'f'},
+                                            {"history", required_argument, nullptr, 'H'},
+                                            {"capture", required_argument, nullptr, 'c'},
+                                            {"knx", required_argument, nullptr, 'k'},
+                                            {"readout", required_argument, nullptr, 'r'},
+                                            {"import", required_argument, nullptr, 'i'},
+                                            {"heap-check", no_argument, nullptr, 'm'},
+                                            {"bench", no_argument, nullptr, 'b'},
+                                            {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "t:s:fH:c:k:r:i:mb", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 't':
+            ticPath = optarg;
+            break;
+        case 's':
+            speed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'f':
+            fast = true;
+            break;
+        case 'H':
+            historyPath = optarg;
+            break;
+        case 'c':
+            capturePath = optarg;
+            break;
+        case 'k':
+            knxPath = optarg;
+            break;
+        case 'r':
+            readoutPath = optarg;
+            break;
+        case 'i':
+            importPath = optarg;
+            break;
+        case 'm':
+            heapCheck = true;
+            break;
+        case 'b':
+            bench = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    uint32_t importIndexes[3 * HISTORY_PERIODS];
+    unsigned int importCount = 0;
+    if (importPath)
+    {
+        FILE *file = fopen(importPath, "r");
+        if (!file)
+        {
+            perror(importPath);
+            return 1;
+        }
+        for (unsigned long v; importCount < sizeof(importIndexes) / sizeof(importIndexes[0]) && fscanf(file, "%lu", &v) == 1;)
+            importIndexes[importCount++] = v;
+        fclose(file);
+    }
+
+    signal(SIGINT, [](int) { running = false; });
+    signal(SIGTERM, [](int) { running = false; });
+    signal(SIGUSR1, [](int) { progMode = !progMode; });
+
+    EEPROM.begin(historyPath);
+    flash_file(capturePath);
+
+    static RTCKnx rtc;
+    static SerialUART serialTeleInfo(ticPath, fast);
+    static TeleInfo teleinfo(&rtc, &serialTeleInfo, speed, TELEINFO_UART_CONFIG);
+    // No RAM survives a restart here: the snapshot is always restored from the history file
+    static TeleInfo::Snapshot snapshot;
+    teleinfo.restoreSnapshot(&snapshot);
+
+    knx.platform().cmdLineArgs(argc, argv); // A restart requested by ETS re-executes the daemon
+    if (knxPath)
+        knx.platform().flashFilePath(knxPath);
+    knx.version((VERSION_MAJOR << 6) | (VERSION_MINOR & 0x3F));
+    knx.orderNumber((const uint8_t *)"ZDI-TINFO1");
+    knx.manufacturerId(0xfa);
+    knx.hardwareType((const uint8_t *)"M-57B0");
+    knx.bau().beforeRestartCallback([]() { teleinfo.saveSnapshot(); });
+    knx.bau().functionPropertyCallback([](uint8_t objectIndex, uint8_t propertyId, uint8_t length, uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+                                       { return objectIndex == READOUT_OBJECT_INDEX && ready &&
+                                                (propertyId == ARCHIVE_PROPERTY_ID          ? teleinfo.archive().queryCommand(length, data, resultData, resultLength)
+                                                 : propertyId == HISTORY_IMPORT_PROPERTY_ID ? teleinfo.historyImportCommand(length, data, resultData, resultLength)
+                                                                                            : propertyId == READOUT_PROPERTY_ID && teleinfo.readoutCommand(length, data, resultData, resultLength)); });
+    knx.bau().functionPropertyStateCallback([](uint8_t objectIndex, uint8_t propertyId, uint8_t length, uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+                                            { return objectIndex == READOUT_OBJECT_INDEX && propertyId == READOUT_PROPERTY_ID && ready &&
+                                                     teleinfo.readoutState(length, data, resultData, resultLength); });
+    knx.readMemory();
+
+    // As the firmware: not run with tables downloaded from an older product database
+    const auto configure = []()
+    {
+        uint8_t mcb[8]; // Segment size (4 bytes, big endian), CRC control, access, CRC
+        uint8_t count = 1;
+        knx.bau().parameters().readProperty(PID_MCB_TABLE, 1, count, mcb);
+        const uint32_t size = (uint32_t)mcb[0] << 24 | (uint32_t)mcb[1] << 16 | mcb[2] << 8 | mcb[3];
+        const uint16_t objects = knx.bau().groupObjectTable().entryCount();
+        if (objects < RTCKnx::NBGO + TeleInfo::NBGO || (count != 0 && size < RTCKnx::SIZEPARAMS + TeleInfo::SIZEPARAMS))
+        {
+            fprintf(stderr, "Downloaded tables too short (%u group objects, %u parameter bytes, %u and %u expected): update the product database\n",
+                    objects, count != 0 ? size : 0, RTCKnx::NBGO + TeleInfo::NBGO, RTCKnx::SIZEPARAMS + TeleInfo::SIZEPARAMS);
+            return false;
+        }
+        rtc.init(0, 0);
+        teleinfo.init(RTCKnx::SIZEPARAMS, RTCKnx::NBGO);
+        rtc.setNotifier<TeleInfo, &TeleInfo::newDate>(&teleinfo);
+        return true;
+    };
+    bool configured = knx.configured();
+    ready = configured && configure();
+    if (!configured)
+        fprintf(stderr, "Not configured: send SIGUSR1 to enter programming mode and download with ETS\n");
+    knx.start();
+
+    bool prog = false;
+    TicMode::Mode mode = TicMode::Unknown;
+    uint32_t modeSince = millis();
+    uint32_t importTry = millis();
+    while (running)
+    {
+        if (prog != progMode)
+        {
+            prog = progMode;
+            knx.progMode(prog);
+        }
+        knx.loop();
+        if (adpsSince && knx.getGroupObject(teleinfo.adpsGroupObject()).commFlag() != WriteRequest)
+        {
+            const uint32_t latency = micros() - adpsSince;
+            ++adpsCount;
+            adpsTotal += latency;
+            adpsMax = MAX(adpsMax, latency);
+            adpsSince = 0;
+        }
+        if (knx.configured() != configured)
+        {
+            configured = !configured;
+            ready = configured && configure(); // ETS download completed
+        }
+        if (ready)
+        {
+            HeapTrack::arm(heapCheck);
+            const uint32_t sliceStart = micros();
+            teleinfo.loop();
+            rtc.loop();
+            longestSlice = MAX(longestSlice, micros() - sliceStart); // Delay of the next knx.loop()
+            HeapTrack::arm(false);
+            if (bench)
+            { // Queued by the fast path on a new value, the repeat while overloaded keeps it
+                GroupObject &adps = knx.getGroupObject(teleinfo.adpsGroupObject());
+                const uint32_t value = adps.value();
+                if (value != adpsValue && adps.commFlag() == WriteRequest)
+                    adpsSince = serialTeleInfo.lineReceived() | 1;
+                adpsValue = value;
+            }
+            uint16_t recorded[6];
+            if (serialTeleInfo.captureDate(recorded))
+            { // Capture replay: the clock follows the recorded one, as a meter time source
+                rtc.timeSource(RTCKnx::MeterOnly);
+                rtc.meterTime(RTCKnx::DateTime{recorded[0], recorded[1], recorded[2], recorded[3], recorded[4], recorded[5]});
+            }
+            if (importPath && millis() - importTry >= 1000)
+            {
+                importTry = millis();
+                const uint8_t result = importHistory(teleinfo, importIndexes, importCount);
+                if (result != 2 /* ImportNotReady */)
+                {
+                    fprintf(stderr, "History import: %s\n", result == 0 ? "done" : result == 3 ? "incomplete" : "rejected");
+                    importPath = nullptr;
+                }
+            }
+            if (teleinfo.ticMode() != mode)
+            { // Time to lock from the start or from the loss of the previous mode
+                mode = teleinfo.ticMode();
+                fprintf(stderr, "TIC mode: %s after %u ms\n", mode == TicMode::Historic ? "historic" : mode == TicMode::Standard ? "standard" : "lost",
+                        millis() - modeSince);
+                modeSince = millis();
+            }
+        }
+        if (serialTeleInfo.eof())
+            break; // Replay over
+        if (!fast)
+            usleep(1000);
+    }
+
+    if (ready && readoutPath)
+        readout(teleinfo, readoutPath);
+    if (ready && bench)
+    {
+        TeleInfo::EncodeCost cost;
+        for (unsigned int i = 0; i < TeleInfo::TeleInfoCount; ++i)
+            if (teleinfo.encodeCost(i, cost))
+                fprintf(stderr, "%-9s%6u %6u\n", cost.key, cost.direct, cost.generic);
+        fprintf(stderr, "Longest TeleInfo and clock call: %u us\n", longestSlice);
+        fprintf(stderr, "ADPS from the IINST line to the stack: %u telegrams, %u us on average, %u us at most\n", adpsCount,
+                adpsCount ? (uint32_t)(adpsTotal / adpsCount) : 0, adpsMax);
+        fprintf(stderr, "Longest flash step: %u us\n", FlashWriter::longest(false));
+    }
+    if (ready)
+        teleinfo.saveSnapshot();
+    if (heapCheck)
+    {
+        fprintf(stderr, "Heap: %u allocations (%u bytes) in the TeleInfo and clock loops\n", HeapTrack::allocations(), HeapTrack::bytes());
+        if (HeapTrack::allocations() != 0)
+            return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * TeleInfo bulk readout decoder
+ *  Decodes the state read through the readout function property (see TeleInfo::readoutCommand)
+ *  and estimates its transfer time on a TP1 line against one group read per group object.
+ *  GPL-3.0 License
+ */
+
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define READOUT_VERSION 1 // As TeleInfo.h
+#define LABELCOUNT 29
+#define TARIFCOUNT 3
+#define ROLLING_WINDOWS 3              // As RollingConsumption.h: 24 hours, 7 days, 30 days
+#define STANDARD_SEGMENT 11            // As TeleInfo.h: state read response in a standard frame (15 APDU octets)
+#define MAX_SEGMENT 31                 // Result buffer of the KNX stack (32 bytes with the return code), extended frame
+
+// Mirror of TeleInfo::Readout on a little endian 32 bits target (RP2040), checked with its size field
+struct DateTime
+{
+    uint16_t sec, min, hour, mday, mon, year;
+};
+struct Readout
+{
+    uint16_t version;
+    uint16_t size;
+    struct
+    {
+        union
+        {
+            char str[13];
+            uint32_t num;
+        } value;
+        uint32_t lastSendValueCheckSum;
+    } data[LABELCOUNT];
+    struct
+    {
+        DateTime lastSave;
+        struct
+        {
+            uint32_t index, yesterday, lastMonth, lastYear, dayM2, monthM2, yearM2;
+        } tariff[TARIFCOUNT];
+    } history;
+    uint32_t historyLastValue[TARIFCOUNT];
+    struct
+    {
+        DateTime day;
+        uint64_t today, yesterday, thisMonth, lastMonth, thisYear, lastYear;
+    } cost;
+    uint32_t rolling[TARIFCOUNT][ROLLING_WINDOWS];
+    struct
+    {
+        int64_t ms;
+        int32_t freqPpb;
+        uint32_t timer;
+    } rtc;
+    uint32_t crc;
+};
+
+enum Type
+{
+    INT,
+    STRING,
+    FOURCC,
+    CHAR
+};
+// TeleInfo::TeleInfoParam order, with the group object value size for the bus estimate
+static const struct
+{
+    const char *label;
+    Type type;
+    uint8_t goSize;
+} Labels[LABELCOUNT] = {{"ADCO", STRING, 14}, {"OPTARIF", FOURCC, 1}, {"ISOUSC", INT, 2}, {"BASE", INT, 4}, {"HCHC", INT, 4}, {"HCHP", INT, 4}, {"EJPHN", INT, 4}, {"EJPHPM", INT, 4}, {"BBRHCJB", INT, 4}, {"BBRHPJB", INT, 4}, {"BBRHCJW", INT, 4}, {"BBRHPJW", INT, 4}, {"BBRHCJR", INT, 4}, {"BBRHPJR", INT, 4}, {"PEJP", INT, 2}, {"PTEC", FOURCC, 1}, {"DEMAIN", FOURCC, 1}, {"IINST", INT, 2}, {"ADPS", INT, 2}, {"IMAX", INT, 2}, {"PAPP", INT, 2}, {"HHPHC", CHAR, 1}, {"IINST1", INT, 2}, {"IINST2", INT, 2}, {"IINST3", INT, 2}, {"IMAX1", INT, 2}, {"IMAX2", INT, 2}, {"IMAX3", INT, 2}, {"PMAX", INT, 2}};
+static const char *const Tariffs[TARIFCOUNT] = {"Base", "HC", "HP"};
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void printDate(const char *name, const DateTime &dt)
+{
+    printf("%s: %04u-%02u-%02u %02u:%02u:%02u\n", name, dt.year, dt.mon + 1, dt.mday, dt.hour, dt.min, dt.sec);
+}
+
+static int decode(const std::vector<uint8_t> &bytes)
+{
+    Readout s;
+    if (bytes.size() < sizeof(s))
+    {
+        fprintf(stderr, "Readout too short: %zu bytes, %zu expected\n", bytes.size(), sizeof(s));
+        return 1;
+    }
+    memcpy(&s, bytes.data(), sizeof(s));
+    if (s.version != READOUT_VERSION || s.size != sizeof(s))
+    {
+        fprintf(stderr, "Unsupported readout: version %u size %u, expected version %u size %zu\n", s.version, s.size, READOUT_VERSION, sizeof(s));
+        return 1;
+    }
+    if (s.crc != crc32(bytes.data(), offsetof(Readout, crc)))
+    {
+        fprintf(stderr, "Bad readout CRC\n");
+        return 1;
+    }
+    for (int i = 0; i < LABELCOUNT; ++i)
+    {
+        const auto &value = s.data[i].value;
+        switch (Labels[i].type)
+        {
+        case INT:
+            printf("%s: %u\n", Labels[i].label, value.num);
+            break;
+        case STRING:
+            printf("%s: %.12s\n", Labels[i].label, value.str);
+            break;
+        case FOURCC:
+        {
+            char fourcc[5] = {0};
+            for (int c = 0, shift = 24; shift >= 0; shift -= 8) // Leading bytes are 0 in short values
+                if ((value.num >> shift) & 0xff)
+                    fourcc[c++] = value.num >> shift;
+            printf("%s: %s\n", Labels[i].label, fourcc);
+            break;
+        }
+        case CHAR:
+            printf("%s: %c\n", Labels[i].label, (char)value.num);
+            break;
+        }
+    }
+    printDate("History saved", s.history.lastSave);
+    for (int i = 0; i < TARIFCOUNT; ++i)
+    {
+        const auto &t = s.history.tariff[i];
+        if (t.index == 0)
+            continue;
+        printf("%s: index %u Wh, today %u, yesterday %u, this month %u, last month %u, this year %u, last year %u\n", Tariffs[i], t.index,
+               t.index - t.yesterday, t.yesterday - t.dayM2, t.index - t.lastMonth, t.lastMonth - t.monthM2, t.index - t.lastYear, t.lastYear - t.yearM2);
+    }
+    printDate("Cost day", s.cost.day);
+    printf("Cost (cents): today %llu, yesterday %llu, this month %llu, last month %llu, this year %llu, last year %llu\n",
+           (unsigned long long)(s.cost.today / 100000), (unsigned long long)(s.cost.yesterday / 100000), (unsigned long long)(s.cost.thisMonth / 100000),
+           (unsigned long long)(s.cost.lastMonth / 100000), (unsigned long long)(s.cost.thisYear / 100000), (unsigned long long)(s.cost.lastYear / 100000));
+    for (int i = 0; i < TARIFCOUNT; ++i)
+        if (s.rolling[i][ROLLING_WINDOWS - 1] != 0)
+            printf("%s: last 24 hours %u Wh, last 7 days %u, last 30 days %u\n", Tariffs[i], s.rolling[i][0], s.rolling[i][1], s.rolling[i][2]);
+    printf("Clock: %s, frequency %+.3f ppm\n", s.rtc.ms >= 0 ? "synchronised" : "not synchronised", s.rtc.freqPpb / 1000.0);
+    return 0;
+}
+
+// TP1 at 9600 bit/s: 13 bit times per octet (11 bits + 2 idle), 50 bit times idle before a frame, acknowledged after 15 bit times
+#define TP1_BIT_US (1000000.0 / 9600)
+static double frameUs(unsigned int apdu)
+{
+    const unsigned int octets = apdu <= 16 ? 7 + apdu : 9 + apdu; // Standard or extended frame
+    return (50 + octets * 13 + 15 + 11) * TP1_BIT_US;
+}
+
+static void estimate(const std::vector<unsigned int> &segmentSizes, double turnaroundMs)
+{
+    const double turnaround = turnaroundMs * 1000;
+    // One group read per group object: realtime (2), clock (4), history (18), rolling windows (9), labels
+    double groupUs = 0;
+    unsigned int groupObjects = 0;
+    const uint8_t others[] = {0, 0, 3, 3, 8, 8}; // 0: 6 bits value carried in the APCI octet
+    for (uint8_t size : others)
+    {
+        groupUs += frameUs(2) + turnaround + frameUs(2 + size);
+        ++groupObjects;
+    }
+    for (int i = 0; i < TARIFCOUNT * (6 + 3); ++i, ++groupObjects)
+        groupUs += frameUs(2) + turnaround + frameUs(2 + 4);
+    for (const auto &label : Labels)
+    {
+        groupUs += frameUs(2) + turnaround + frameUs(2 + label.goSize);
+        ++groupObjects;
+    }
+    printf("Group reads: %u objects, %u telegrams, %.0f ms\n", groupObjects, groupObjects * 2, groupUs / 1000);
+    // Command, then state reads: request object index, property id, offset and length; response adds the return code
+    for (unsigned int segment : segmentSizes)
+    {
+        const unsigned int segments = (sizeof(Readout) + segment - 1) / segment;
+        const double readoutUs = frameUs(2 + 2 + 1) + turnaround + frameUs(2 + 2 + 9) +
+                                 segments * (frameUs(2 + 2 + 3) + turnaround) + (sizeof(Readout) / segment) * frameUs(2 + 2 + 1 + segment) +
+                                 (sizeof(Readout) % segment ? frameUs(2 + 2 + 1 + sizeof(Readout) % segment) : 0);
+        printf("Readout: %zu bytes in %u segments of %u, %u telegrams, %.0f ms (%.1fx)\n", sizeof(Readout), segments, segment, 2 + segments * 2,
+               readoutUs / 1000, groupUs / readoutUs);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] [READOUT]\n"
+                    "  Decodes a readout file (binary, '-' for stdin)\n"
+                    "  -e, --estimate        TP1 transfer time of the readout against group reads\n"
+                    "  -s, --segment N       Bytes per state read (default: 11 in standard frames and 31 in extended frames, at most)\n"
+                    "  -t, --turnaround MS   Device response time (default 10)\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int segment = 0;
+    double turnaround = 10;
+    bool estimating = false;
+    static const struct option options[] = {{"estimate", no_argument, nullptr, 'e'},
+                                            {"segment", required_argument, nullptr, 's'},
+                                            {"turnaround", required_argument, nullptr, 't'},
+                                            {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "es:t:", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 'e':
+            estimating = true;
+            break;
+        case 's':
+            segment = strtoul(optarg, nullptr, 10);
+            break;
+        case 't':
+            turnaround = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (segment > MAX_SEGMENT)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (estimating)
+        estimate(segment ? std::vector<unsigned int>{segment} : std::vector<unsigned int>{STANDARD_SEGMENT, MAX_SEGMENT}, turnaround);
+    if (optind == argc)
+        return estimating ? 0 : (usage(argv[0]), 1);
+
+    FILE *file = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "rb");
+    if (!file)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[1024];
+    for (size_t len; (len = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+        bytes.insert(bytes.end(), buffer, buffer + len);
+    return decode(bytes);
+}
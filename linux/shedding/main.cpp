@@ -0,0 +1,300 @@
+/*
+ * TeleInfo load shedding replay
+ *  Replays recorded TIC streams through the load shedding engine (see LoadShedding) with a table of channels:
+ *  the load seen by the engine is the recorded one less the channels it has switched off. Counts the overload
+ *  episodes left, the reaction time and the switching, and checks the minimum off times and the priorities.
+ *  GPL-3.0 License
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <knx.h>
+#include "LoadShedding.h"
+#include "TicLine.h"
+#include "TicReplay.h"
+
+#define CHANNEL_GO 2 // LoadShedding GOs from 1: state, then the channels
+
+struct Channel
+{
+    uint32_t priority = 0, power = 0, minOff = 0; // As the ETS parameters
+    bool on = true;
+    uint32_t offSince = 0;
+    uint32_t sends = 0;
+    unsigned offs = 0, ons = 0;
+};
+
+struct Replay
+{
+    Channel channel[SHEDDING_CHANNELS];
+    uint32_t threshold = 100, hysteresis = 300, restoreDelay = 60, lag = 2000;
+    uint32_t isousc = 0, iinst = 0, phases[3] = {0}, papp = 0;
+    bool started = false;
+    // Episodes over the subscribed power (ADPS), recorded and with shedding; over the shedding limit
+    bool recordedOver = false, over = false, overLimit = false;
+    uint32_t overSince = 0, limitSince = 0, limitLines = 0;
+    bool reacted = false;
+    // Results
+    unsigned recordedOverloads = 0, overloads = 0, limitEpisodes = 0, unanswered = 0, errors = 0;
+    uint64_t overMs = 0;
+    uint32_t reactionMax = 0, reactionLinesMax = 0;
+    uint32_t first = 0, last = 0;
+};
+
+static LoadShedding shedding;
+static bool verbose = false;
+static uint32_t now = 0;
+
+uint32_t millis() { return now; }
+void delay(uint32_t ms) { now += ms; }
+
+static void error(Replay &r, uint32_t time, const char *what, int channel)
+{
+    ++r.errors;
+    printf("%10.1f s  error: channel %d %s\n", time / 1000.0, channel + 1, what);
+}
+
+// Commands sent by the engine since the previous line
+static void commands(Replay &r, uint32_t time)
+{
+    bool changed = false;
+    for (int i = 0; i < SHEDDING_CHANNELS; ++i)
+    {
+        Channel &c = r.channel[i];
+        GroupObject &go = knx.getGroupObject(CHANNEL_GO + i);
+        if (go.sends == c.sends)
+            continue;
+        c.sends = go.sends;
+        const bool on = go.value();
+        if (on == c.on)
+            continue;
+        if (on)
+        {
+            ++c.ons;
+            if (time - c.offSince < c.minOff * 1000)
+                error(r, time, "restored before its minimum off time", i);
+        }
+        else
+        {
+            ++c.offs;
+            c.offSince = time;
+            if (!r.reacted && r.overLimit)
+            { // First switch off of an episode over the limit
+                r.reacted = true;
+                r.reactionMax = time - r.limitSince > r.reactionMax ? time - r.limitSince : r.reactionMax;
+                r.reactionLinesMax = r.limitLines > r.reactionLinesMax ? r.limitLines : r.reactionLinesMax;
+            }
+        }
+        c.on = on;
+        changed = true;
+        if (verbose)
+            printf("%10.1f s  channel %d %s\n", time / 1000.0, i + 1, on ? "on" : "off");
+    }
+    // Most important channels first: none on while a more important one is off
+    for (int i = 0; changed && i < SHEDDING_CHANNELS; ++i)
+        for (int j = 0; j < SHEDDING_CHANNELS; ++j)
+            if (r.channel[i].priority != 0 && r.channel[j].priority != 0 && r.channel[i].priority < r.channel[j].priority && !r.channel[i].on &&
+                r.channel[j].on)
+            {
+                error(r, time, "off while a less important channel is on", i);
+                break;
+            }
+}
+
+// Recorded load less the channels switched off for the lag (shown by the meter after ~2 frames)
+static uint32_t load(const Replay &r, uint32_t recorded, uint32_t time)
+{
+    uint32_t shed = 0;
+    for (const Channel &c : r.channel)
+        if (c.priority != 0 && !c.on && time - c.offSince >= r.lag)
+            shed += c.power;
+    return recorded > shed ? recorded - shed : 0;
+}
+
+static void line(void *context, const char *begin, const char *end, uint32_t time)
+{
+    Replay &r = *(Replay *)context;
+    if (!TicLine::validHistoric(begin, end))
+        return;
+    now = r.last = time;
+    if (!r.started)
+    {
+        r.first = time;
+        shedding.init(0, 0, time);
+        r.started = true;
+        commands(r, time);
+    }
+    const char *value;
+    if ((value = TicLine::value(begin, end, "ISOUSC ")))
+        r.isousc = TicLine::number(value, end);
+    else if ((value = TicLine::value(begin, end, "IINST ")))
+        r.iinst = TicLine::number(value, end);
+    else if ((value = TicLine::value(begin, end, "IINST1 ")) || (value = TicLine::value(begin, end, "IINST2 ")) || (value = TicLine::value(begin, end, "IINST3 ")))
+        r.phases[begin[5] - '1'] = TicLine::number(value, end);
+    else if ((value = TicLine::value(begin, end, "PAPP ")))
+        r.papp = TicLine::number(value, end);
+    else
+        return;
+    if (r.isousc == 0)
+        return;
+    ++r.limitLines;
+
+    // Load as TeleInfo::updateShedding, in VA
+    const uint32_t phases = MAX(r.phases[0], MAX(r.phases[1], r.phases[2]));
+    uint32_t recorded = MAX(r.iinst, phases) * 230;
+    if (phases == 0)
+        recorded = MAX(recorded, r.papp);
+    const uint32_t subscribed = r.isousc * 230;
+    const uint32_t seen = load(r, recorded, time);
+
+    const bool recordedOver = recorded > subscribed;
+    if (recordedOver && !r.recordedOver)
+        ++r.recordedOverloads;
+    r.recordedOver = recordedOver;
+    const bool over = seen > subscribed;
+    if (over && !r.over)
+    {
+        ++r.overloads;
+        r.overSince = time;
+        if (verbose)
+            printf("%10.1f s  overload left: %u VA (recorded %u VA)\n", time / 1000.0, seen, recorded);
+    }
+    else if (!over && r.over)
+        r.overMs += time - r.overSince;
+    r.over = over;
+    const bool overLimit = seen > subscribed * r.threshold / 100;
+    if (overLimit && !r.overLimit)
+    {
+        ++r.limitEpisodes;
+        r.limitSince = time;
+        r.limitLines = 0;
+        r.reacted = false;
+        if (verbose)
+            printf("%10.1f s  over the limit: %u VA\n", time / 1000.0, seen);
+    }
+    else if (!overLimit && r.overLimit && !r.reacted)
+        ++r.unanswered; // Nothing left to shed, or under the limit again before
+    r.overLimit = overLimit;
+
+    shedding.update(seen, subscribed, time);
+    commands(r, time);
+}
+
+static bool channel(Replay &r, const char *arg)
+{
+    int i = 0;
+    while (i < SHEDDING_CHANNELS && r.channel[i].priority != 0)
+        ++i;
+    unsigned long priority, power, minOff;
+    if (i == SHEDDING_CHANNELS || sscanf(arg, "%lu:%lu:%lu", &priority, &power, &minOff) != 3 || priority == 0)
+        return false;
+    r.channel[i].priority = priority;
+    r.channel[i].power = power;
+    r.channel[i].minOff = minOff;
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] -c PRIORITY:VA:MINOFF [-c ...] FILE...\n"
+                    "  Replays historic TIC files, raw or exported by \"capture dump\", one after the other\n"
+                    "  -c, --channel P:VA:S   Channel: priority (1 = most important), estimated load, minimum off time in s\n"
+                    "                         (up to %d)\n"
+                    "  -t, --threshold PCT    Shedding threshold in %% of ISOUSC (default 100)\n"
+                    "  -y, --hysteresis VA    Margin kept when restoring a channel (default 300)\n"
+                    "  -d, --delay S          Delay between two restore steps (default 60)\n"
+                    "  -l, --lag MS           Delay before a channel switched off shows on the meter (default 2000)\n"
+                    "  -s, --speed BAUDS      Speed of the raw files (default 1200)\n"
+                    "  -v, --verbose          Print each switch and overload\n"
+                    "Exits with 2 if a channel is restored before its minimum off time or out of the priority order.\n",
+            name, SHEDDING_CHANNELS);
+}
+
+int main(int argc, char **argv)
+{
+    static Replay r;
+    unsigned long speed = 1200;
+    static const struct option options[] = {{"channel", required_argument, nullptr, 'c'},   {"threshold", required_argument, nullptr, 't'},
+                                            {"hysteresis", required_argument, nullptr, 'y'}, {"delay", required_argument, nullptr, 'd'},
+                                            {"lag", required_argument, nullptr, 'l'},        {"speed", required_argument, nullptr, 's'},
+                                            {"verbose", no_argument, nullptr, 'v'},          {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "c:t:y:d:l:s:v", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (!channel(r, optarg))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            r.threshold = strtoul(optarg, nullptr, 10);
+            break;
+        case 'y':
+            r.hysteresis = strtoul(optarg, nullptr, 10);
+            break;
+        case 'd':
+            r.restoreDelay = strtoul(optarg, nullptr, 10);
+            break;
+        case 'l':
+            r.lag = strtoul(optarg, nullptr, 10);
+            break;
+        case 's':
+            speed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || r.channel[0].priority == 0 || r.threshold == 0 || speed == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    // ETS parameters, as LoadShedding::init reads them
+    knx.paramInt(0, r.threshold);
+    knx.paramInt(4, r.hysteresis);
+    knx.paramInt(8, r.restoreDelay);
+    for (int i = 0; i < SHEDDING_CHANNELS; ++i)
+    {
+        knx.paramInt(12 + 12 * i, r.channel[i].priority);
+        knx.paramInt(16 + 12 * i, r.channel[i].power);
+        knx.paramInt(20 + 12 * i, r.channel[i].minOff);
+    }
+
+    TicReplay replay(speed, line, &r);
+    for (int i = optind; i < argc; ++i)
+    {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        if (!replay.replay(file))
+            fprintf(stderr, "%s: unsupported capture\n", argv[i]);
+        fclose(file);
+    }
+    if (r.over)
+        r.overMs += r.last - r.overSince;
+
+    printf("replayed %.2f h, threshold %u%% of ISOUSC, hysteresis %u VA, restore delay %u s\n", (r.last - r.first) / 3600000.0, r.threshold, r.hysteresis,
+           r.restoreDelay);
+    printf("overloads: %u recorded, %u left with shedding (%.1f s over ISOUSC)\n", r.recordedOverloads, r.overloads, r.overMs / 1000.0);
+    printf("episodes over the limit: %u, answered within %u lines (%.1f s), %u left to the meter\n", r.limitEpisodes, r.reactionLinesMax,
+           r.reactionMax / 1000.0, r.unanswered);
+    for (int i = 0; i < SHEDDING_CHANNELS; ++i)
+        if (r.channel[i].priority != 0)
+            printf("channel %d (priority %u, %u VA): %u off, %u on\n", i + 1, r.channel[i].priority, r.channel[i].power, r.channel[i].offs, r.channel[i].ons);
+    printf("errors: %u\n", r.errors);
+    return r.errors != 0 ? 2 : 0;
+}
@@ -0,0 +1,34 @@
+#include <knx.h>
+#include <string.h>
+
+SimulatedKnx knx;
+
+SimulatedKnx::SimulatedKnx() { restart(); }
+
+GroupObject &SimulatedKnx::getGroupObject(uint16_t asap) { return mGroupObjects[asap % SIMULATION_GROUP_OBJECTS]; }
+
+uint32_t SimulatedKnx::paramInt(uint32_t addr)
+{
+    if (addr + 4 > SIMULATION_PARAMS)
+        return 0;
+    return ((uint32_t)mParams[addr] << 24) | ((uint32_t)mParams[addr + 1] << 16) | ((uint32_t)mParams[addr + 2] << 8) | mParams[addr + 3];
+}
+
+void SimulatedKnx::paramInt(uint32_t addr, uint32_t value)
+{
+    if (addr + 4 > SIMULATION_PARAMS)
+        return;
+    mParams[addr] = value >> 24;
+    mParams[addr + 1] = value >> 16;
+    mParams[addr + 2] = value >> 8;
+    mParams[addr + 3] = value;
+}
+
+void SimulatedKnx::restart()
+{
+    for (uint16_t i = 0; i < SIMULATION_GROUP_OBJECTS; ++i)
+    {
+        mGroupObjects[i] = GroupObject();
+        mGroupObjects[i].mAsap = i;
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef SIMULATION_KNX_H
+#define SIMULATION_KNX_H
+
+// Stand-in for the knx library in the history simulation (see main.cpp): group objects keep their value
+// and count their sends, parameters come from a table filled by the simulation, bus telegrams are
+// injected with GroupObject::write(). Only the API used by the firmware sources is provided.
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SIMULATION_GROUP_OBJECTS 256
+#define SIMULATION_PARAMS 256 // Bytes
+
+struct Dpt
+{
+    Dpt() {}
+    Dpt(short main, short sub, short idx = 0) : mainGroup(main), subGroup(sub), index(idx) {}
+    unsigned short mainGroup = 0;
+    unsigned short subGroup = 0;
+    unsigned short index = 0;
+};
+#define DPT_Switch Dpt(1, 1)
+#define DPT_Alarm Dpt(1, 5)
+#define DPT_Char_ASCII Dpt(4, 1)
+#define DPT_Value_1_Ucount Dpt(5, 10)
+#define DPT_Value_2_Ucount Dpt(7, 1)
+#define DPT_TimePeriodSec Dpt(7, 5)
+#define DPT_TimePeriodMin Dpt(7, 6)
+#define DPT_Value_Electric_Current Dpt(7, 12)
+#define DPT_Value_2_Count Dpt(8, 1)
+#define DPT_Percent_V16 Dpt(8, 10)
+#define DPT_Value_Curr Dpt(9, 21)
+#define DPT_Value_Power Dpt(9, 24)
+#define DPT_TimeOfDay Dpt(10, 1, 1)
+#define DPT_Date Dpt(11, 1)
+#define DPT_Value_4_Count Dpt(13, 1)
+#define DPT_ActiveEnergy Dpt(13, 10)
+#define DPT_String_ASCII Dpt(16, 0)
+#define DPT_DateTime Dpt(19, 1)
+
+class KNXValue
+{
+    double mNumber = 0;
+    const char *mString = nullptr;
+    struct tm mTime = {};
+
+public:
+    KNXValue(bool value) : mNumber(value) {}
+    KNXValue(uint8_t value) : mNumber(value) {}
+    KNXValue(uint16_t value) : mNumber(value) {}
+    KNXValue(uint32_t value) : mNumber(value) {}
+    KNXValue(int32_t value) : mNumber(value) {}
+    KNXValue(float value) : mNumber(value) {}
+    KNXValue(double value) : mNumber(value) {}
+    KNXValue(const char *value) : mString(value) {}
+    KNXValue(struct tm value) : mTime(value) {}
+    operator bool() const { return mNumber != 0; }
+    operator uint8_t() const { return (uint8_t)mNumber; }
+    operator uint16_t() const { return (uint16_t)mNumber; }
+    operator uint32_t() const { return (uint32_t)mNumber; }
+    operator int32_t() const { return (int32_t)mNumber; }
+    operator double() const { return mNumber; }
+    operator struct tm() const { return mTime; }
+};
+
+class GroupObject;
+typedef void (*GroupObjectUpdatedHandler)(GroupObject &go);
+
+class GroupObject
+{
+    KNXValue mValue = KNXValue((uint32_t)0);
+    uint8_t mPayload[2] = {0}; // DPT 8.001 is held as on the bus, written in place by the firmware
+    Dpt mDpt;
+    GroupObjectUpdatedHandler mCallback = nullptr;
+    uint16_t mAsap = 0;
+
+public:
+    uint32_t sends = 0;         // Telegrams sent by the device
+    bool readRequested = false; // Read sent by the device, not answered yet
+
+    void dataPointType(Dpt dpt) { mDpt = dpt; }
+    Dpt dataPointType() const { return mDpt; }
+    void callback(GroupObjectUpdatedHandler handler) { mCallback = handler; }
+    bool inPlace() const { return mDpt.mainGroup == 8 && mDpt.subGroup == 1; }
+    KNXValue value() const { return inPlace() ? KNXValue((int32_t)(int16_t)((mPayload[0] << 8) | mPayload[1])) : mValue; }
+    void valueNoSend(const KNXValue &value)
+    {
+        mValue = value;
+        const double number = value;
+        if (inPlace() && number >= -32768 && number <= 32767) // Out of range: left unchanged, as the library does
+        {
+            const int16_t raw = (int16_t)number;
+            mPayload[0] = raw >> 8;
+            mPayload[1] = raw;
+        }
+    }
+    void value(const KNXValue &value)
+    {
+        valueNoSend(value);
+        objectWritten();
+    }
+    void objectWritten() { ++sends; }
+    void requestObjectRead() { readRequested = true; }
+    uint8_t *valueRef() { return inPlace() ? mPayload : nullptr; }
+    size_t valueSize() const { return inPlace() ? sizeof(mPayload) : 0; } // The other labels go through KNXValue
+    uint16_t asap() const { return mAsap; }
+    // Telegram received from the bus (write or read response)
+    void write(const KNXValue &value)
+    {
+        valueNoSend(value);
+        readRequested = false;
+        if (mCallback)
+            mCallback(*this);
+    }
+    friend class SimulatedKnx;
+};
+
+class SimulatedKnx
+{
+    GroupObject mGroupObjects[SIMULATION_GROUP_OBJECTS];
+    uint8_t mParams[SIMULATION_PARAMS] = {0};
+
+public:
+    SimulatedKnx();
+    GroupObject &getGroupObject(uint16_t asap);
+    uint32_t paramInt(uint32_t addr);
+    void paramInt(uint32_t addr, uint32_t value); // Big endian, as downloaded by ETS
+    uint16_t individualAddress() const { return 0x1101; }
+    bool configured() const { return true; }
+    void restart(); // Device reset: group objects lose their value, handlers and pending reads
+};
+extern SimulatedKnx knx;
+
+#endif
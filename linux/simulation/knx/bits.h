@@ -0,0 +1,10 @@
+#ifndef SIMULATION_KNX_BITS_H
+#define SIMULATION_KNX_BITS_H
+
+#include <stdint.h>
+
+// Virtual device clock of the history simulation (see main.cpp)
+uint32_t millis();
+void delay(uint32_t ms);
+
+#endif
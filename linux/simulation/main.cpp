@@ -0,0 +1,840 @@
+/*
+ * TeleInfo history simulation
+ *  Runs the firmware core (TeleInfo + RTCKnx) under a virtual clock against a synthetic meter for years of
+ *  operation, with device reboots, power cuts and bus clock corrections, and checks the history, the rolling
+ *  consumption and the calendar every simulated hour against the meter indexes. Optionally reads the state
+ *  each day through the bulk readout on a modelled TP1 line while the device runs, against one group read per
+ *  group object, and imports the period starts of the meter once through the bulk history import.
+ *  GPL-3.0 License
+ */
+
+#include <Arduino.h>
+#include <knx.h>
+#include <EEPROM.h>
+#include <hardware/flash.h>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "RTCKnx.h"
+#include "TeleInfo.h"
+
+#define STEP_MS 10000                  // Device loops run every 10s of simulated time
+#define FRAME_PERIOD_MS 60000          // One meter frame per minute, at 30s
+#define HOUR_MS (60 * 60 * 1000LL)
+#define DAY_MS (24 * HOUR_MS)
+#define LOOPS_PER_STEP 4               // TeleInfo stages (reception to housekeeping)
+#define TARIFFS 3                      // Base, HC, HP: as TeleInfo::TARIFCOUNT
+#define HISTORY_GO 7                   // First consumption group object (Base today)
+#define DATETIME_GO 3                  // RTCKnx date and time group object
+#define PAPP_GO 45                     // Apparent power label (DPT 8.001)
+#define TRUTH_HOURS (31 * 24)          // Meter consumption kept per hour for the rolling windows
+#define MAX_REPORTED_ERRORS 20
+#define READOUT_MS (12 * HOUR_MS + 30000) // Daily bulk readout (--readout), with the frame of 12:00:30
+
+// Virtual device clock: restarts at 0 on each boot and drifts from the wall clock
+static uint32_t deviceMs = 0;
+uint32_t millis() { return deviceMs; }
+void delay(uint32_t ms) { deviceMs += ms; }
+
+static uint64_t randomState = 1;
+static uint32_t randomNumber(uint32_t max) // In [0, max)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return max ? randomState % max : 0;
+}
+
+// Calendar of the simulation, independent from RTCKnx: days since 1970-01-01 (proleptic Gregorian)
+struct Date
+{
+    int year;
+    unsigned month; // 1 to 12
+    unsigned day;
+};
+static int64_t daysFromCivil(const Date &date)
+{
+    const int y = date.year - (date.month <= 2);
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = y - era * 400;
+    const unsigned doy = (153 * (date.month + (date.month > 2 ? -3 : 9)) + 2) / 5 + date.day - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (int64_t)era * 146097 + doe - 719468;
+}
+static Date civilFromDays(int64_t z)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = z - era * 146097;
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    return Date{(int)(yoe + era * 400 + (month <= 2)), month, doy - (153 * mp + 2) / 5 + 1};
+}
+
+// Synthetic meter, HC/HP option: off-peak hours from 22:00 to 6:00
+struct Meter
+{
+    uint64_t mWh[TARIFFS] = {0, 4321000000ULL, 8765000000ULL}; // HC and HP registers, Base is their sum
+    uint32_t power = 0;                                      // In VA over the last minute
+
+    uint32_t index(int tariff) const { return tariff == 0 ? index(1) + index(2) : mWh[tariff] / 1000; }
+    static bool offPeak(unsigned hour) { return hour >= 22 || hour < 6; }
+    // Consumption of the minute ending at the frame
+    void consume(const Date &date, unsigned hour)
+    {
+        const bool winter = date.month <= 3 || date.month >= 11;
+        power = 250 + randomNumber(400);
+        if (hour == 7 || (hour >= 18 && hour < 22))
+            power += 1200 + randomNumber(2500);
+        if (winter)
+            power += 1500 + (offPeak(hour) ? 1500 : 0);
+        if (randomNumber(100) == 0)
+            power += 6000; // Oven, EV charger
+        mWh[offPeak(hour) ? 1 : 2] += power * 1000ULL / 60;
+    }
+};
+
+// TIC historic frame with the checksum of each line
+static int frameLine(char *out, const char *label, const char *value)
+{
+    unsigned int sum = ' ';
+    for (const char *c = label; *c; ++c)
+        sum += *c;
+    for (const char *c = value; *c; ++c)
+        sum += *c;
+    return sprintf(out, "\n%s %s %c\r", label, value, (sum & 0x3f) + 0x20);
+}
+static int frame(char *out, const Meter &meter, unsigned hour)
+{
+    char value[16];
+    int len = 0;
+    out[len++] = 0x02;
+    len += frameLine(out + len, "ADCO", "021728123456");
+    len += frameLine(out + len, "OPTARIF", "HC..");
+    len += frameLine(out + len, "ISOUSC", "45");
+    sprintf(value, "%09u", meter.index(1));
+    len += frameLine(out + len, "HCHC", value);
+    sprintf(value, "%09u", meter.index(2));
+    len += frameLine(out + len, "HCHP", value);
+    len += frameLine(out + len, "PTEC", Meter::offPeak(hour) ? "HC.." : "HP..");
+    sprintf(value, "%03u", (meter.power + 115) / 230);
+    len += frameLine(out + len, "IINST", value);
+    len += frameLine(out + len, "IMAX", "090");
+    sprintf(value, "%05u", meter.power);
+    len += frameLine(out + len, "PAPP", value);
+    len += frameLine(out + len, "HHPHC", "A");
+    len += frameLine(out + len, "MOTDETAT", "000000");
+    out[len++] = 0x03;
+    return len;
+}
+
+// Index of each tariff at the start of the periods, in the history group object order, taken from the last frame
+// before the date change (0: before the simulation start). After a power cut across the end of a period, the device
+// starts the new one at the last frame received when its clock gets valid, and the ended one is unknown
+// (TeleInfo::validateHistory())
+struct Truth
+{
+    uint32_t index[TARIFFS] = {0};
+    uint32_t start[TARIFFS][HISTORY_PERIODS] = {{0}};
+    bool previousLost[3] = {false}; // Yesterday, last month, last year
+    int restarting = -1;            // Longest period started again at each frame until then
+    Date date = {0, 0, 0};
+    // Consumption per wall hour, for the rolling windows
+    int64_t hourStamp[TRUTH_HOURS];
+    uint32_t hourly[TRUTH_HOURS][TARIFFS];
+
+    void frame(const Meter &meter, const Date &frameDate, int64_t hour, bool afterPowerCut)
+    {
+        if (date.year != 0 && (frameDate.day != date.day || frameDate.month != date.month || frameDate.year != date.year))
+        {
+            const int change = frameDate.year != date.year ? 2 : frameDate.month != date.month ? 1 : 0;
+            for (int period = change; period >= 0; --period)
+            {
+                for (int i = 0; i < TARIFFS; ++i)
+                {
+                    start[i][2 * period + 1] = start[i][2 * period];
+                    start[i][2 * period] = afterPowerCut ? meter.index(i) : index[i];
+                }
+                // A year or month change while off also clears the shorter periods
+                previousLost[period] = afterPowerCut;
+            }
+            restarting = afterPowerCut ? change : -1;
+        }
+        else if (!afterPowerCut)
+            restarting = -1;
+        else
+            for (int period = restarting; period >= 0; --period)
+                for (int i = 0; i < TARIFFS; ++i)
+                    start[i][2 * period] = meter.index(i);
+        date = frameDate;
+        const int slot = hour % TRUTH_HOURS;
+        if (hourStamp[slot] != hour)
+        {
+            hourStamp[slot] = hour;
+            memset(hourly[slot], 0, sizeof(hourly[slot]));
+        }
+        for (int i = 0; i < TARIFFS; ++i)
+        {
+            if (index[i] != 0)
+                hourly[slot][i] += meter.index(i) - index[i];
+            index[i] = meter.index(i);
+        }
+    }
+    // Expected value of a history group object, false when it started before the simulation
+    bool expected(int tariff, int period, uint32_t &value) const
+    {
+        const uint32_t *s = start[tariff];
+        const uint32_t from = s[period], to = period & 1 ? s[period - 1] : index[tariff];
+        if (from == 0 || to == 0)
+            return false;
+        value = to - from;
+        return true;
+    }
+    uint32_t consumption(int tariff, int64_t fromHour, int64_t toHour) const
+    {
+        uint32_t sum = 0;
+        for (int64_t hour = fromHour; hour <= toHour; ++hour)
+            if (hourStamp[hour % TRUTH_HOURS] == hour)
+                sum += hourly[hour % TRUTH_HOURS][tariff];
+        return sum;
+    }
+};
+
+struct Results
+{
+    uint64_t frames = 0, checks = 0, errors = 0, unknown = 0;
+    unsigned warmReboots = 0, powerCuts = 0, clockSteps = 0, clockReads = 0;
+    // Bulk readouts against group reads, on the modelled bus
+    unsigned readouts = 0, readoutBytes = 0, readoutTelegrams = 0, groupReads = 0;
+    uint64_t readoutUs = 0, groupReadUs = 0;
+    uint32_t answerUs = 0; // Longest device answer, in host time
+    unsigned imports = 0;
+    // Boots (cold, warm): setup time in host time and waited by delay(), group objects answering another value than
+    // before the reset
+    unsigned boots[2] = {0}, changed[2] = {0};
+    uint64_t bootUs[2] = {0};
+    uint32_t bootMaxUs[2] = {0}, bootDelayMs[2] = {0};
+    // Clock discipline against the bus clock once settled: phase in ms and frequency in ppb, sampled at each step
+    uint64_t clockSamples = 0;
+    double phaseSum = 0, phaseSquares = 0, frequencySquares = 0;
+    int64_t phaseMax = 0;
+    int64_t frequencyMax = 0;
+};
+
+static const char *const TariffNames[TARIFFS] = {"Base", "HC", "HP"};
+static const char *const PeriodNames[HISTORY_PERIODS] = {"today", "yesterday", "this month", "last month", "this year", "last year"};
+static const char *const WindowNames[3] = {"24 hours", "7 days", "30 days"};
+static const uint32_t PappPeaks[4] = {32766, 32767, 32768, 40000}; // In VA, at 19:14:30, around the DPT 8.001 limit
+
+static Results results;
+static bool verbose = false;
+static int64_t wallMs = 0; // Local time since 1970-01-01
+
+static void error(const char *format, uint32_t device, uint32_t expected, int tariff, const char *what)
+{
+    if (++results.errors > MAX_REPORTED_ERRORS)
+        return;
+    const Date date = civilFromDays(wallMs / DAY_MS);
+    printf("%04d-%02u-%02u %02u:%02u ", date.year, date.month, date.day, (unsigned)(wallMs % DAY_MS / HOUR_MS), (unsigned)(wallMs % HOUR_MS / 60000));
+    printf(format, tariff >= 0 ? TariffNames[tariff] : "", what, device, expected);
+    printf("\n");
+}
+
+// Device under test, built again on each boot (placement: nothing is freed, as on the target)
+static SerialUART *serial;
+static TeleInfo::Snapshot snapshot; // No-init RAM
+static const char *historyPath, *flashPath;
+alignas(RTCKnx) static uint8_t rtcStorage[sizeof(RTCKnx)];
+alignas(TeleInfo) static uint8_t teleinfoStorage[sizeof(TeleInfo)];
+static RTCKnx *rtc;
+static TeleInfo *teleinfo;
+
+// Numeric group object values (the clock ones move on, the strings are not compared)
+static bool numeric(GroupObject &go)
+{
+    const unsigned short main = go.dataPointType().mainGroup;
+    return main != 0 && main != 10 && main != 11 && main != 16 && main != 19;
+}
+
+// Device reset, timed up to the end of the setup: what the group objects answer before the first TIC frame is
+// compared with their values before the reset
+static void boot(bool warm)
+{
+    static double before[SIMULATION_GROUP_OBJECTS];
+    const bool running = teleinfo != nullptr;
+    for (uint16_t asap = 1; running && asap < SIMULATION_GROUP_OBJECTS; ++asap)
+        before[asap] = knx.getGroupObject(asap).value();
+    if (!warm)
+    { // RAM lost, flash kept
+        memset(&snapshot, 0xa5, sizeof(snapshot));
+        EEPROM.begin(historyPath);
+        flash_file(flashPath);
+    }
+    deviceMs = 0;
+    knx.restart();
+    const uint32_t start = micros();
+    rtc = new (rtcStorage) RTCKnx();
+    teleinfo = new (teleinfoStorage) TeleInfo(rtc, serial, TIC_HISTORIC_SPEED, SERIAL_7E1);
+    teleinfo->restoreSnapshot(&snapshot);
+    rtc->init(0, 0);
+    teleinfo->init(RTCKnx::SIZEPARAMS, RTCKnx::NBGO);
+    rtc->setNotifier<TeleInfo, &TeleInfo::newDate>(teleinfo);
+    const uint32_t us = micros() - start;
+    if (!running)
+        return;
+    ++results.boots[warm];
+    results.bootUs[warm] += us;
+    results.bootMaxUs[warm] = MAX(results.bootMaxUs[warm], us);
+    results.bootDelayMs[warm] = MAX(results.bootDelayMs[warm], deviceMs);
+    for (uint16_t asap = 1; asap < SIMULATION_GROUP_OBJECTS; ++asap)
+    {
+        GroupObject &go = knx.getGroupObject(asap);
+        if (numeric(go) && (double)go.value() != before[asap])
+            ++results.changed[warm];
+    }
+}
+
+// The flash writes of a day change take ~50ms on the device, while the few loops of each simulated step stretch
+// them over minutes: done before a reboot or a power cut, which lands after them as on the device
+static void flushFlash()
+{
+    for (int i = 0; i < 100000 && teleinfo->flashPending(); ++i)
+        teleinfo->loop(); // Not the clock: no day change seen at the time of the cut
+}
+
+static void check(const Truth &truth, const Meter &meter, int64_t countedFrom)
+{
+    if (countedFrom == INT64_MAX)
+        return; // No frame with a valid clock since the boot
+    ++results.checks;
+    // Calendar: RTCKnx month lengths and leap years against the simulation one (clock error well under a minute)
+    const Date date = civilFromDays(wallMs / DAY_MS);
+    const RTCKnx::DateTime &dt = rtc->dateTime();
+    if (!rtc->isValid() || dt.tm_year != date.year || dt.tm_mon + 1U != date.month || dt.tm_mday != date.day || dt.tm_hour != wallMs % DAY_MS / HOUR_MS)
+        error("%s%sclock %u, expected %u (YYYYMMDDHH)", (uint32_t)(((dt.tm_year * 100 + dt.tm_mon + 1) * 100 + dt.tm_mday) * 100 + dt.tm_hour),
+              (uint32_t)(((date.year * 100 + date.month) * 100 + date.day) * 100 + wallMs % DAY_MS / HOUR_MS), -1, "");
+    for (int period = 0; period < HISTORY_PERIODS; ++period)
+    {
+        uint32_t value[TARIFFS];
+        for (int i = 0; i < TARIFFS; ++i)
+            value[i] = knx.getGroupObject(HISTORY_GO + i * HISTORY_PERIODS + period).value();
+        if (value[0] != value[1] + value[2])
+            error("%s %s: %u, HC + HP %u", value[0], value[1] + value[2], 0, PeriodNames[period]);
+        for (int i = 0; i < TARIFFS; ++i)
+        {
+            uint32_t expected;
+            if (!truth.expected(i, period, expected) || value[i] == expected)
+                continue;
+            if (value[i] == 0 && (period & 1) && truth.previousLost[period / 2])
+                ++results.unknown; // Power cut across the end of the period
+            else
+                error("%s %s: %u, expected %u", value[i], expected, i, PeriodNames[period]);
+        }
+    }
+    // Apparent power of the last frame, 32767 at most
+    const uint32_t papp = (int32_t)knx.getGroupObject(PAPP_GO).value();
+    if (papp != MIN(meter.power, 0x7fffU))
+        error("%s%sPAPP %u, expected %u", papp, MIN(meter.power, 0x7fffU), -1, "");
+    // Rolling windows: current bucket and the previous ones, exact unless they hold the consumption of a power cut
+    const int64_t hour = wallMs / HOUR_MS;
+    const int64_t windowStart[3] = {hour - 23, (hour / 6 - 27) * 6, (hour / 24 - 29) * 24};
+    for (int i = 0; i < TARIFFS; ++i)
+    {
+        uint32_t previous = 0;
+        for (int w = 0; w < 3; ++w)
+        {
+            const uint32_t value = teleinfo->rolling().consumption(i, w);
+            if (value < previous)
+                error("%s last %s: %u, shorter window %u", value, previous, i, WindowNames[w]);
+            previous = value;
+            if (windowStart[w] * HOUR_MS <= countedFrom)
+                continue;
+            const uint32_t expected = truth.consumption(i, windowStart[w], hour);
+            if (value != expected)
+                error("%s last %s: %u, expected %u", value, expected, i, WindowNames[w]);
+        }
+    }
+}
+
+// TP1 at 9600 bit/s, as linux/readout: 13 bit times per octet, 50 idle before a frame, acknowledged after 15
+static uint32_t frameUs(unsigned int apdu)
+{
+    const unsigned int octets = apdu <= 16 ? 7 + apdu : 9 + apdu; // Standard or extended frame
+    return (50 + octets * 13 + 15 + 11) * 1000000ULL / 9600;
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// Request received by the device: answered by knx.loop() once the TeleInfo and RTCKnx loops in progress return
+// (both run here, the TIC frame of the step being parsed meanwhile). The device clock follows the bus
+struct Bus
+{
+    uint32_t startMs = deviceMs;
+    uint64_t us = 0;
+
+    template <typename Handler> void request(unsigned int requestApdu, Handler handler)
+    {
+        us += frameUs(requestApdu);
+        deviceMs = startMs + us / 1000;
+        const uint32_t start = micros();
+        teleinfo->loop();
+        rtc->loop();
+        const unsigned int responseApdu = handler();
+        const uint32_t answer = micros() - start;
+        results.answerUs = MAX(results.answerUs, answer);
+        us += answer + frameUs(responseApdu);
+        deviceMs = startMs + us / 1000;
+    }
+};
+
+// Bulk readout (TeleInfo::readoutCommand and readoutState) with segment bytes per state read, then one group read per
+// group object set by the firmware. Returns the device time spent, taken from the next steps
+static uint32_t readout(unsigned int segment)
+{
+    Bus bus;
+    uint8_t result[1 + 254];
+    uint8_t resultLength = 0;
+    // Function property APDUs: APCI (2), object index and property id, then the data (result code first in responses)
+    bus.request(2 + 2, [&]() {
+        resultLength = sizeof(result);
+        if (!teleinfo->readoutCommand(0, nullptr, result, resultLength))
+            resultLength = 1;
+        return 2 + 2 + resultLength;
+    });
+    const uint16_t size = resultLength == 9 ? (result[1] << 8) | result[2] : 0;
+    const uint32_t crc = (uint32_t)result[5] << 24 | result[6] << 16 | result[7] << 8 | result[8];
+    std::vector<uint8_t> bytes;
+    unsigned int telegrams = 2;
+    while (bytes.size() < size)
+    {
+        const uint8_t request[3] = {(uint8_t)(bytes.size() >> 8), (uint8_t)bytes.size(), (uint8_t)segment};
+        bus.request(2 + 2 + sizeof(request), [&]() {
+            resultLength = 1 + segment;
+            if (!teleinfo->readoutState(sizeof(request), request, result, resultLength))
+                resultLength = 1;
+            return 2 + 2 + resultLength;
+        });
+        telegrams += 2;
+        if (resultLength < 2 || result[0] != 0)
+            break;
+        bytes.insert(bytes.end(), result + 1, result + resultLength);
+    }
+    if (size != sizeof(TeleInfo::Readout) || bytes.size() != size || crc32(bytes.data(), offsetof(TeleInfo::Readout, crc)) != crc)
+        error("%s%sreadout of %u bytes, %u expected (or bad CRC)", bytes.size(), size, -1, "");
+    ++results.readouts;
+    results.readoutBytes = size;
+    results.readoutTelegrams = telegrams;
+    results.readoutUs += bus.us;
+
+    // Group reads: APCI (2), then the value (in the APCI octet for 6 bits)
+    const uint64_t readoutUs = bus.us;
+    unsigned int groupReads = 0;
+    for (uint16_t asap = 1; asap < SIMULATION_GROUP_OBJECTS; ++asap)
+    {
+        const unsigned short main = knx.getGroupObject(asap).dataPointType().mainGroup;
+        if (main == 0)
+            continue;
+        const unsigned int valueSize = main == 1 ? 0 : main <= 6 ? 1 : main <= 9 ? 2 : main <= 11 ? 3 : main == 16 ? 14 : main == 19 ? 8 : 4;
+        bus.request(2, [&]() { return 2 + valueSize; });
+        ++groupReads;
+    }
+    results.groupReads = groupReads;
+    results.groupReadUs += bus.us - readoutUs;
+    return deviceMs - bus.startMs;
+}
+
+// Bulk history import of the period starts known by the truth, as a client on the bus: 2 indexes per standard
+// frame, then the commit. Once applied, the 18 history group objects must show the truth at once
+static uint8_t importHistory(const Truth &truth)
+{
+    uint8_t request[10] = {0 /* ImportBegin */};
+    uint8_t result[1];
+    uint8_t resultLength = sizeof(result);
+    teleinfo->historyImportCommand(1, request, result, resultLength);
+    for (unsigned int slot = 0; slot < TARIFFS * HISTORY_PERIODS && result[0] == 0; slot += 2)
+    {
+        request[0] = 1; // ImportWrite
+        request[1] = slot;
+        for (unsigned int i = 0; i < 2; ++i)
+        {
+            const uint32_t index = truth.start[(slot + i) / HISTORY_PERIODS][(slot + i) % HISTORY_PERIODS];
+            request[2 + 4 * i] = index >> 24;
+            request[3 + 4 * i] = index >> 16;
+            request[4 + 4 * i] = index >> 8;
+            request[5 + 4 * i] = index;
+        }
+        resultLength = sizeof(result);
+        teleinfo->historyImportCommand(sizeof(request), request, result, resultLength);
+    }
+    if (result[0] != 0)
+        return result[0];
+    request[0] = 2; // ImportCommit
+    resultLength = sizeof(result);
+    teleinfo->historyImportCommand(1, request, result, resultLength);
+    if (result[0] != 0)
+        return result[0];
+    ++results.imports;
+    for (int i = 0; i < TARIFFS; ++i)
+        for (int period = 0; period < HISTORY_PERIODS; ++period)
+        {
+            uint32_t expected = 0;
+            truth.expected(i, period, expected);
+            const uint32_t value = knx.getGroupObject(HISTORY_GO + i * HISTORY_PERIODS + period).value();
+            if (value != expected)
+                error("%s %s after the import: %u, expected %u", value, expected, i, PeriodNames[period]);
+        }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "  -y, --years N          Simulated years (default 3)\n"
+                    "  -s, --start YYYY-MM-DD First simulated day (default 2023-12-20, before a leap year)\n"
+                    "  -r, --reboot-days N    Mean days between two device reboots (default 9, 0: none)\n"
+                    "  -p, --power-cut-days N Mean days between two power cuts (default 23, 0: none)\n"
+                    "  -d, --drift PPM        Device clock drift (default 40)\n"
+                    "  -w, --wander PPM       Daily swing of the drift, as with the temperature (default 0)\n"
+                    "  -j, --jitter MS        Bus time received in the second after the one it carries, plus up to MS of\n"
+                    "                         delays (default: exact)\n"
+                    "  -P, --sync MINUTES     Bus time read period of the device (default 60)\n"
+                    "  -S, --seed N           Random seed (default 1)\n"
+                    "  -R, --readout BYTES    Bulk readout each day at noon, BYTES per state read (%d: standard frames), against\n"
+                    "                         group reads on a TP1 line\n"
+                    "  -I, --import DAYS      History reset at noon after DAYS days, then bulk import of the period starts of the\n"
+                    "                         meter, checked at once on the 18 history group objects\n"
+                    "  -v, --verbose          Print each reboot, power cut and clock correction\n",
+            name, READOUT_STANDARD_SEGMENT);
+}
+
+int main(int argc, char **argv)
+{
+    double years = 3;
+    Date start = {2023, 12, 20};
+    unsigned int rebootDays = 9, powerCutDays = 23;
+    int drift = 40;
+    int wander = 0;
+    int jitter = -1; // Bus time latency, -1: exact
+    unsigned int syncMinutes = 60;
+    unsigned int segment = 0; // Bulk readout, 0: none
+    double importDays = 0;    // Bulk history import, 0: none
+
+    static const struct option options[] = {{"years", required_argument, nullptr, 'y'},
+                                            {"start", required_argument, nullptr, 's'},
+                                            {"reboot-days", required_argument, nullptr, 'r'},
+                                            {"power-cut-days", required_argument, nullptr, 'p'},
+                                            {"drift", required_argument, nullptr, 'd'},
+                                            {"wander", required_argument, nullptr, 'w'},
+                                            {"jitter", required_argument, nullptr, 'j'},
+                                            {"sync", required_argument, nullptr, 'P'},
+                                            {"seed", required_argument, nullptr, 'S'},
+                                            {"readout", required_argument, nullptr, 'R'},
+                                            {"import", required_argument, nullptr, 'I'},
+                                            {"verbose", no_argument, nullptr, 'v'},
+                                            {nullptr, 0, nullptr, 0}};
+    for (int opt; (opt = getopt_long(argc, argv, "y:s:r:p:d:w:j:P:S:R:I:v", options, nullptr)) != -1;)
+    {
+        switch (opt)
+        {
+        case 'y':
+            years = atof(optarg);
+            break;
+        case 's':
+            if (sscanf(optarg, "%d-%u-%u", &start.year, &start.month, &start.day) != 3)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            rebootDays = strtoul(optarg, nullptr, 10);
+            break;
+        case 'p':
+            powerCutDays = strtoul(optarg, nullptr, 10);
+            break;
+        case 'd':
+            drift = atoi(optarg);
+            break;
+        case 'w':
+            wander = atoi(optarg);
+            break;
+        case 'j':
+            jitter = atoi(optarg);
+            break;
+        case 'P':
+            syncMinutes = strtoul(optarg, nullptr, 10);
+            break;
+        case 'S':
+            randomState = MAX(strtoull(optarg, nullptr, 10), 1ULL); // Xorshift state never 0
+            break;
+        case 'R':
+            segment = strtoul(optarg, nullptr, 10);
+            if (segment == 0 || segment > 254)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'I':
+            importDays = atof(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Flash of the device in temporary files, kept across power cuts
+    char history[] = "/tmp/teleinfo-history-XXXXXX", flash[] = "/tmp/teleinfo-flash-XXXXXX";
+    const int historyFd = mkstemp(history), flashFd = mkstemp(flash);
+    if (historyFd < 0 || flashFd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(historyFd);
+    close(flashFd);
+    unlink(history); // No file: erased flash
+    historyPath = history;
+    flashPath = flash;
+
+    // TIC through a pipe, read by the Linux SerialUART as a replay that never ends
+    int tic[2];
+    if (pipe(tic) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    char ticPath[32];
+    snprintf(ticPath, sizeof(ticPath), "/dev/fd/%d", tic[0]);
+    serial = new SerialUART(ticPath, true);
+
+    knx.paramInt(0, syncMinutes); // RTCKnx: bus time read period in minutes
+    knx.paramInt(4, 60);   // TeleInfo: send period in seconds
+    knx.paramInt(168, 1);  // TIC mode: historic
+    static Truth truth;
+    static Meter meter;
+    boot(false);
+
+    wallMs = daysFromCivil(start) * DAY_MS;
+    const int64_t startMs = wallMs, endMs = wallMs + (int64_t)(years * 365.2425 * DAY_MS);
+    int64_t importAt = importDays > 0 ? startMs + (int64_t)importDays * DAY_MS + READOUT_MS : 0;
+    bool importReset = false; // History reset, imported at the next step
+    int64_t nextReboot = rebootDays ? wallMs + (randomNumber(2 * rebootDays * 24) + 1) * HOUR_MS + randomNumber(360) * STEP_MS : INT64_MAX;
+    int64_t nextPowerCut = powerCutDays ? wallMs + (randomNumber(2 * powerCutDays * 24) + 1) * HOUR_MS + randomNumber(360) * STEP_MS : INT64_MAX;
+    int64_t powerBack = 0;          // End of the current power cut, 0: powered
+    int64_t busErrorUntil = 0;      // Bus clock wrong until then
+    int32_t busErrorMs = 0;
+    int64_t countedFrom = INT64_MAX; // First frame with a valid clock since the start or the last power cut
+    bool afterPowerCut = false;     // Until the device clock is valid with a frame received since the boot
+    bool frameSinceBoot = false;
+    int64_t driftAccumulator = 0;
+    // Clock errors measured once the frequency is known and the bus time read again since the last boot or bus clock
+    // change
+    const int64_t referenceMs = startMs - RTCKnx::secondsSinceReference(RTCKnx::DateTime{0, 0, 0, (uint16_t)start.day, (uint16_t)(start.month - 1),
+                                                                                          (uint16_t)start.year}) * 1000;
+    const int64_t settleMs = (int64_t)MAX(syncMinutes, 1U) * 60000 + STEP_MS;
+    int64_t settledFrom = startMs + 2 * DAY_MS;
+    uint32_t busMs = 0; // Device time spent by a readout, ahead of the wall clock
+    char buffer[512];
+    const clock_t started = clock();
+
+    for (; wallMs < endMs; wallMs += STEP_MS)
+    {
+        const Date date = civilFromDays(wallMs / DAY_MS);
+        const unsigned hour = wallMs % DAY_MS / HOUR_MS;
+        if (powerBack)
+        {
+            if (wallMs < powerBack)
+                continue; // Meter off too: nothing consumed
+            powerBack = 0;
+            boot(false);
+            settledFrom = MAX(settledFrom, wallMs + settleMs);
+            countedFrom = INT64_MAX;
+            afterPowerCut = true;
+            frameSinceBoot = false;
+        }
+        else if (wallMs >= nextPowerCut || (date.year % 2 && date.month == 12 && date.day == 31 && wallMs % DAY_MS == DAY_MS - 30 * 60000))
+        { // Random, and from 23:30 across the end of every other year
+            uint32_t minutes = randomNumber(10) < 7 ? 1 + randomNumber(120) : randomNumber(3) < 2 ? 60 + randomNumber(12 * 60) : 24 * 60 + randomNumber(3 * 24 * 60);
+            if (wallMs >= nextPowerCut)
+                nextPowerCut = wallMs + (randomNumber(2 * powerCutDays * 24) + 1) * HOUR_MS + randomNumber(360) * STEP_MS;
+            else
+                minutes = MAX(minutes, 31U);
+            powerBack = wallMs + minutes * 60000LL;
+            flushFlash();
+            // Day change seen by the device just before, its clock a few seconds ahead: the periods ended are kept
+            const RTCKnx::DateTime &seen = rtc->dateTime();
+            if (rtc->isValid() && truth.date.year != 0 && (seen.tm_mday != truth.date.day || seen.tm_mon + 1U != truth.date.month || seen.tm_year != truth.date.year))
+                truth.frame(meter, Date{seen.tm_year, seen.tm_mon + 1U, seen.tm_mday}, wallMs / HOUR_MS, false);
+            ++results.powerCuts;
+            if (verbose)
+                printf("%04d-%02u-%02u %02u:%02u power cut for %u minutes\n", date.year, date.month, date.day, hour, (unsigned)(wallMs % HOUR_MS / 60000),
+                       (unsigned)((powerBack - wallMs) / 60000));
+            continue;
+        }
+        else if (wallMs >= nextReboot)
+        { // Watchdog, brownout or ETS restart: the no-init RAM survives
+            nextReboot = wallMs + (randomNumber(2 * rebootDays * 24) + 1) * HOUR_MS + randomNumber(360) * STEP_MS;
+            flushFlash();
+            boot(true);
+            ++results.warmReboots;
+            if (verbose)
+                printf("%04d-%02u-%02u %02u:%02u reboot\n", date.year, date.month, date.day, hour, (unsigned)(wallMs % HOUR_MS / 60000));
+        }
+
+        // Device clock, its drift swinging over the day
+        const double ppm = drift + wander * sin(2 * M_PI * (wallMs % DAY_MS) / DAY_MS);
+        driftAccumulator += (int64_t)llround(STEP_MS * ppm);
+        const uint32_t spent = MIN(busMs, (uint32_t)STEP_MS);
+        busMs -= spent;
+        deviceMs += STEP_MS - spent + driftAccumulator / 1000000;
+        driftAccumulator %= 1000000;
+
+        // Bus clock: answers the reads of the device, sometimes off by a few seconds until the next correction
+        if (busErrorUntil && wallMs >= busErrorUntil)
+        {
+            busErrorUntil = busErrorMs = 0;
+            settledFrom = MAX(settledFrom, wallMs + settleMs);
+        }
+        else if (!busErrorUntil && randomNumber(6 * 60 * 24 * 30) == 0)
+        {
+            busErrorMs = (int32_t)(randomNumber(2) ? 1 : -1) * (3000 + randomNumber(17000));
+            busErrorUntil = wallMs + DAY_MS;
+            settledFrom = MAX(settledFrom, wallMs + settleMs);
+            ++results.clockSteps;
+            if (verbose)
+                printf("%04d-%02u-%02u %02u:%02u bus clock off by %d ms for a day\n", date.year, date.month, date.day, hour, (unsigned)(wallMs % HOUR_MS / 60000),
+                       busErrorMs);
+        }
+        GroupObject &dateTime = knx.getGroupObject(DATETIME_GO);
+        if (dateTime.readRequested)
+        {
+            // Reaches the device after the second it carries: the rest of that second and the bus delays
+            const uint32_t lateMs = jitter >= 0 ? randomNumber(1000) + randomNumber(jitter + 1) : 0;
+            deviceMs += lateMs;
+            busMs += lateMs;
+            const int64_t bus = wallMs + busErrorMs;
+            const Date busDate = civilFromDays(bus / DAY_MS);
+            const struct tm value = {(int)(bus % 60000 / 1000), (int)(bus % HOUR_MS / 60000), (int)(bus % DAY_MS / HOUR_MS), (int)busDate.day, (int)busDate.month,
+                                     busDate.year, 0, 0, 0};
+            knx.getGroupObject(DATETIME_GO - 2).readRequested = knx.getGroupObject(DATETIME_GO - 1).readRequested = false; // Date and time alone
+            dateTime.write(value);
+            ++results.clockReads;
+        }
+        rtc->loop(); // Day change at the device clock before the frame of this step, as with continuous loops
+
+        // Meter frame
+        if (wallMs % FRAME_PERIOD_MS == 30000)
+        {
+            meter.consume(date, hour);
+            if (hour == 19 && wallMs % HOUR_MS == 14 * 60000 + 30000)
+                meter.power = PappPeaks[date.day % 4]; // Consumption unchanged, seen by the check at 19:15
+            const int len = frame(buffer, meter, hour);
+            if (write(tic[1], buffer, len) != len)
+            {
+                perror("TIC pipe");
+                return 1;
+            }
+            truth.frame(meter, date, wallMs / HOUR_MS, afterPowerCut);
+            frameSinceBoot = true;
+            ++results.frames;
+            if (countedFrom == INT64_MAX && rtc->isValid())
+                countedFrom = wallMs; // Rolling windows starting before hold the consumption since the last flash save
+        }
+        if (segment && wallMs % DAY_MS == READOUT_MS)
+            busMs += readout(segment);
+        if (importAt && wallMs >= importAt && rtc->isValid() && frameSinceBoot && !afterPowerCut)
+        {
+            if (!importReset)
+            { // As the button: the history, the cost and the rolling windows restart
+                teleinfo->resetHistory();
+                importReset = true;
+                countedFrom = wallMs;
+            }
+            else
+            {
+                const uint8_t result = importHistory(truth);
+                if (result != 2 /* Meter index or clock unknown: next step */)
+                    importAt = 0;
+                if (result != 0 && result != 2)
+                    error("%s%shistory import: %u, expected %u", result, 0, -1, "");
+            }
+        }
+        for (int i = 0; i < LOOPS_PER_STEP; ++i)
+        {
+            teleinfo->loop();
+            rtc->loop();
+        }
+        if (afterPowerCut && frameSinceBoot && rtc->isValid())
+            afterPowerCut = false; // The history takes the labels of the last frame at each loop
+        if (wallMs >= settledFrom && rtc->isValid())
+        {
+            RTCKnx::State state;
+            rtc->saveState(state);
+            const int64_t phase = rtc->now() - busMs - (wallMs + busErrorMs - referenceMs); // Device time ahead by busMs
+            const int64_t frequency = state.freqPpb + llround(ppm * 1e9 / (1e6 + ppm)); // Device ahead by ppm
+            ++results.clockSamples;
+            results.phaseSum += phase;
+            results.phaseSquares += (double)phase * phase;
+            results.frequencySquares += (double)frequency * frequency;
+            results.phaseMax = MAX(results.phaseMax, phase < 0 ? -phase : phase);
+            results.frequencyMax = MAX(results.frequencyMax, frequency < 0 ? -frequency : frequency);
+        }
+
+        if (wallMs % HOUR_MS == 15 * 60000 && wallMs - startMs > DAY_MS)
+            check(truth, meter, countedFrom);
+    }
+
+    const double seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+    const double days = (double)(endMs - startMs) / DAY_MS;
+    printf("%.0f days simulated in %.1fs: %.0f days/s\n", days, seconds, days / seconds);
+    printf("%llu frames, %u reboots, %u power cuts, %u bus clock errors, %u clock reads\n", (unsigned long long)results.frames, results.warmReboots,
+           results.powerCuts, results.clockSteps, results.clockReads);
+    if (importDays > 0)
+        printf("%u history import%s checked\n", results.imports, results.imports == 1 ? "" : "s");
+    if (results.readouts)
+        printf("%u readouts of %u bytes: %u telegrams, %.2fs on the bus; %u group reads: %u telegrams, %.2fs; longest device answer %uus (host)\n",
+               results.readouts, results.readoutBytes, results.readoutTelegrams, results.readoutUs / 1e6 / results.readouts, results.groupReads,
+               2 * results.groupReads, results.groupReadUs / 1e6 / results.readouts, results.answerUs);
+    for (int warm = 1; warm >= 0; --warm)
+        if (results.boots[warm])
+            printf("%u %s boots: setup in %.0fus on average, %uus at most (host) and %ums of delay; %u group objects answering another value "
+                   "than before\n",
+                   results.boots[warm], warm ? "warm" : "cold", (double)results.bootUs[warm] / results.boots[warm], results.bootMaxUs[warm],
+                   results.bootDelayMs[warm], results.changed[warm]);
+    if (results.clockSamples)
+    {
+        const double mean = results.phaseSum / results.clockSamples;
+        printf("clock against the bus: phase %.0fms on average, %.0fms standard deviation, %lldms at most; frequency %.0fppb RMS, %lldppb at most\n",
+               mean, sqrt(MAX(results.phaseSquares / results.clockSamples - mean * mean, 0.0)), (long long)results.phaseMax,
+               sqrt(results.frequencySquares / results.clockSamples), (long long)results.frequencyMax);
+    }
+    printf("%llu hourly checks: %llu errors, %llu previous periods unknown after a power cut\n", (unsigned long long)results.checks,
+           (unsigned long long)results.errors, (unsigned long long)results.unknown);
+    unlink(history);
+    unlink(flash);
+    return results.errors ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+#include <Arduino.h>
+#include <knx.h>
+#include <hardware/flash.h>
+#include "EnergyArchive.h"
+#include "FlashWriter.h"
+
+// Filesystem region reserved by board_build.filesystem_size: the archive takes its end before the snapshot sector,
+// TicCapture the rest.
+// Linker symbols, addressed as integers: the region is outside of any object known to the compiler
+extern "C" uint8_t _FS_start[];
+extern "C" uint8_t _FS_end[];
+
+#define DAY_SLOTS (ARCHIVE_DAY_SECTORS * ARCHIVE_SECTOR_SIZE / sizeof(EnergyArchive::Record))
+#define MONTH_SLOTS (ARCHIVE_MONTH_SECTORS * ARCHIVE_SECTOR_SIZE / sizeof(EnergyArchive::Record))
+#define MIN_DAYS (DAY_SLOTS - ARCHIVE_SECTOR_SIZE / sizeof(EnergyArchive::Record)) // Days kept when the oldest sector is erased
+
+static_assert(ARCHIVE_PAGE_SIZE % sizeof(EnergyArchive::Record) == 0, "Records must not straddle flash pages");
+
+uintptr_t EnergyArchive::regionAddress() { return (uintptr_t)_FS_end - ARCHIVE_SNAPSHOT_SIZE - ARCHIVE_REGION_SIZE; }
+bool EnergyArchive::available() { return (uintptr_t)_FS_end - (uintptr_t)_FS_start >= ARCHIVE_REGION_SIZE + ARCHIVE_SNAPSHOT_SIZE; }
+
+uint32_t EnergyArchive::slotOffset(bool month, uint32_t number)
+{
+    return month ? ARCHIVE_DAY_SECTORS * ARCHIVE_SECTOR_SIZE + (number % MONTH_SLOTS) * sizeof(Record) : (number % DAY_SLOTS) * sizeof(Record);
+}
+const EnergyArchive::Record *EnergyArchive::slot(bool month, uint32_t number) const
+{
+    const uint32_t offset = slotOffset(month, number);
+    if (offset - offset % ARCHIVE_SECTOR_SIZE == mErasing)
+        return nullptr; // Flash content undefined while the erase is suspended
+    return (const Record *)(regionAddress() + offset);
+}
+bool EnergyArchive::valid(const Record *record, uint32_t number) { return record && record->number == number && record->check == (uint16_t)~number; }
+
+static const int64_t Origin = RTCKnx::secondsSinceReference(RTCKnx::DateTime{0, 0, 0, 1, 0, 2020});
+
+int32_t EnergyArchive::dayNumber(const RTCKnx::DateTime &dt)
+{
+    return (RTCKnx::secondsSinceReference(RTCKnx::DateTime{0, 0, 0, dt.tm_mday, dt.tm_mon, dt.tm_year}) - Origin) / (24 * 60 * 60);
+}
+void EnergyArchive::date(int32_t day, RTCKnx::DateTime &dt) { RTCKnx::fromSecondsSinceReference(Origin + (int64_t)day * 24 * 60 * 60, dt); }
+uint32_t EnergyArchive::monthNumber(const RTCKnx::DateTime &dt) { return (dt.tm_year - 2020) * 12 + dt.tm_mon; }
+bool EnergyArchive::validDate(const RTCKnx::DateTime &dt) { return dt.tm_year >= 2020 && dt.tm_year < 2200 && dt.tm_mon < 12 && dt.tm_mday >= 1 && dt.tm_mday <= 31; }
+
+void EnergyArchive::init(uint16_t baseGO)
+{
+    knx.getGroupObject(m_GO.from = ++baseGO).dataPointType(DPT_Date);
+    GroupObjectDispatch::attach<EnergyArchive, &EnergyArchive::onFrom>(m_GO.from, this);
+    knx.getGroupObject(m_GO.to = ++baseGO).dataPointType(DPT_Date);
+    GroupObjectDispatch::attach<EnergyArchive, &EnergyArchive::onTo>(m_GO.to, this);
+    for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+        knx.getGroupObject(m_GO.result[i] = ++baseGO).dataPointType(DPT_ActiveEnergy);
+}
+
+// Newest records, once: the running totals continue from the newest day
+void EnergyArchive::scan()
+{
+    for (uint32_t i = 0; i < DAY_SLOTS; ++i)
+    {
+        const Record *record = slot(false, i);
+        if (valid(record, record->number) && record->number % DAY_SLOTS == i && record->number > mLastDay)
+        {
+            mLastDay = record->number;
+            memcpy(mTotal, record->total, sizeof(mTotal));
+        }
+    }
+    for (uint32_t i = 0; i < MONTH_SLOTS; ++i)
+    {
+        const Record *record = slot(true, i);
+        if (valid(record, record->number) && record->number % MONTH_SLOTS == i && record->number > mLastMonth)
+            mLastMonth = record->number;
+    }
+    mFillMonth = mLastMonth + 1;
+    mScanned = true;
+}
+
+// True when the sector of a slot holds anything but the records written before it in the same pass of the ring:
+// oldest records, or other data, erased before the first write in the sector even if the slot itself is blank
+bool EnergyArchive::stale(bool month, uint32_t number) const
+{
+    const uint32_t offset = slotOffset(month, number);
+    const uint32_t index = offset % ARCHIVE_SECTOR_SIZE / sizeof(Record);
+    const Record *first = (const Record *)(regionAddress() + offset - offset % ARCHIVE_SECTOR_SIZE);
+    for (uint32_t i = 0; i < ARCHIVE_SECTOR_SIZE / sizeof(Record); ++i)
+    {
+        const uint8_t *bytes = (const uint8_t *)(first + i);
+        bool blank = true;
+        for (unsigned int j = 0; j < sizeof(Record); ++j)
+            blank = blank && bytes[j] == 0xff;
+        if (!blank && !(i < index && valid(first + i, number - (index - i))))
+            return true;
+    }
+    return false;
+}
+
+// One step of the write of the running totals in the slot of a day or month: erase of its sector if stale,
+// then program of the page. True once written
+bool EnergyArchive::write(bool month, uint32_t number, const uint32_t total[ARCHIVE_TARIFFS])
+{
+    const uint32_t offset = slotOffset(month, number);
+    const uint32_t sector = offset - offset % ARCHIVE_SECTOR_SIZE;
+    if (mErasing != sector && stale(month, number))
+        mErasing = sector;
+    if (mErasing == sector)
+    {
+        if (FlashWriter::erase(regionAddress() - XIP_BASE + sector))
+            mErasing = 0xffffffff;
+        return false; // Programmed by the next call
+    }
+    const Record record = {(uint16_t)number, (uint16_t)~number, {total[0], total[1], total[2]}};
+    uint8_t page[ARCHIVE_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page)); // Programming 0xff leaves the other records of the page unchanged
+    memcpy(page + offset % ARCHIVE_PAGE_SIZE, &record, sizeof(record));
+    FlashWriter::program(regionAddress() - XIP_BASE + offset - offset % ARCHIVE_PAGE_SIZE, page, ARCHIVE_PAGE_SIZE);
+    return true;
+}
+
+void EnergyArchive::todayConsumption(const uint32_t consumption[ARCHIVE_TARIFFS]) { memcpy(mToday, consumption, sizeof(mToday)); }
+
+// Called on the first day change seen after a day: queues the records of the day that ended, and of the months
+// ended since the previous record (device off across month ends). Days without a day change get no record:
+// they keep the previous total (see total()), the consumption goes to the last day.
+void EnergyArchive::dayEnded(const uint32_t consumption[ARCHIVE_TARIFFS])
+{
+    if (!available() || !rtc.isValid())
+        return;
+    if (!mScanned)
+        scan();
+    const int32_t ended = dayNumber(rtc.dateTime()) - 1;
+    if (ended <= mLastDay)
+        return;
+    while (step())
+        ; // Two day changes before the records of the first one are written: never with a running clock
+    RTCKnx::DateTime first, last, next;
+    date(mLastDay >= 0 ? mLastDay + 1 : ended, first);
+    date(ended, last);
+    date(ended + 1, next);
+    mFillMonth = MAX((int32_t)monthNumber(first), mLastMonth + 1);
+    mLastMonth = MAX(mLastMonth, (int32_t)monthNumber(last) - (next.tm_mday == 1 ? 0 : 1));
+    mFillMonth = MAX(mFillMonth, mLastMonth - (int32_t)MONTH_SLOTS + 1);
+    for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+    {
+        mGapTotal[i] = mTotal[i];
+        mTotal[i] += consumption[i];
+        mToday[i] = 0;
+    }
+    mLastDay = ended;
+    mDayPending = true;
+}
+
+bool EnergyArchive::step()
+{
+    if (mDayPending)
+    {
+        if (write(false, mLastDay, mTotal))
+            mDayPending = false;
+        return true;
+    }
+    if (mFillMonth <= mLastMonth)
+    {
+        RTCKnx::DateTime dt;
+        date(mLastDay, dt);
+        if (write(true, mFillMonth, (int32_t)monthNumber(dt) == mFillMonth ? mTotal : mGapTotal)) // Ended with mLastDay, or before
+            ++mFillMonth;
+        return true;
+    }
+    return false;
+}
+
+// Running totals at the end of a day: from its record, the record of its month if it is the last day of a month,
+// the previous record for the days without a day change, or the live totals from the newest record
+bool EnergyArchive::total(int32_t day, int32_t today, uint32_t result[ARCHIVE_TARIFFS])
+{
+    if (day < 0)
+        return false;
+    if (day >= mLastDay && mLastDay >= 0)
+    {
+        for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+            result[i] = mTotal[i] + (day >= today ? mToday[i] : 0);
+        return true;
+    }
+    const Record *record = slot(false, day);
+    if (!valid(record, day))
+    {
+        RTCKnx::DateTime dt, next;
+        date(day, dt);
+        date(day + 1, next);
+        const uint32_t month = monthNumber(dt);
+        record = slot(true, month);
+        if (next.tm_mday != 1 || !valid(record, month))
+        {
+            // Records of the last MIN_DAYS days are never erased: a day without one there is a day without a day change
+            record = nullptr;
+            for (int32_t previous = day - 1; !record && previous >= 0 && previous > mLastDay - (int32_t)MIN_DAYS; --previous)
+            {
+                if (valid(slot(false, previous), previous))
+                    record = slot(false, previous);
+            }
+            if (!record)
+                return false;
+        }
+    }
+    memcpy(result, record->total, sizeof(record->total));
+    return true;
+}
+
+// Consumption per tariff from the start of a day to the end of another one, both included
+bool EnergyArchive::query(const RTCKnx::DateTime &from, const RTCKnx::DateTime &to, uint32_t result[ARCHIVE_TARIFFS])
+{
+    if (!available() || !rtc.isValid() || !validDate(from) || !validDate(to))
+        return false;
+    if (!mScanned)
+        scan();
+    const int32_t first = dayNumber(from), last = dayNumber(to), today = dayNumber(rtc.dateTime());
+    uint32_t start[ARCHIVE_TARIFFS];
+    if (last < first || !total(first - 1, today, start) || !total(last, today, result))
+        return false;
+    for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+        result[i] -= start[i];
+    return true;
+}
+
+void EnergyArchive::onFrom(GroupObject &go, uint8_t)
+{
+    const struct tm date = go.value();
+    mFrom = RTCKnx::DateTime{0, 0, 0, (uint16_t)date.tm_mday, (uint16_t)(date.tm_mon - 1), (uint16_t)date.tm_year};
+}
+void EnergyArchive::onTo(GroupObject &go, uint8_t)
+{
+    const struct tm date = go.value();
+    uint32_t result[ARCHIVE_TARIFFS];
+    if (!query(mFrom, RTCKnx::DateTime{0, 0, 0, (uint16_t)date.tm_mday, (uint16_t)(date.tm_mon - 1), (uint16_t)date.tm_year}, result))
+        return; // Range not archived: no answer
+    for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+        knx.getGroupObject(m_GO.result[i]).value((int32_t)result[i]);
+}
+
+// Function property: from and to dates (day, month, year on 2 bytes, big endian), returns the consumption
+// per tariff in Wh (4 bytes each, big endian) after the return code, or return code 1 if the range is not archived
+bool EnergyArchive::queryCommand(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (length < 8 || resultLength < 1 + 4 * ARCHIVE_TARIFFS)
+        return false;
+    const RTCKnx::DateTime from = {0, 0, 0, data[0], (uint16_t)(data[1] - 1), (uint16_t)((data[2] << 8) | data[3])};
+    const RTCKnx::DateTime to = {0, 0, 0, data[4], (uint16_t)(data[5] - 1), (uint16_t)((data[6] << 8) | data[7])};
+    uint32_t result[ARCHIVE_TARIFFS];
+    if (!query(from, to, result))
+    {
+        resultData[0] = 1;
+        resultLength = 1;
+        return true;
+    }
+    resultData[0] = 0;
+    for (int i = 0; i < ARCHIVE_TARIFFS; ++i)
+    {
+        resultData[1 + 4 * i] = result[i] >> 24;
+        resultData[2 + 4 * i] = result[i] >> 16;
+        resultData[3 + 4 * i] = result[i] >> 8;
+        resultData[4 + 4 * i] = result[i];
+    }
+    resultLength = 1 + 4 * ARCHIVE_TARIFFS;
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef ENERGYARCHIVE_H
+#define ENERGYARCHIVE_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "RTCKnx.h"
+#include "GroupObjectDispatch.h"
+
+#define ARCHIVE_TARIFFS 3                 // As TeleInfo::TARIFCOUNT
+#define ARCHIVE_SECTOR_SIZE 4096U         // Flash erase unit
+#define ARCHIVE_PAGE_SIZE 256U            // Flash program unit
+#define ARCHIVE_DAY_SECTORS 6             // 1536 days, 1280 at least once a sector is recycled: 3.5 years
+#define ARCHIVE_MONTH_SECTORS 2           // 512 months
+#define ARCHIVE_REGION_SIZE ((ARCHIVE_DAY_SECTORS + ARCHIVE_MONTH_SECTORS) * ARCHIVE_SECTOR_SIZE) // Before the snapshot sector
+#define ARCHIVE_SNAPSHOT_SIZE 4096U       // End of the filesystem region: TeleInfo snapshot (SNAPSHOT_SECTOR_SIZE)
+#define ARCHIVE_PROPERTY_ID 202           // Range query function property, on READOUT_OBJECT_INDEX
+
+// Daily and monthly energy archive per tariff in external flash. Each record holds the running total
+// (Wh since the archive start) at the end of its day or month, in a slot addressed by its day or month
+// number: the consumption between two dates is the difference of two records, read in constant time.
+// Records are queued on a day change and written by step(), one flash step per call.
+class EnergyArchive
+{
+public:
+    struct Record
+    {
+        uint16_t number; // Day or month since 2020-01-01
+        uint16_t check;  // ~number: tells a record from erased flash or other data
+        uint32_t total[ARCHIVE_TARIFFS];
+    };
+
+private:
+    RTCKnx &rtc;
+    struct
+    {
+        uint16_t from;
+        uint16_t to; // Written: runs the query
+        uint16_t result[ARCHIVE_TARIFFS];
+    } m_GO;
+
+    uint32_t mTotal[ARCHIVE_TARIFFS] = {0}; // At the end of mLastDay
+    uint32_t mToday[ARCHIVE_TARIFFS] = {0}; // Since the end of mLastDay
+    uint32_t mGapTotal[ARCHIVE_TARIFFS] = {0}; // At the end of the days before mLastDay without a day change (device off)
+    int32_t mLastDay = -1; // Newest day record
+    int32_t mLastMonth = -1;
+    bool mDayPending = false;     // Record of mLastDay not written yet
+    int32_t mFillMonth = 0;       // Next month record written, up to mLastMonth
+    uint32_t mErasing = 0xffffffff; // Sector being erased for a record: its records are not read
+    RTCKnx::DateTime mFrom = {0};
+    bool mScanned = false;
+
+    static uintptr_t regionAddress();
+    static bool available();
+    static uint32_t slotOffset(bool month, uint32_t number);
+    const Record *slot(bool month, uint32_t number) const;
+    static bool valid(const Record *record, uint32_t number);
+    static int32_t dayNumber(const RTCKnx::DateTime &dt);
+    static void date(int32_t day, RTCKnx::DateTime &dt);
+    static uint32_t monthNumber(const RTCKnx::DateTime &dt);
+    static bool validDate(const RTCKnx::DateTime &dt);
+    void scan();
+    bool stale(bool month, uint32_t number) const;
+    bool write(bool month, uint32_t number, const uint32_t total[ARCHIVE_TARIFFS]);
+    bool total(int32_t day, int32_t today, uint32_t result[ARCHIVE_TARIFFS]);
+    void onFrom(GroupObject &go, uint8_t);
+    void onTo(GroupObject &go, uint8_t);
+
+public:
+    EnergyArchive(RTCKnx &_rtc) : rtc(_rtc){};
+    void init(uint16_t baseGO);
+    void todayConsumption(const uint32_t consumption[ARCHIVE_TARIFFS]);
+    void dayEnded(const uint32_t consumption[ARCHIVE_TARIFFS]);
+    bool step(); // False when no record is left to write
+    bool query(const RTCKnx::DateTime &from, const RTCKnx::DateTime &to, uint32_t result[ARCHIVE_TARIFFS]);
+    bool queryCommand(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength);
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t)
+    };
+};
+
+#endif
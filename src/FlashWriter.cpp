@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include <hardware/flash.h>
+#include <hardware/timer.h>
+#include "FlashWriter.h"
+
+// W25Q flash commands
+#define FLASH_WRITE_ENABLE 0x06
+#define FLASH_SECTOR_ERASE 0x20
+#define FLASH_READ_STATUS 0x05  // Bit 0: busy
+#define FLASH_READ_STATUS2 0x35 // Bit 7: erase suspended
+#define FLASH_SUSPEND 0x75      // Busy cleared within 20us
+#define FLASH_RESUME 0x7a
+
+uint32_t FlashWriter::mErasing = FlashWriter::NONE;
+uint32_t FlashWriter::mLongest = 0;
+
+// Flash commands run from RAM with interrupts stopped: the flash cannot be read while it is erasing
+static void __no_inline_not_in_flash_func(command)(uint8_t cmd)
+{
+    uint8_t rx;
+    flash_do_cmd(&cmd, &rx, 1);
+}
+
+static uint8_t __no_inline_not_in_flash_func(status)(uint8_t cmd)
+{
+    const uint8_t tx[2] = {cmd, 0};
+    uint8_t rx[2];
+    flash_do_cmd(tx, rx, sizeof(tx));
+    return rx[1];
+}
+
+// Starts or resumes the erase, lets it run for a slice at most, then suspends it. True once erased
+static bool __no_inline_not_in_flash_func(eraseSlice)(uint32_t offset, bool start, uint32_t slice)
+{
+    if (start)
+    {
+        command(FLASH_WRITE_ENABLE);
+        const uint8_t tx[4] = {FLASH_SECTOR_ERASE, (uint8_t)(offset >> 16), (uint8_t)(offset >> 8), (uint8_t)offset};
+        uint8_t rx[4];
+        flash_do_cmd(tx, rx, sizeof(tx));
+    }
+    else
+        command(FLASH_RESUME);
+    const uint32_t begin = time_us_32();
+    while (status(FLASH_READ_STATUS) & 1)
+    {
+        if (time_us_32() - begin >= slice)
+        {
+            command(FLASH_SUSPEND);
+            while (status(FLASH_READ_STATUS) & 1)
+                ;
+            return !(status(FLASH_READ_STATUS2) & 0x80); // Not suspended: completed meanwhile
+        }
+    }
+    return true; // Flash readable again: the last command restored the XIP mode
+}
+
+void FlashWriter::measure(uint32_t start) { mLongest = MAX(mLongest, micros() - start); }
+
+bool FlashWriter::erase(uint32_t offset)
+{
+    const uint32_t sector = mErasing != NONE ? mErasing : offset; // An erase left by its writer still completes
+    const uint32_t start = micros();
+    noInterrupts();
+    rp2040.idleOtherCore();
+    const bool done = eraseSlice(sector, mErasing == NONE, FLASH_ERASE_SLICE);
+    rp2040.resumeOtherCore();
+    interrupts();
+    measure(start);
+    mErasing = done ? NONE : sector;
+    return done && sector == offset;
+}
+
+extern "C" void __real_flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+// The W25Q takes page programs while an erase is suspended, out of the sector being erased
+void FlashWriter::program(uint32_t offset, const uint8_t *data, size_t count)
+{
+    const uint32_t start = micros();
+    noInterrupts();
+    rp2040.idleOtherCore();
+    if (mErasing != NONE && offset - offset % FLASH_SECTOR_SIZE == mErasing)
+        complete();
+    __real_flash_range_program(offset, data, count);
+    rp2040.resumeOtherCore();
+    interrupts();
+    measure(start);
+}
+
+bool FlashWriter::rewrite(uint32_t offset, const uint8_t *data, size_t size, uint8_t &step)
+{
+    const unsigned int pages = (MIN(size, (size_t)FLASH_SECTOR_SIZE) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    if (step == 0)
+    {
+        if (erase(offset))
+            step = 1; // Pages from the next call
+        return false;
+    }
+    // Step n programs the first non blank page from n - 1
+    for (; step <= pages; ++step)
+    {
+        const size_t start = (step - 1) * FLASH_PAGE_SIZE;
+        uint8_t page[FLASH_PAGE_SIZE];
+        memset(page, 0xff, sizeof(page)); // Last page padded as erased
+        memcpy(page, data + start, MIN(size - start, sizeof(page)));
+        unsigned int i = 0;
+        while (i < FLASH_PAGE_SIZE && page[i] == 0xff)
+            ++i;
+        if (i != FLASH_PAGE_SIZE)
+        {
+            program(offset + start, page, FLASH_PAGE_SIZE);
+            ++step;
+            break;
+        }
+    }
+    return step > pages;
+}
+
+bool FlashWriter::erasing() { return mErasing != NONE; }
+
+void FlashWriter::complete()
+{
+    if (mErasing == NONE)
+        return;
+    eraseSlice(mErasing, false, 0xffffffff);
+    mErasing = NONE;
+}
+
+uint32_t FlashWriter::longest(bool reset)
+{
+    const uint32_t result = mLongest;
+    if (reset)
+        mLongest = 0;
+    return result;
+}
+
+// Erases and programs of the EEPROM emulation and of the knx library, with -Wl,--wrap=flash_range_erase and
+// -Wl,--wrap=flash_range_program: called with interrupts stopped, while the flash is readable (the erase being
+// done is suspended). The erase is completed first, as for any write outside of FlashWriter
+extern "C" void __real_flash_range_erase(uint32_t flash_offs, size_t count);
+extern "C" void __wrap_flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    FlashWriter::complete();
+    __real_flash_range_erase(flash_offs, count);
+}
+extern "C" void __wrap_flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    FlashWriter::complete();
+    __real_flash_range_program(flash_offs, data, count);
+}
@@ -0,0 +1,37 @@
+#ifndef FLASHWRITER_H
+#define FLASHWRITER_H
+
+#include <Arduino.h>
+
+#define FLASH_ERASE_SLICE 1000 // In us: longest erase step, the erase is suspended in between
+
+// Flash writes in steps of bounded duration, for the loops: interrupts and the other core are stopped
+// during each step, as the code runs from the flash being written. A sector erase (~45ms, up to 400ms)
+// runs in the flash chip over several steps: each one resumes it for a slice, then suspends it to read
+// the flash again. A page program (~0.5ms, up to 3ms) is a step of its own.
+// The flash takes no other erase while one is suspended: a single erase is run at a time, and other
+// flash_range_erase() and flash_range_program() calls (EEPROM emulation, knx library) complete it first
+// (-Wl,--wrap=flash_range_erase,--wrap=flash_range_program).
+class FlashWriter
+{
+    static uint32_t mErasing; // Offset of the sector being erased, NONE if none
+    static uint32_t mLongest; // Longest step, in us
+
+    static void measure(uint32_t start);
+
+public:
+    static const uint32_t NONE = 0xffffffff;
+    // One step of the erase of the sector at offset (from the flash start): true once it is erased.
+    // While another sector is erased, the step goes to that erase and false is returned
+    static bool erase(uint32_t offset);
+    // One step: programs count bytes (a page at most) at offset, in an erased area
+    static void program(uint32_t offset, const uint8_t *data, size_t count);
+    // One step of the rewrite of a sector from size bytes of RAM (the rest left erased): erase, then one page
+    // per call, blank pages skipped. step is 0 at the start: true once the sector is written
+    static bool rewrite(uint32_t offset, const uint8_t *data, size_t size, uint8_t &step);
+    static bool erasing();
+    static void complete(); // Runs the erase being done to its end at once, interrupts stopped by the caller
+    static uint32_t longest(bool reset); // Longest step in us
+};
+
+#endif
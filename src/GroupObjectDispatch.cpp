@@ -0,0 +1,32 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "GroupObjectDispatch.h"
+
+GroupObjectDispatch::Entry GroupObjectDispatch::mEntries[DISPATCH_HANDLERS];
+uint8_t GroupObjectDispatch::mCount = 0;
+
+void GroupObjectDispatch::attach(uint16_t asap, Handler handler, void *object, uint8_t arg)
+{
+    uint8_t i = 0;
+    while (i < mCount && mEntries[i].asap != asap)
+        ++i;
+    if (i == DISPATCH_HANDLERS)
+        return;
+    if (i == mCount)
+        ++mCount; // Otherwise called again after an ETS download: replace the handler
+    mEntries[i] = Entry{asap, arg, handler, object};
+    knx.getGroupObject(asap).callback(dispatch); // A plain function pointer: stored without allocation
+}
+
+void GroupObjectDispatch::dispatch(GroupObject &go)
+{
+    const uint16_t asap = go.asap();
+    for (const Entry *entry = mEntries; entry != mEntries + mCount; ++entry)
+    {
+        if (entry->asap == asap)
+        {
+            entry->handler(entry->object, go, entry->arg);
+            return;
+        }
+    }
+}
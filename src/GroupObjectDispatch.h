@@ -0,0 +1,40 @@
+#ifndef GROUPOBJECTDISPATCH_H
+#define GROUPOBJECTDISPATCH_H
+
+#include <Arduino.h>
+#include <knx.h>
+
+#define DISPATCH_HANDLERS 26 // Written group objects: 3 RTCKnx, 19 TeleInfo, 1 TicCapture, 2 EnergyArchive
+
+// Group object write handlers without std::function state: handlers are member functions bound at
+// compile time, registered in a fixed table and looked up by group object number on each write.
+class GroupObjectDispatch
+{
+public:
+    typedef void (*Handler)(void *object, GroupObject &go, uint8_t arg);
+
+    // Calls (object->*Method)(go, arg) when the group object is written from the bus
+    template <class T, void (T::*Method)(GroupObject &go, uint8_t arg)>
+    static void attach(uint16_t asap, T *object, uint8_t arg = 0)
+    {
+        attach(asap, [](void *object, GroupObject &go, uint8_t arg)
+               { (static_cast<T *>(object)->*Method)(go, arg); },
+               object, arg);
+    }
+    static void attach(uint16_t asap, Handler handler, void *object, uint8_t arg);
+
+private:
+    struct Entry
+    {
+        uint16_t asap;
+        uint8_t arg;
+        Handler handler;
+        void *object;
+    };
+    static Entry mEntries[DISPATCH_HANDLERS];
+    static uint8_t mCount;
+
+    static void dispatch(GroupObject &go);
+};
+
+#endif
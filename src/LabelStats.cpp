@@ -0,0 +1,77 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "LabelStats.h"
+
+// TIC units to the group object ones: A to mA (DPT 9.021), VA to kVA (DPT 9.024)
+static const float Scale[LabelStats::LABELCOUNT] = {1000.0f, 0.001f, 1000.0f, 1000.0f, 1000.0f};
+
+void LabelStats::init(int baseAddr, uint16_t baseGO)
+{
+    mParams.enabled = knx.paramInt(baseAddr);
+    for (int i = 0; i < LABELCOUNT; ++i)
+    {
+        const Dpt dpt = i == PAPP ? DPT_Value_Power : DPT_Value_Curr;
+        knx.getGroupObject(m_GO.label[i].min = ++baseGO).dataPointType(dpt);
+        knx.getGroupObject(m_GO.label[i].max = ++baseGO).dataPointType(dpt);
+        knx.getGroupObject(m_GO.label[i].mean = ++baseGO).dataPointType(dpt);
+        knx.getGroupObject(m_GO.label[i].weightedMean = ++baseGO).dataPointType(dpt);
+    }
+}
+
+void LabelStats::sample(Label label, uint32_t value, uint32_t current)
+{
+    if ((mParams.enabled & (1 << label)) == 0)
+        return;
+    Stat &stat = mStats[label];
+    if (!stat.active)
+    {
+        stat.min = stat.max = value;
+        stat.start = current;
+        stat.active = true;
+    }
+    else
+    {
+        stat.weighted += (uint64_t)stat.last * (current - stat.lastTime);
+        stat.min = MIN(stat.min, value);
+        stat.max = MAX(stat.max, value);
+    }
+    stat.sum += value;
+    ++stat.count;
+    stat.last = value;
+    stat.lastTime = current;
+}
+
+void LabelStats::emit(Label label, uint32_t current)
+{
+    Stat &stat = mStats[label];
+    if (stat.count == 0)
+        return; // No frame in the period
+    stat.weighted += (uint64_t)stat.last * (current - stat.lastTime);
+    const uint32_t elapsed = current - stat.start;
+    const float scale = Scale[label];
+    knx.getGroupObject(m_GO.label[label].min).value(stat.min * scale);
+    knx.getGroupObject(m_GO.label[label].max).value(stat.max * scale);
+    knx.getGroupObject(m_GO.label[label].mean).value((float)stat.sum / stat.count * scale);
+    knx.getGroupObject(m_GO.label[label].weightedMean).value(elapsed != 0 ? (float)stat.weighted / elapsed * scale : stat.last * scale);
+    // The last value holds until the next frame: it opens the next period
+    stat.min = stat.max = stat.last;
+    stat.sum = stat.count = 0;
+    stat.weighted = 0;
+    stat.start = stat.lastTime = current;
+}
+
+void LabelStats::loop(uint32_t current, const PublishSchedule &schedule, uint32_t period)
+{
+    if (mParams.enabled == 0 || (period == 0 && !schedule.aligned()))
+        return;
+    if (mPeriodStart == 0)
+        mPeriodStart = current;
+    if (!schedule.due(mPeriodStart, current, period - 1)) // Over after period ms when not aligned
+        return;
+    mPeriodStart = current;
+    for (int i = 0; i < LABELCOUNT; ++i)
+    {
+        if (mStats[i].active)
+            emit((Label)i, current);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef LABELSTATS_H
+#define LABELSTATS_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "PublishSchedule.h"
+
+// Streaming min/max/mean of the instantaneous labels over each send period, so peaks between two
+// telegrams are not lost. Updated in O(1) per TIC frame, emitted at the end of each period.
+class LabelStats
+{
+public:
+    enum Label
+    {
+        IINST = 0,
+        PAPP,
+        IINST1,
+        IINST2,
+        IINST3,
+        LABELCOUNT
+    };
+
+private:
+    struct
+    {
+        uint32_t enabled; // Bit mask of Label
+    } mParams;
+    struct
+    {
+        struct
+        {
+            uint16_t min;
+            uint16_t max;
+            uint16_t mean;
+            uint16_t weightedMean; // Time-weighted
+        } label[LABELCOUNT];
+    } m_GO;
+
+    struct Stat
+    {
+        uint32_t min;
+        uint32_t max;
+        uint32_t last;
+        uint32_t count; // Frames in the period
+        uint64_t sum;
+        uint64_t weighted; // Value * ms
+        uint32_t start;
+        uint32_t lastTime;
+        bool active;
+    } mStats[LABELCOUNT] = {0};
+    uint32_t mPeriodStart = 0;
+
+    void emit(Label label, uint32_t current);
+
+public:
+    LabelStats(){};
+    void init(int baseAddr, uint16_t baseGO);
+    void sample(Label label, uint32_t value, uint32_t current);
+    void loop(uint32_t current, const PublishSchedule &schedule, uint32_t period);
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "LoadShedding.h"
+
+void LoadShedding::init(int baseAddr, uint16_t baseGO, uint32_t current)
+{
+    mParams.threshold = knx.paramInt(baseAddr);
+    mParams.hysteresis = knx.paramInt(baseAddr + 4);
+    mParams.restoreDelay = knx.paramInt(baseAddr + 8);
+    baseAddr += 12;
+    for (int i = 0; i < SHEDDING_CHANNELS; ++i, baseAddr += 12)
+    {
+        mParams.channel[i].priority = knx.paramInt(baseAddr);
+        mParams.channel[i].power = knx.paramInt(baseAddr + 4);
+        mParams.channel[i].minOff = knx.paramInt(baseAddr + 8);
+    }
+    knx.getGroupObject(m_GO.active = ++baseGO).dataPointType(DPT_Alarm);
+    for (int i = 0; i < SHEDDING_CHANNELS; ++i)
+        knx.getGroupObject(m_GO.channel[i] = ++baseGO).dataPointType(DPT_Switch);
+
+    // Insertion sort by priority, done once per configuration
+    const uint8_t previousCount = mCount;
+    uint8_t previousOrder[SHEDDING_CHANNELS];
+    memcpy(previousOrder, mOrder, sizeof(mOrder));
+    mCount = 0;
+    for (uint8_t i = 0; i < SHEDDING_CHANNELS; ++i)
+    {
+        if (mParams.channel[i].priority == 0)
+            continue;
+        uint8_t pos = mCount++;
+        for (; pos > 0 && mParams.channel[mOrder[pos - 1]].priority > mParams.channel[i].priority; --pos)
+            mOrder[pos] = mOrder[pos - 1];
+        mOrder[pos] = i;
+    }
+    knx.getGroupObject(m_GO.active).valueNoSend(mShed != 0);
+    if (mStarted && mCount == previousCount && memcmp(previousOrder, mOrder, mCount) == 0)
+        return; // Same channels after an ETS download: keep the shedding state
+    mStarted = true;
+    mLastAction = current;
+    mPendingPower = 0;
+    if (restoreShed(current))
+        return;
+    // Output states unknown (no snapshot, or other channels): switch every channel off, then restore them progressively
+    mShed = mCount;
+    for (uint8_t i = 0; i < mCount; ++i)
+        switchChannel(mOrder[i], false, current);
+    knx.getGroupObject(m_GO.active).value(mShed != 0);
+}
+
+// Channels left as the snapshot has them, when the shed ones are still the last ones of the order. No telegram:
+// the outputs kept their state over the restart
+bool LoadShedding::restoreShed(uint32_t current)
+{
+    if (!mRestoredValid)
+        return false;
+    mRestoredValid = false;
+    uint8_t shed = 0;
+    uint8_t tail = 0;
+    while (shed < mCount && (mRestored.off & (1 << mOrder[mCount - 1 - shed])))
+        tail |= 1 << mOrder[mCount - 1 - shed++];
+    if (tail != mRestored.off)
+        return false;
+    mShed = shed;
+    for (uint8_t i = 0; i < mCount; ++i)
+    {
+        const uint8_t channel = mOrder[i];
+        const bool off = mRestored.off & (1 << channel);
+        if (off)
+            mOffSince[channel] = current - mRestored.offFor[channel]; // Time off before the restart counts for minOff
+        knx.getGroupObject(m_GO.channel[channel]).valueNoSend(!off);
+    }
+    knx.getGroupObject(m_GO.active).valueNoSend(mShed != 0);
+    return true;
+}
+
+LoadShedding::State LoadShedding::state(uint32_t current) const
+{
+    if (!mStarted)
+        return mRestored; // Not applied yet
+    State s = {0};
+    for (uint8_t i = 0; i < mShed; ++i)
+    {
+        const uint8_t channel = mOrder[mCount - 1 - i];
+        s.off |= 1 << channel;
+        s.offFor[channel] = current - mOffSince[channel];
+    }
+    return s;
+}
+
+void LoadShedding::restore(const State &state)
+{
+    mRestored = state;
+    mRestoredValid = true;
+}
+
+void LoadShedding::switchChannel(uint8_t channel, bool on, uint32_t current)
+{
+    if (!on)
+        mOffSince[channel] = current;
+    knx.getGroupObject(m_GO.channel[channel]).value(on);
+}
+
+void LoadShedding::update(uint32_t load, uint32_t subscribed, uint32_t current)
+{
+    if (mCount == 0 || subscribed == 0)
+        return;
+    const bool wasActive = mShed != 0;
+    const uint32_t limit = subscribed * mParams.threshold / 100;
+    if (current - mLastAction > SHEDDING_SETTLE_PERIOD)
+        mPendingPower = 0;
+    int32_t excess = (int32_t)(load - mPendingPower) - (int32_t)limit;
+    if (excess > 0 && mShed < mCount)
+    {
+        // Shed as many channels as needed at once, least important first
+        while (excess > 0 && mShed < mCount)
+        {
+            const uint8_t channel = mOrder[mCount - 1 - mShed];
+            switchChannel(channel, false, current);
+            ++mShed;
+            excess -= mParams.channel[channel].power;
+            mPendingPower += mParams.channel[channel].power;
+        }
+        mLastAction = current;
+    }
+    else if (excess <= 0 && mShed > 0 && current - mLastAction >= mParams.restoreDelay * 1000)
+    {
+        // Restore the most important shed channel if it fits under the limit with the hysteresis margin
+        const uint8_t channel = mOrder[mCount - mShed];
+        if (current - mOffSince[channel] >= mParams.channel[channel].minOff * 1000 &&
+            load + mParams.channel[channel].power + mParams.hysteresis <= limit)
+        {
+            switchChannel(channel, true, current);
+            --mShed;
+            mLastAction = current;
+            mPendingPower = 0;
+        }
+    }
+    if (wasActive != (mShed != 0))
+        knx.getGroupObject(m_GO.active).value(mShed != 0);
+}
+
+bool LoadShedding::active() const { return mShed != 0; }
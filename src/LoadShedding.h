@@ -0,0 +1,69 @@
+#ifndef LOADSHEDDING_H
+#define LOADSHEDDING_H
+
+#include <Arduino.h>
+#include <knx.h>
+
+#define SHEDDING_CHANNELS 6
+#define SHEDDING_SETTLE_PERIOD 3000 // A shed load shows on the meter within ~2 frames
+
+// Priority load shedding (delestage): switches KNX outputs off from the least important one when the
+// load goes over the subscribed power, then restores them one by one, most important first.
+class LoadShedding
+{
+    struct
+    {
+        uint32_t threshold;    // In % of ISOUSC
+        uint32_t hysteresis;   // In VA, margin kept when restoring a channel
+        uint32_t restoreDelay; // In seconds, between two restore steps
+        struct
+        {
+            uint32_t priority; // 1 = most important, 0 = channel not used
+            uint32_t power;    // Estimated load in VA
+            uint32_t minOff;   // In seconds
+        } channel[SHEDDING_CHANNELS];
+    } mParams;
+    struct
+    {
+        uint16_t active;
+        uint16_t channel[SHEDDING_CHANNELS];
+    } m_GO;
+
+    uint8_t mOrder[SHEDDING_CHANNELS]; // Used channels, most important first
+    uint8_t mCount = 0;
+    uint8_t mShed = 0; // The last mShed channels of mOrder are off
+    uint32_t mOffSince[SHEDDING_CHANNELS] = {0};
+    uint32_t mLastAction = 0;
+    uint32_t mPendingPower = 0; // Shed in the settle period, not yet seen by the meter
+    bool mStarted = false;
+
+public:
+    // Channels shed, kept in the TeleInfo snapshot so a restart leaves the outputs as they are
+    struct State
+    {
+        uint8_t off;                        // Bit per channel
+        uint32_t offFor[SHEDDING_CHANNELS]; // In ms, when the state was taken
+    };
+
+private:
+    State mRestored = {0};
+    bool mRestoredValid = false; // mRestored not yet applied by init()
+
+    void switchChannel(uint8_t channel, bool on, uint32_t current);
+    bool restoreShed(uint32_t current);
+
+public:
+    LoadShedding(){};
+    void init(int baseAddr, uint16_t baseGO, uint32_t current);
+    void update(uint32_t load, uint32_t subscribed, uint32_t current);
+    bool active() const;
+    State state(uint32_t current) const;
+    void restore(const State &state); // Before init()
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "OverloadForecast.h"
+
+void OverloadForecast::init(int baseAddr, uint16_t baseGO)
+{
+    mParams.threshold = knx.paramInt(baseAddr);
+    mParams.horizon = knx.paramInt(baseAddr + 4);
+    mPredictor.configure(mParams.threshold, mParams.horizon);
+    knx.getGroupObject(m_GO.warning = ++baseGO).dataPointType(DPT_Alarm);
+    knx.getGroupObject(m_GO.timeToLimit = ++baseGO).dataPointType(DPT_TimePeriodSec);
+    knx.getGroupObject(m_GO.warning).valueNoSend(mPredictor.warning());
+    knx.getGroupObject(m_GO.timeToLimit).valueNoSend((uint16_t)MIN(mPredictor.timeToLimit() / 1000, 0xffffUL));
+}
+
+// IINST (phase 0) or IINSTn (phase n) line, in A
+void OverloadForecast::sample(uint8_t phase, uint32_t amps, uint32_t isousc, uint32_t current)
+{
+    if (!mPredictor.sample(phase, amps, isousc, current))
+        return;
+    if (mPredictor.warning())
+    { // Time left first, so that it is known when the warning is received
+        knx.getGroupObject(m_GO.timeToLimit).value((uint16_t)MIN(mPredictor.timeToLimit() / 1000, 0xffffUL));
+    }
+    knx.getGroupObject(m_GO.warning).value(mPredictor.warning());
+}
+
+bool OverloadForecast::warning() const { return mPredictor.warning(); }
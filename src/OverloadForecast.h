@@ -0,0 +1,37 @@
+#ifndef OVERLOADFORECAST_H
+#define OVERLOADFORECAST_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "OverloadPredictor.h"
+
+// Early warning sent before ADPS: raised when the trend of a phase current is projected to cross a fraction of
+// ISOUSC within the horizon, so that load shedding can act before the breaker trips
+class OverloadForecast
+{
+    struct
+    {
+        uint32_t threshold; // In % of ISOUSC, 0: disabled
+        uint32_t horizon;   // In seconds
+    } mParams;
+    struct
+    {
+        uint16_t warning;
+        uint16_t timeToLimit;
+    } m_GO;
+
+    OverloadPredictor mPredictor;
+
+public:
+    OverloadForecast(){};
+    void init(int baseAddr, uint16_t baseGO);
+    void sample(uint8_t phase, uint32_t amps, uint32_t isousc, uint32_t current);
+    bool warning() const;
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
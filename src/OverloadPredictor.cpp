@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include "OverloadPredictor.h"
+
+// threshold: in % of ISOUSC, horizon: in s
+void OverloadPredictor::configure(uint32_t threshold, uint32_t horizon)
+{
+    mThreshold = threshold;
+    mHorizon = horizon * 1000;
+}
+
+// Time for the trend to reach the limit, from the current time
+uint32_t OverloadPredictor::timeToLimit(const Trend &trend, int32_t limit, uint32_t current) const
+{
+    const int32_t level = trend.level + (int64_t)trend.slope * (int32_t)(current - trend.last) / 1000;
+    if (level >= limit)
+        return 0;
+    if (trend.slope <= 0)
+        return FORECAST_NEVER;
+    const int64_t ms = (int64_t)(limit - level) * 1000 / trend.slope;
+    return ms < FORECAST_NEVER ? (uint32_t)ms : FORECAST_NEVER;
+}
+
+// One IINST line (phase 0) or IINSTn line (phase n), in A. Tells whether the warning changed
+bool OverloadPredictor::sample(uint8_t phase, uint32_t amps, uint32_t isousc, uint32_t current)
+{
+    if (mThreshold == 0 || isousc == 0 || phase >= FORECAST_PHASES)
+        return false;
+    Trend &trend = mTrend[phase];
+    const int32_t mA = amps * 1000;
+    if (!trend.started || current - trend.last > FORECAST_GAP)
+    {
+        trend.level = mA;
+        trend.slope = 0;
+        trend.started = true;
+    }
+    else if (current != trend.last)
+    {
+        const int32_t dt = current - trend.last;
+        const int32_t predicted = trend.level + (int64_t)trend.slope * dt / 1000;
+        const int32_t level = predicted + ((mA - predicted) >> FORECAST_LEVEL_SHIFT);
+        const int32_t slope = (int64_t)(level - trend.level) * 1000 / dt;
+        trend.slope += (slope - trend.slope) >> FORECAST_SLOPE_SHIFT;
+        trend.level = level;
+    }
+    trend.last = current;
+
+    // Earliest crossing over the phases still sampled
+    const int32_t limit = isousc * mThreshold * 10;
+    mTimeToLimit = FORECAST_NEVER;
+    for (int i = 0; i < FORECAST_PHASES; ++i)
+    {
+        if (mTrend[i].started && current - mTrend[i].last <= FORECAST_GAP)
+        {
+            const uint32_t ms = timeToLimit(mTrend[i], limit, current);
+            if (ms < mTimeToLimit)
+                mTimeToLimit = ms;
+        }
+    }
+    if (mTimeToLimit <= mHorizon)
+    {
+        mClearSince = 0;
+        if (mWarning)
+            return false;
+        mWarning = true;
+        return true;
+    }
+    if (!mWarning)
+        return false;
+    if (mClearSince == 0)
+        mClearSince = current | 1;
+    if (current - mClearSince < FORECAST_CLEAR_DELAY)
+        return false;
+    mWarning = false;
+    mClearSince = 0;
+    return true;
+}
+
+bool OverloadPredictor::warning() const { return mWarning; }
+uint32_t OverloadPredictor::timeToLimit() const { return mTimeToLimit; }
@@ -0,0 +1,40 @@
+#ifndef OVERLOADPREDICTOR_H
+#define OVERLOADPREDICTOR_H
+
+#include <stdint.h>
+
+#define FORECAST_PHASES 4               // IINST, IINST1 to IINST3
+#define FORECAST_LEVEL_SHIFT 1          // Level gain 1/2
+#define FORECAST_SLOPE_SHIFT 2          // Slope gain 1/4
+#define FORECAST_GAP (30 * 1000)        // Trend restarted after 30s without sample
+#define FORECAST_CLEAR_DELAY (10 * 1000) // Warning cleared after 10s without crossing in the horizon
+#define FORECAST_NEVER 0xffffffffU
+
+// Early overload warning: per phase incremental trend of the current (double exponential smoothing, O(1) per
+// sample), projected over a horizon against a fraction of ISOUSC. Shared by the firmware and the host tools
+// (no Arduino dependency).
+class OverloadPredictor
+{
+    struct Trend
+    {
+        int32_t level; // In mA
+        int32_t slope; // In mA/s
+        uint32_t last;
+        bool started;
+    } mTrend[FORECAST_PHASES] = {0};
+    uint32_t mThreshold = 0; // In % of ISOUSC
+    uint32_t mHorizon = 0;   // In ms
+    uint32_t mTimeToLimit = FORECAST_NEVER;
+    uint32_t mClearSince = 0;
+    bool mWarning = false;
+
+    uint32_t timeToLimit(const Trend &trend, int32_t limit, uint32_t current) const;
+
+public:
+    void configure(uint32_t threshold, uint32_t horizon);
+    bool sample(uint8_t phase, uint32_t amps, uint32_t isousc, uint32_t current);
+    bool warning() const;
+    uint32_t timeToLimit() const; // In ms, FORECAST_NEVER when no phase is rising towards the limit
+};
+
+#endif
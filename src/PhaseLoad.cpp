@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "PhaseLoad.h"
+
+uint32_t PhaseLoad::isqrt(uint64_t v)
+{
+    uint64_t result = 0, bit = (uint64_t)1 << 62;
+    while (bit > v)
+        bit >>= 2;
+    for (; bit != 0; bit >>= 2)
+    {
+        if (v >= result + bit)
+        {
+            v -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else
+            result >>= 1;
+    }
+    return (uint32_t)result;
+}
+
+void PhaseLoad::init(int baseAddr, uint16_t baseGO)
+{
+    mParams.averageShift = MIN(knx.paramInt(baseAddr), 12U);
+    mParams.currentDeadband = knx.paramInt(baseAddr + 4);     // In mA
+    mParams.imbalanceDeadband = knx.paramInt(baseAddr + 8);   // In 0.01%
+    knx.getGroupObject(m_GO.imbalance = ++baseGO).dataPointType(DPT_Percent_V16);
+    knx.getGroupObject(m_GO.neutral = ++baseGO).dataPointType(DPT_Value_Curr);
+    knx.getGroupObject(m_GO.mostLoaded = ++baseGO).dataPointType(DPT_Value_1_Ucount);
+    for (int i = 0; i < PHASECOUNT; ++i)
+        knx.getGroupObject(m_GO.average[i] = ++baseGO).dataPointType(DPT_Value_Curr);
+    for (int i = 0; i < PHASECOUNT; ++i)
+        knx.getGroupObject(m_GO.peak[i] = ++baseGO).dataPointType(DPT_Value_Electric_Current);
+    if (!mActive)
+        return;
+    // Called again after an ETS download: group objects are rebuilt empty
+    knx.getGroupObject(m_GO.imbalance).valueNoSend((float)mImbalance.value / 100);
+    knx.getGroupObject(m_GO.neutral).valueNoSend((float)mNeutral.value);
+    knx.getGroupObject(m_GO.mostLoaded).valueNoSend((uint8_t)mMostLoaded.value);
+    for (int i = 0; i < PHASECOUNT; ++i)
+    {
+        knx.getGroupObject(m_GO.average[i]).valueNoSend((float)mAverageOut[i].value);
+        knx.getGroupObject(m_GO.peak[i]).valueNoSend((uint16_t)mPeak[i].value);
+    }
+}
+
+void PhaseLoad::sample(const uint32_t iinst[PHASECOUNT])
+{
+    const int32_t i1 = iinst[0], i2 = iinst[1], i3 = iinst[2];
+    const int32_t sum = i1 + i2 + i3;
+    int maxPhase = 0;
+    for (int i = 0; i < PHASECOUNT; ++i)
+    {
+        const int32_t mA = iinst[i] * 1000;
+        if (!mActive)
+            mAverage[i] = mA << 8;
+        else
+            mAverage[i] += ((mA << 8) - mAverage[i]) >> mParams.averageShift;
+        if (mAverageOut[i].value != mAverage[i] >> 8)
+        {
+            mAverageOut[i].value = mAverage[i] >> 8;
+            knx.getGroupObject(m_GO.average[i]).valueNoSend((float)mAverageOut[i].value);
+        }
+        if (mPeak[i].value < (int32_t)iinst[i])
+        {
+            mPeak[i].value = iinst[i];
+            knx.getGroupObject(m_GO.peak[i]).valueNoSend((uint16_t)iinst[i]);
+        }
+        if (iinst[i] > iinst[maxPhase])
+            maxPhase = i;
+    }
+    mActive = true;
+
+    // Deviation of the most loaded phase from the average
+    const int32_t imbalance = sum != 0 ? (3 * (int32_t)iinst[maxPhase] - sum) * 10000 / sum : 0;
+    if (mImbalance.value != imbalance)
+    {
+        mImbalance.value = imbalance;
+        knx.getGroupObject(m_GO.imbalance).valueNoSend((float)imbalance / 100);
+    }
+    // Phases 120 degrees apart, unity power factor
+    const int32_t neutral = isqrt((uint64_t)(i1 * i1 + i2 * i2 + i3 * i3 - i1 * i2 - i2 * i3 - i3 * i1) * 1000000);
+    if (mNeutral.value != neutral)
+    {
+        mNeutral.value = neutral;
+        knx.getGroupObject(m_GO.neutral).valueNoSend((float)neutral);
+    }
+    if (mMostLoaded.value != maxPhase + 1)
+    {
+        mMostLoaded.value = maxPhase + 1;
+        knx.getGroupObject(m_GO.mostLoaded).valueNoSend((uint8_t)(maxPhase + 1));
+    }
+}
+
+bool PhaseLoad::publish(uint16_t go, Output &out, uint32_t deadband)
+{
+    const uint32_t delta = abs(out.value - out.lastSent);
+    if (out.sent && (delta == 0 || delta < deadband))
+        return false;
+    out.lastSent = out.value;
+    out.sent = true;
+    knx.getGroupObject(go).objectWritten();
+    return true;
+}
+
+void PhaseLoad::loop(uint32_t current, bool isRealTime, const PublishSchedule &schedule, uint32_t period)
+{
+    if (!mActive || !(isRealTime || schedule.due(mLastSend, current, period)))
+        return;
+    bool sent = publish(m_GO.imbalance, mImbalance, mParams.imbalanceDeadband);
+    sent |= publish(m_GO.neutral, mNeutral, mParams.currentDeadband);
+    sent |= publish(m_GO.mostLoaded, mMostLoaded, 0);
+    for (int i = 0; i < PHASECOUNT; ++i)
+    {
+        sent |= publish(m_GO.average[i], mAverageOut[i], mParams.currentDeadband);
+        sent |= publish(m_GO.peak[i], mPeak[i], 0);
+    }
+    if (sent)
+        mLastSend = current;
+}
+
+void PhaseLoad::newDay()
+{
+    for (int i = 0; i < PHASECOUNT; ++i)
+    {
+        mPeak[i].value = 0;
+        knx.getGroupObject(m_GO.peak[i]).valueNoSend((uint16_t)0);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PHASELOAD_H
+#define PHASELOAD_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "PublishSchedule.h"
+
+#define PHASECOUNT 3
+
+// Streaming analytics of the three phase currents (IINST1/2/3), updated once per TIC frame
+class PhaseLoad
+{
+    struct
+    {
+        uint32_t averageShift;      // Moving average over 2^n frames
+        uint32_t currentDeadband;   // In mA
+        uint32_t imbalanceDeadband; // In 0.01%
+    } mParams;
+    struct
+    {
+        uint16_t imbalance;
+        uint16_t neutral;
+        uint16_t mostLoaded;
+        uint16_t average[PHASECOUNT];
+        uint16_t peak[PHASECOUNT];
+    } m_GO;
+
+    struct Output
+    {
+        int32_t value;
+        int32_t lastSent;
+        bool sent;
+    };
+    int32_t mAverage[PHASECOUNT] = {0}; // In mA, 8 bits fixed point
+    Output mImbalance = {0};            // In 0.01%
+    Output mNeutral = {0};              // In mA
+    Output mMostLoaded = {0};
+    Output mAverageOut[PHASECOUNT] = {0};
+    Output mPeak[PHASECOUNT] = {0}; // In A
+    uint32_t mLastSend = 0;
+    bool mActive = false;
+
+    static inline uint32_t isqrt(uint64_t v);
+    bool publish(uint16_t go, Output &out, uint32_t deadband);
+
+public:
+    PhaseLoad(){};
+    void init(int baseAddr, uint16_t baseGO);
+    void sample(const uint32_t iinst[PHASECOUNT]);
+    void loop(uint32_t current, bool isRealTime, const PublishSchedule &schedule, uint32_t period);
+    void newDay();
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
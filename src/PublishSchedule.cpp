@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "PublishSchedule.h"
+
+void PublishSchedule::init(int baseAddr)
+{
+    mParams.period = knx.paramInt(baseAddr);
+    mParams.totalsPeriod = knx.paramInt(baseAddr + 4);
+    mParams.spread = knx.paramInt(baseAddr + 8);
+    // Pseudo-random but stable offset: hash of the individual address, unique on the bus
+    mOffset = mParams.spread != 0 ? ((uint32_t)knx.individualAddress() * 2654435761UL >> 8) % (mParams.spread + 1) : 0;
+    mSlot = mTotalsSlot = -1;
+    mBoundary = mTotalsBoundary = false;
+}
+
+// Tells whether now is in a later period than slot, the first period seen only starts the schedule
+bool PublishSchedule::crossed(int64_t now, uint32_t period, uint32_t offset, int64_t &slot)
+{
+    const int64_t periodMs = (int64_t)period * 1000;
+    const int64_t current = (now - offset % periodMs) / periodMs;
+    const bool boundary = slot >= 0 && current != slot;
+    slot = current;
+    return boundary;
+}
+
+// Latches the boundaries crossed since the previous call, once per TeleInfo::loop()
+void PublishSchedule::loop(RTCKnx &rtc)
+{
+    mValid = mParams.period != 0 && rtc.isValid();
+    if (!mValid)
+    {
+        mSlot = mTotalsSlot = -1;
+        return;
+    }
+    const int64_t now = rtc.now();
+    mBoundary = crossed(now, mParams.period, mOffset, mSlot);
+    mTotalsBoundary = mParams.totalsPeriod != 0 ? crossed(now, mParams.totalsPeriod, mOffset, mTotalsSlot) : mBoundary;
+}
+
+bool PublishSchedule::aligned() const { return mValid; }
+
+// Period started at last is over: on the next boundary when aligned, period ms after last otherwise
+bool PublishSchedule::due(uint32_t last, uint32_t current, uint32_t period) const
+{
+    return mValid ? mBoundary : current - last > period;
+}
+
+bool PublishSchedule::totalsDue(uint32_t last, uint32_t current, uint32_t period) const
+{
+    return mValid ? mTotalsBoundary : current - last > period;
+}
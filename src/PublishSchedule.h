@@ -0,0 +1,44 @@
+#ifndef PUBLISHSCHEDULE_H
+#define PUBLISHSCHEDULE_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "RTCKnx.h"
+
+// Optional wall clock schedule of the periodic sends: values are published when the clock crosses a multiple of
+// the period (periods dividing a day fall on round times: every 10s, on the minute, on the quarter-hour...), shifted
+// by a per-device offset so that devices configured alike do not all send at once. Each object keeps its own
+// period timer while disabled or while the clock is not set.
+class PublishSchedule
+{
+    struct
+    {
+        uint32_t period;       // In seconds, labels, phase analytics and statistics, 0: not aligned
+        uint32_t totalsPeriod; // In seconds, history and cost totals, 0: same as period
+        uint32_t spread;       // In ms, largest per-device offset
+    } mParams;
+
+    uint32_t mOffset = 0;
+    int64_t mSlot = -1;
+    int64_t mTotalsSlot = -1;
+    bool mBoundary = false;
+    bool mTotalsBoundary = false;
+    bool mValid = false;
+
+    static bool crossed(int64_t now, uint32_t period, uint32_t offset, int64_t &slot);
+
+public:
+    PublishSchedule(){};
+    void init(int baseAddr);
+    void loop(RTCKnx &rtc);
+    bool aligned() const;
+    bool due(uint32_t last, uint32_t current, uint32_t period) const;
+    bool totalsDue(uint32_t last, uint32_t current, uint32_t period) const;
+    enum
+    {
+        NBGO = 0,
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
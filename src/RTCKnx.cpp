@@ -2,57 +2,173 @@
 #include <knx.h>
 #include "RTCKnx.h"
 
-void RTCKnx::setAndAjust()
+void RTCKnx::synchronize(int64_t ms)
 {
-    if (isValid())
+    const uint32_t local = RTCKnx::millis();
+    const uint32_t previousSync = mLastSync;
+    mLastSync = local | 1;
+    if (!mSynced)
     {
-        uint32_t t = RTCKnx::millis();
-        if (mLastSync != 0)
+        mRefMs = mFreqBaseMs = ms;
+        mRefLocal = mFreqBaseLocal = local;
+        mPendingDateMs = mPendingTimeMs = -1;
+        mSynced = true;
+        dateTime();
+        if (mDayCallback)
         {
-            const int64_t num = 1000 * (secondsSinceReference(mDateTimeStamp) - secondsSinceReference(mLastDateTime)) * mCorr.denum / mCorr.num;
-            const int64_t denum = ((num & ~(int64_t)UINT32_MAX)) + (t - mLastSync);
-            if (num != 0 && denum != 0 && num * 10 >= denum * 9 && num * 10 <= denum * 11)
-            {
-                mCorr.num = num;
-                mCorr.denum = denum;
-            }
+            mDayCallback(mDayCallbackObject, Init);
         }
-        bool bInit = mShift == 0;
-        mLastSync = mShift = t | 1;
-        mLastDateTime = mDateTimeStamp;
-        if (bInit && mDayCallback)
+        return;
+    }
+    const int64_t predicted = nowMs(local);
+    const int64_t error = ms - predicted;
+    const int64_t drift = (int64_t)(local - previousSync) * RTC_MAX_DRIFT_PPM / 1000000; // At most, since the last one
+    mRefLocal = local;
+    const bool large = error > RTC_STEP_THRESHOLD || error < -RTC_STEP_THRESHOLD;
+    if (large && (error > drift || error < -drift))
+    {
+        // Clock change: step, and move the frequency baseline along
+        mRefMs = ms;
+        mFreqBaseMs += error;
+    }
+    else
+    {
+        // Phase: partial correction filters the bus jitter, the drift of long periods between synchronisations
+        // is caught up at once
+        mRefMs = large ? ms : predicted + error / RTC_PHASE_GAIN;
+        // Frequency: measured over the whole baseline, so the 1s resolution fades as it grows
+        const uint32_t span = local - mFreqBaseLocal;
+        if (span >= RTC_MIN_FREQ_SPAN)
         {
-            mDayCallback(Init);
+            const int64_t measured = (ms - mFreqBaseMs - (int64_t)span) * 1000000000LL / span;
+            mFreqPpb = MAX(MIN(mFreqPpb + (measured - mFreqPpb) / 2, (int64_t)RTC_MAX_FREQ_PPB), -(int64_t)RTC_MAX_FREQ_PPB);
+            if (span >= RTC_MAX_FREQ_SPAN)
+            {
+                mFreqBaseMs = ms;
+                mFreqBaseLocal = local;
+            }
         }
     }
+    dateTime();
+}
+
+int64_t RTCKnx::nowMs(uint32_t local) const
+{
+    const uint32_t elapsed = local - mRefLocal;
+    return mRefMs + elapsed + (int64_t)elapsed * mFreqPpb / 1000000000;
+}
+
+// Records the source activity and tells whether its time must be used
+bool RTCKnx::accept(bool meter)
+{
+    const uint32_t current = RTCKnx::millis() | 1;
+    uint32_t &last = meter ? mLastMeterTime : mLastKnxTime;
+    last = current;
+    const uint32_t primary = meter ? mLastKnxTime : mLastMeterTime;
+    switch (mSource)
+    {
+    case KnxOnly:
+    default:
+        return !meter;
+    case MeterOnly:
+        return meter;
+    case KnxFirst:
+        return !meter || primary == 0 || current - primary > RTC_SOURCE_TIMEOUT;
+    case MeterFirst:
+        return meter || primary == 0 || current - primary > RTC_SOURCE_TIMEOUT;
+    }
+}
+
+void RTCKnx::meterTime(const DateTime &dt)
+{
+    if (!accept(true))
+        return;
+    const uint32_t current = RTCKnx::millis() | 1;
+    if (mSynced && mLastMeterSync != 0 && current - mLastMeterSync < RTC_METER_PERIOD)
+        return;
+    mLastMeterSync = current;
+    synchronize(secondsSinceReference(dt) * 1000);
+}
+
+void RTCKnx::timeSource(uint32_t source) { mSource = source; }
+
+void RTCKnx::setDate(const DateTime &date)
+{
+    const int64_t dateMs = secondsSinceReference(date) * 1000;
+    if (!mSynced)
+    {
+        mPendingDateMs = dateMs;
+        if (mPendingTimeMs >= 0)
+            synchronize(dateMs + mPendingTimeMs + (RTCKnx::millis() - mPendingTimeLocal));
+        return;
+    }
+    // Date alone carries no timing: only used to fix a wrong day, away from midnight where date and time may straddle it
+    const int64_t now = nowMs(RTCKnx::millis());
+    const int64_t timeOfDay = now % RTC_DAY_MS;
+    if (timeOfDay < RTC_MIDNIGHT_GUARD || timeOfDay > RTC_DAY_MS - RTC_MIDNIGHT_GUARD)
+        return;
+    if (now - timeOfDay != dateMs)
+        synchronize(dateMs + timeOfDay);
+}
+
+void RTCKnx::setTime(int64_t timeOfDayMs)
+{
+    if (!mSynced)
+    {
+        mPendingTimeMs = timeOfDayMs;
+        mPendingTimeLocal = RTCKnx::millis();
+        if (mPendingDateMs >= 0)
+            synchronize(mPendingDateMs + timeOfDayMs);
+        return;
+    }
+    // Keep the day closest to the local clock (time received around midnight)
+    const int64_t now = nowMs(RTCKnx::millis());
+    int64_t ms = now - now % RTC_DAY_MS + timeOfDayMs;
+    if (ms - now > RTC_DAY_MS / 2)
+        ms -= RTC_DAY_MS;
+    else if (now - ms > RTC_DAY_MS / 2)
+        ms += RTC_DAY_MS;
+    synchronize(ms);
+}
+
+void RTCKnx::onDate(GroupObject &go, uint8_t)
+{
+    if (!accept(false))
+        return;
+    const struct tm date = go.value();
+    setDate(DateTime{0, 0, 0, (uint16_t)date.tm_mday, (uint16_t)(date.tm_mon - 1), (uint16_t)date.tm_year});
+}
+void RTCKnx::onTime(GroupObject &go, uint8_t)
+{
+    if (!accept(false))
+        return;
+    const struct tm time = go.value();
+    setTime(((time.tm_hour * 60 + time.tm_min) * 60 + time.tm_sec) * 1000LL);
+}
+void RTCKnx::onDateTime(GroupObject &go, uint8_t)
+{
+    if (!accept(false))
+        return;
+    const struct tm time = go.value();
+    const DateTime dt = {(uint16_t)time.tm_sec, (uint16_t)time.tm_min, (uint16_t)time.tm_hour, (uint16_t)time.tm_mday, (uint16_t)(time.tm_mon - 1), (uint16_t)time.tm_year};
+    synchronize(secondsSinceReference(dt) * 1000);
 }
 
 void RTCKnx::init(int baseAddr, uint16_t baseGO)
 {
-    if (mPersistentTimer != 0)
-        new (&mDayCallback) std::function<void(DateChange)>();
-    mLastSync = mLastRequested = 0;
-    mTimerOffset = mPersistentTimer;                     // Load last timer before reset
+    if (!mStarted)
+    { // Called again after an ETS download: keep the clock running
+        mLastSync = mLastRequested = 0;
+        mTimerOffset = mPersistentTimer; // Load last timer before reset
+        mStarted = true;
+    }
     mParams.period = knx.paramInt(baseAddr) * 60 * 1000; // In minutes
     knx.getGroupObject(m_GO.date = ++baseGO).dataPointType(DPT_Date);
-    knx.getGroupObject(m_GO.date).callback([this](GroupObject &go)
-                                           {
-            const struct tm date = go.value();
-            mDateTimeStamp.tm_year = date.tm_year; mDateTimeStamp.tm_mon = date.tm_mon - 1; mDateTimeStamp.tm_mday = date.tm_mday;
-            setAndAjust(); });
+    GroupObjectDispatch::attach<RTCKnx, &RTCKnx::onDate>(m_GO.date, this);
     knx.getGroupObject(m_GO.time = ++baseGO).dataPointType(Dpt(10, 1, 1) /*DPT_TimeOfDay*/);
-    knx.getGroupObject(m_GO.time).callback([this](GroupObject &go)
-                                           {
-            const struct tm time = go.value();
-            mDateTimeStamp.tm_hour = time.tm_hour; mDateTimeStamp.tm_min = time.tm_min; mDateTimeStamp.tm_sec = time.tm_sec;
-            setAndAjust(); });
+    GroupObjectDispatch::attach<RTCKnx, &RTCKnx::onTime>(m_GO.time, this);
     knx.getGroupObject(m_GO.dateTime = ++baseGO).dataPointType(DPT_DateTime);
-    knx.getGroupObject(m_GO.dateTime).callback([this](GroupObject &go)
-                                               {
-            const struct tm time = go.value();
-            mDateTimeStamp.tm_year = time.tm_year; mDateTimeStamp.tm_mon = time.tm_mon - 1; mDateTimeStamp.tm_mday = time.tm_mday; 
-            mDateTimeStamp.tm_hour = time.tm_hour; mDateTimeStamp.tm_min = time.tm_min; mDateTimeStamp.tm_sec = time.tm_sec;
-            setAndAjust(); });
+    GroupObjectDispatch::attach<RTCKnx, &RTCKnx::onDateTime>(m_GO.dateTime, this);
     knx.getGroupObject(m_GO.dateTimeStatus = ++baseGO).dataPointType(DPT_DateTime);
     if (isValid())
         updateStatus();
@@ -60,88 +176,48 @@ void RTCKnx::init(int baseAddr, uint16_t baseGO)
 
 const RTCKnx::DateTime &RTCKnx::dateTime()
 {
-    // Adjust clock deviation
-    if (mShift != 0)
-    {
-        uint32_t current = RTCKnx::millis() | 1;
-        if ((current - mShift) < 1000)
-            return mDateTimeStamp;
-        int32_t adjmSec = (current - mShift) * mCorr.num / mCorr.denum;
-        int32_t restmSec = adjmSec % 1000;
-        mDateTimeStamp.tm_sec += adjmSec / 1000;
-        mShift = (current - restmSec) | 1;
-        if (mDateTimeStamp.tm_sec >= 60)
-        {
-            mDateTimeStamp.tm_min += mDateTimeStamp.tm_sec / 60;
-            mDateTimeStamp.tm_sec = mDateTimeStamp.tm_sec % 60;
-        }
-        if (mDateTimeStamp.tm_min >= 60)
-        {
-            mDateTimeStamp.tm_hour += mDateTimeStamp.tm_min / 60;
-            mDateTimeStamp.tm_min = mDateTimeStamp.tm_min % 60;
-        }
-        if (mDateTimeStamp.tm_hour >= 24)
-        {
-            mDateTimeStamp.tm_mday += mDateTimeStamp.tm_hour / 24;
-            mDateTimeStamp.tm_hour = mDateTimeStamp.tm_hour % 24;
-        }
-        bool bEnd = false;
-        while (!bEnd)
-        {
-            switch (mDateTimeStamp.tm_mon)
-            {
-            case 0:
-            case 2:
-            case 4:
-            case 6:
-            case 7:
-            case 9:
-            case 11:
-            {
-                if (mDateTimeStamp.tm_mday > 31)
-                {
-                    ++mDateTimeStamp.tm_mon;
-                    mDateTimeStamp.tm_mday -= 31;
-                }
-                else
-                    bEnd = true;
-            };
-            break;
-            case 1:
-            {
-                int februaryDays = ((mDateTimeStamp.tm_year & 3) == 0) && (((mDateTimeStamp.tm_year % 100) != 0) || ((mDateTimeStamp.tm_year % 400) == 0)) ? 29 : 28;
-                if (mDateTimeStamp.tm_mday > februaryDays)
-                {
-                    ++mDateTimeStamp.tm_mon;
-                    mDateTimeStamp.tm_mday -= februaryDays;
-                }
-                else
-                    bEnd = true;
-            };
-            break;
-            case 3:
-            case 5:
-            case 8:
-            case 10:
-            {
-                if (mDateTimeStamp.tm_mday > 30)
-                {
-                    ++mDateTimeStamp.tm_mon;
-                    mDateTimeStamp.tm_mday -= 30;
-                }
-                else
-                    bEnd = true;
-            };
-            break;
-            default:
-                ++mDateTimeStamp.tm_year;
-                mDateTimeStamp.tm_mon -= 12;
-            }
-        }
+    if (!mSynced)
+        return mDateTimeStamp;
+    const uint32_t local = RTCKnx::millis();
+    const int64_t now = nowMs(local);
+    if (local - mRefLocal > 60 * 60 * 1000)
+    { // Move the reference forward, far from the 32 bits local timer overflow
+        mRefMs = now;
+        mRefLocal = local;
+    }
+    const int64_t seconds = now / 1000;
+    if (seconds != mLastSeconds)
+    {
+        fromSecondsSinceReference(seconds, mDateTimeStamp);
+        mLastSeconds = seconds;
         updateStatus();
     }
     return mDateTimeStamp;
 }
+
+void RTCKnx::saveState(State &state)
+{
+    state.timer = RTCKnx::millis();
+    state.ms = mSynced ? nowMs(state.timer) : -1;
+    state.freqPpb = mFreqPpb;
+}
+
+void RTCKnx::restoreState(const State &state, bool warm)
+{
+    if (state.freqPpb >= -RTC_MAX_FREQ_PPB && state.freqPpb <= RTC_MAX_FREQ_PPB)
+        mFreqPpb = state.freqPpb;
+    if (!warm)
+        return; // Time spent powered off is unknown: wait for the next synchronisation
+    mPersistentTimer = mTimerOffset = state.timer;
+    if (state.ms >= 0)
+    {
+        mRefMs = mFreqBaseMs = state.ms;
+        mRefLocal = mFreqBaseLocal = state.timer;
+        mSynced = true;
+        mLastEmittedDay = dateTime(); // Day of the snapshot: a day change during the restart is still emitted
+    }
+}
+
 void RTCKnx::updateStatus()
 {
     knx.getGroupObject(m_GO.dateTimeStatus).valueNoSend(tm{mDateTimeStamp.tm_sec, mDateTimeStamp.tm_min, mDateTimeStamp.tm_hour, mDateTimeStamp.tm_mday, mDateTimeStamp.tm_mon + 1, mDateTimeStamp.tm_year ? mDateTimeStamp.tm_year : 1900, 0, 0, 0});
@@ -171,21 +247,51 @@ int64_t RTCKnx::secondsSinceReference(const RTCKnx::DateTime &dt)
     leapYears = leapYears / 4 - leapYears / 100 + leapYears / 400;
     return (int64_t)dt.tm_sec + (int64_t)dt.tm_min * 60 + (int64_t)dt.tm_hour * 60 * 60 + ((int64_t)dt.tm_mday - 1 + daysToMonth[dt.tm_mon % 12] + leapYears + (int64_t)(dt.tm_year + dt.tm_mon / 12 - 2020) * 365) * 60 * 60 * 24;
 }
+void RTCKnx::fromSecondsSinceReference(int64_t seconds, RTCKnx::DateTime &dt)
+{
+    static const int64_t origin = secondsSinceReference(DateTime{0, 0, 0, 1, 0, 2020});
+    static const uint8_t monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    seconds = MAX(seconds - origin, (int64_t)0);
+    uint32_t days = seconds / (60 * 60 * 24);
+    const uint32_t rest = seconds % (60 * 60 * 24);
+    dt.tm_sec = rest % 60;
+    dt.tm_min = rest / 60 % 60;
+    dt.tm_hour = rest / (60 * 60);
+    for (dt.tm_year = 2020;; ++dt.tm_year)
+    {
+        const bool leap = ((dt.tm_year & 3) == 0) && (((dt.tm_year % 100) != 0) || ((dt.tm_year % 400) == 0));
+        const uint32_t yearDays = leap ? 366 : 365;
+        if (days < yearDays)
+        {
+            for (dt.tm_mon = 0;; ++dt.tm_mon)
+            {
+                const uint32_t monthLength = monthDays[dt.tm_mon] + (leap && dt.tm_mon == 1 ? 1 : 0);
+                if (days < monthLength)
+                    break;
+                days -= monthLength;
+            }
+            break;
+        }
+        days -= yearDays;
+    }
+    dt.tm_mday = days + 1;
+}
 void RTCKnx::loop()
 {
     uint32_t currentMillis = RTCKnx::millis();
     if (currentMillis - mDelay < 100)
         return;
     mDelay = currentMillis;
-    // Ask Date/Time from the bus when required
-    if (mParams.period != 0 && (mLastRequested == 0 || ((currentMillis - mLastSync) > mParams.period && (currentMillis - mLastRequested) > mParams.period)))
+    // Ask Date/Time from the bus when required, unless the meter provides it
+    const bool meterActive = mSource == MeterOnly || (mSource == MeterFirst && mLastMeterTime != 0 && currentMillis - mLastMeterTime < RTC_SOURCE_TIMEOUT);
+    if (mParams.period != 0 && !meterActive && (mLastRequested == 0 || ((currentMillis - mLastSync) > mParams.period && (currentMillis - mLastRequested) > mParams.period)))
     {
         knx.getGroupObject(m_GO.date).requestObjectRead();
         knx.getGroupObject(m_GO.time).requestObjectRead();
         knx.getGroupObject(m_GO.dateTime).requestObjectRead();
         mLastRequested = currentMillis;
     }
-    if (mDateTimeStamp.tm_mday == 0 || !mDayCallback)
+    if (!mSynced || !mDayCallback)
         return;
     const DateTime &currentDateTime = dateTime();
     if (mLastEmittedDay.tm_mday == 0)
@@ -208,11 +314,12 @@ void RTCKnx::loop()
     }
     if (change != Same)
     {
-        mDayCallback(change);
+        mDayCallback(mDayCallbackObject, change);
         mLastEmittedDay = currentDateTime;
     }
 }
 
-void RTCKnx::setNotifier(const std::function<void(DateChange)> &notifier) { mDayCallback = notifier; }
 uint32_t RTCKnx::millis() { return mPersistentTimer = mTimerOffset + ::millis(); }
-bool RTCKnx::isValid() const { return mDateTimeStamp.tm_mday != 0 && mDateTimeStamp.tm_hour != 0xffff; } // Date + Time must be both set
+bool RTCKnx::isValid() const { return mSynced; } // Date + Time must be both set
+
+int64_t RTCKnx::now() { return mSynced ? nowMs(RTCKnx::millis()) : -1; }
@@ -4,10 +4,24 @@
 
 #include <Arduino.h>
 #include <knx.h>
+#include "GroupObjectDispatch.h"
+
+#define RTC_STEP_THRESHOLD 2000                       // In ms: larger errors are clock changes (DST...), not drift
+#define RTC_MAX_DRIFT_PPM 200                         // Oscillator tolerance: errors growing faster are clock changes too
+#define RTC_PHASE_GAIN 4                              // 1/4 of the phase error is corrected at each synchronisation
+#define RTC_MIN_FREQ_SPAN (30 * 60 * 1000)            // Bus time has a 1s resolution: measure frequency over 30 min at least
+#define RTC_MAX_FREQ_SPAN (30UL * 24 * 60 * 60 * 1000) // Restart the frequency baseline after 30 days
+#define RTC_MAX_FREQ_PPB 10000000                     // +/-1%
+#define RTC_MIDNIGHT_GUARD (5 * 60 * 1000)            // Date alone is ignored 5 min around midnight
+#define RTC_DAY_MS (24 * 60 * 60 * 1000LL)
+#define RTC_METER_PERIOD (60 * 1000)          // Meter time (every TIC frame) is used once per minute
+#define RTC_SOURCE_TIMEOUT (60 * 60 * 1000)   // Fallback source is used when the primary one is silent for 1 hour
 
 class RTCKnx
 {
-    void setAndAjust();
+    void synchronize(int64_t ms);
+    int64_t nowMs(uint32_t local) const;
+    bool accept(bool meter);
     struct
     {
         uint32_t period;
@@ -22,12 +36,28 @@ class RTCKnx
 
     uint32_t mPersistentTimer = 0; // Should stay after reset
     uint32_t mTimerOffset = 0;
-    struct
-    {
-        int64_t num = 1, denum = 1;
-    } mCorr;
+    bool mStarted = false;
+
+    // Discipline loop: real time = mRefMs + elapsed local time * (1 + mFreqPpb / 1e9)
+    bool mSynced = false;
+    int64_t mRefMs = 0; // Since secondsSinceReference() origin
+    uint32_t mRefLocal = 0;
+    int32_t mFreqPpb = 0;
+    int64_t mFreqBaseMs = 0; // Start of the frequency measurement baseline
+    uint32_t mFreqBaseLocal = 0;
+
+    // Date and time received separately before the first synchronisation
+    int64_t mPendingDateMs = -1;
+    int64_t mPendingTimeMs = -1;
+    uint32_t mPendingTimeLocal = 0;
+    int64_t mLastSeconds = -1;
+
+    // Time sources
+    uint32_t mSource = 0;
+    uint32_t mLastKnxTime = 0;   // Last time received from the bus
+    uint32_t mLastMeterTime = 0; // Last time received from the meter
+    uint32_t mLastMeterSync = 0;
 
-    uint32_t mShift = 0;
     uint32_t mLastSync = 0;
     uint32_t mDelay = 0;
     uint32_t mLastRequested = 0;
@@ -43,28 +73,60 @@ public:
         Month,
         Year
     };
+    enum TimeSource
+    {
+        KnxOnly = 0,
+        KnxFirst,   // Meter is the fallback
+        MeterFirst, // Bus is the fallback, not polled while the meter provides the time
+        MeterOnly
+    };
     typedef struct
     {
         uint16_t tm_sec /*[0-59]*/, tm_min /*[0-59]*/, tm_hour /*[0-23]*/, tm_mday /*[1-31]*/, tm_mon /*[0-11]*/, tm_year /*Year*/;
     } DateTime;
     const DateTime &dateTime();
+    struct State
+    {
+        int64_t ms; // At timer, -1 when not synchronised
+        int32_t freqPpb;
+        uint32_t timer;
+    };
+    void saveState(State &state);
+    void restoreState(const State &state, bool warm);
     void updateStatus();
     static int64_t secondsSinceReference(const DateTime &dt);
+    static void fromSecondsSinceReference(int64_t seconds, DateTime &dt);
     void loop();
-    void setNotifier(const std::function<void(DateChange)> &notifier);
+    typedef void (*Notifier)(void *object, DateChange change);
+    // Calls (object->*Method)(change) on each day change, bound at compile time
+    template <class T, void (T::*Method)(DateChange change)>
+    void setNotifier(T *object)
+    {
+        mDayCallback = [](void *object, DateChange change)
+        { (static_cast<T *>(object)->*Method)(change); };
+        mDayCallbackObject = object;
+    }
+    void timeSource(uint32_t source);
+    void meterTime(const DateTime &dt);
     enum
     {
         NBGO = sizeof(m_GO) / sizeof(uint16_t),
         SIZEPARAMS = sizeof(mParams)
     };
     uint32_t millis();
+    int64_t now(); // In ms since the secondsSinceReference() origin, -1 when not set
     bool isValid() const;
 
 private:
-    std::function<void(DateChange)> mDayCallback;
+    void setDate(const DateTime &date);
+    void setTime(int64_t timeOfDayMs);
+    void onDate(GroupObject &go, uint8_t);
+    void onTime(GroupObject &go, uint8_t);
+    void onDateTime(GroupObject &go, uint8_t);
+    Notifier mDayCallback = nullptr;
+    void *mDayCallbackObject = nullptr;
     DateTime mDateTimeStamp = {0, 0, 0xffff, 0, 0, 0};
     DateTime mLastEmittedDay = {0};
-    DateTime mLastDateTime = {0};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "RollingConsumption.h"
+
+// Rings in State::bucket order
+static const struct
+{
+    uint8_t first; // First bucket
+    uint8_t count;
+    uint8_t hours; // Per bucket
+} Rings[ROLLING_WINDOWS] = {{0, 24, 1}, {24, 28, 6}, {52, 30, 24}};
+
+static_assert(ROLLING_BUCKETS == 24 + 28 + 30, "Rings must fill State::bucket");
+
+void RollingConsumption::init(uint16_t baseGO)
+{
+    for (int i = 0; i < ROLLING_TARIFFS; ++i)
+        for (int w = 0; w < ROLLING_WINDOWS; ++w)
+            knx.getGroupObject(m_GO.window[i][w] = ++baseGO).dataPointType(DPT_ActiveEnergy);
+    resyncGroupObjects();
+}
+
+// Moves the newest buckets to hour: the buckets entered are emptied and taken out of the sums.
+// O(1) per hour, the whole ring only after a stop longer than its window
+void RollingConsumption::advance(uint32_t hour)
+{
+    if (hour <= mState.hour)
+        return; // Clock set back: stay in the newest buckets until it catches up
+    for (int w = 0; w < ROLLING_WINDOWS; ++w)
+    {
+        const uint32_t from = mState.hour / Rings[w].hours, to = hour / Rings[w].hours;
+        for (uint32_t b = to - from > Rings[w].count ? to - Rings[w].count : from; b != to;)
+        {
+            uint32_t *bucket = mState.bucket[Rings[w].first + ++b % Rings[w].count];
+            for (int i = 0; i < ROLLING_TARIFFS; ++i)
+            {
+                if (bucket[i] != 0)
+                    mChanged |= 1 << i;
+                mSum[w][i] -= bucket[i];
+                bucket[i] = 0;
+            }
+        }
+    }
+    mState.hour = hour;
+}
+
+// Adds the consumption of the hours (from, mState.hour] to the buckets, evenly spread over them when the
+// device was stopped: the share of the hours older than a ring is left out of its window
+void RollingConsumption::add(int tariff, uint32_t delta, uint32_t from)
+{
+    const uint32_t to = mState.hour, hours = to - from;
+    for (int w = 0; w < ROLLING_WINDOWS; ++w)
+    {
+        const uint32_t last = to / Rings[w].hours, first = last - from / Rings[w].hours >= Rings[w].count ? last - Rings[w].count + 1 : from / Rings[w].hours;
+        for (uint32_t b = first; b <= last; ++b)
+        {
+            uint32_t share = delta;
+            if (hours > 1)
+            { // Hours of (from, to] in the bucket, as a difference of running shares so nothing is lost to rounding
+                const uint32_t begin = MAX(b * Rings[w].hours, from + 1) - from - 1, end = MIN((b + 1) * Rings[w].hours, to + 1) - from - 1;
+                share = (uint32_t)((uint64_t)delta * end / hours - (uint64_t)delta * begin / hours);
+            }
+            else if (b != last)
+                continue;
+            mState.bucket[Rings[w].first + b % Rings[w].count][tariff] += share;
+            mSum[w][tariff] += share;
+        }
+    }
+}
+
+void RollingConsumption::update(const uint32_t index[ROLLING_TARIFFS])
+{
+    const int64_t now = rtc.now();
+    if (now < 0)
+        return;
+    const uint32_t hour = now / (60 * 60 * 1000);
+    const uint32_t from = mState.hour != 0 && hour > mState.hour ? mState.hour : hour;
+    if (mState.hour == 0)
+        mState.hour = hour;
+    else
+        advance(hour);
+    for (int i = 0; i < ROLLING_TARIFFS; ++i)
+    {
+        // A lower index (new meter, new contract) only restarts the deltas
+        if (index[i] > mState.index[i] && mState.index[i] != 0)
+        {
+            add(i, index[i] - mState.index[i], from);
+            mChanged |= 1 << i;
+        }
+        if (index[i] != 0)
+            mState.index[i] = index[i];
+    }
+}
+
+// Sends the windows of the tariffs that changed
+void RollingConsumption::emit()
+{
+    if (mChanged == 0)
+        return;
+    resyncGroupObjects();
+    for (int i = 0; i < ROLLING_TARIFFS; ++i)
+        if (mChanged & (1 << i))
+            for (int w = 0; w < ROLLING_WINDOWS; ++w)
+                knx.getGroupObject(m_GO.window[i][w]).objectWritten();
+    mChanged = 0;
+}
+
+uint32_t RollingConsumption::consumption(int tariff, int window) const { return mSum[window][tariff]; }
+
+void RollingConsumption::resyncGroupObjects()
+{
+    for (int i = 0; i < ROLLING_TARIFFS; ++i)
+        for (int w = 0; w < ROLLING_WINDOWS; ++w)
+            knx.getGroupObject(m_GO.window[i][w]).valueNoSend(mSum[w][i]);
+}
+
+const RollingConsumption::State &RollingConsumption::state() const { return mState; }
+
+// The sums are rebuilt once from the buckets. The consumption while stopped is spread by the first update
+void RollingConsumption::restore(const State &state)
+{
+    mState = state;
+    for (int w = 0; w < ROLLING_WINDOWS; ++w)
+        for (int i = 0; i < ROLLING_TARIFFS; ++i)
+        {
+            mSum[w][i] = 0;
+            for (int b = 0; b < Rings[w].count; ++b)
+                mSum[w][i] += mState.bucket[Rings[w].first + b][i];
+        }
+    mChanged = 0;
+}
+
+void RollingConsumption::reset()
+{
+    mState = {0};
+    memset(mSum, 0, sizeof(mSum));
+    mChanged = 0;
+    resyncGroupObjects();
+}
@@ -0,0 +1,56 @@
+#ifndef ROLLINGCONSUMPTION_H
+#define ROLLINGCONSUMPTION_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "RTCKnx.h"
+
+#define ROLLING_TARIFFS 3              // As TeleInfo::TARIFCOUNT
+#define ROLLING_WINDOWS 3              // Last 24 hours, 7 days, 30 days
+#define ROLLING_BUCKETS (24 + 28 + 30) // Rings of 1 hour, 6 hours and 1 day buckets
+
+// Consumption of each tariff over the last 24 hours, 7 days and 30 days, without calendar reset.
+// Each window is a ring of fixed buckets and its running sum: an index increase is added to the newest
+// bucket of each ring, and a bucket left behind by the clock is taken out of the sum, without rescan.
+// The windows cover the current bucket and the previous ones (23 to 24 hours for the last 24 hours).
+class RollingConsumption
+{
+public:
+    struct State
+    {
+        uint32_t hour;                                     // Of the newest buckets, since the RTCKnx reference. 0: not started
+        uint32_t index[ROLLING_TARIFFS];                   // At the last update
+        uint32_t bucket[ROLLING_BUCKETS][ROLLING_TARIFFS]; // In Wh
+    };
+
+private:
+    RTCKnx &rtc;
+    struct
+    {
+        uint16_t window[ROLLING_TARIFFS][ROLLING_WINDOWS];
+    } m_GO;
+
+    State mState = {0};
+    uint32_t mSum[ROLLING_WINDOWS][ROLLING_TARIFFS] = {{0}};
+    uint8_t mChanged = 0; // Bit per tariff, since the last emit()
+
+    void advance(uint32_t hour);
+    void add(int tariff, uint32_t delta, uint32_t from);
+
+public:
+    RollingConsumption(RTCKnx &_rtc) : rtc(_rtc){};
+    void init(uint16_t baseGO);
+    void update(const uint32_t index[ROLLING_TARIFFS]);
+    void emit();
+    uint32_t consumption(int tariff, int window) const; // Window: 0 (24 hours), 1 (7 days), 2 (30 days)
+    void resyncGroupObjects();
+    const State &state() const;
+    void restore(const State &state);
+    void reset();
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t)
+    };
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "TariffCost.h"
+
+int32_t TariffCost::cents(uint64_t cost) { return (int32_t)(cost / COST_UNITS_PER_CENT); }
+
+void TariffCost::init(int baseAddr, uint16_t baseGO)
+{
+    for (int i = 0; i < PERIODCOUNT; ++i)
+    {
+        mParams.price[i] = knx.paramInt(baseAddr + i * 4); // In 0.0001 EUR per kWh
+    }
+    knx.getGroupObject(m_GO.today = ++baseGO).dataPointType(DPT_Value_4_Count);
+    knx.getGroupObject(m_GO.yesterday = ++baseGO).dataPointType(DPT_Value_4_Count);
+    knx.getGroupObject(m_GO.thisMonth = ++baseGO).dataPointType(DPT_Value_4_Count);
+    knx.getGroupObject(m_GO.lastMonth = ++baseGO).dataPointType(DPT_Value_4_Count);
+    knx.getGroupObject(m_GO.thisYear = ++baseGO).dataPointType(DPT_Value_4_Count);
+    knx.getGroupObject(m_GO.lastYear = ++baseGO).dataPointType(DPT_Value_4_Count);
+    resyncGroupObjects();
+}
+
+void TariffCost::indexChanged(Period period, uint32_t previous, uint32_t index)
+{
+    // First reception or meter index reset: nothing to account for
+    if (previous == 0 || index <= previous)
+        return;
+    const uint64_t cost = (uint64_t)(index - previous) * mParams.price[period];
+    mCost.today += cost;
+    mCost.thisMonth += cost;
+    mCost.thisYear += cost;
+}
+
+void TariffCost::newDate(RTCKnx::DateChange change, const RTCKnx::DateTime &dateTime)
+{
+    switch (change)
+    {
+    case RTCKnx::Year:
+        mCost.lastYear = mCost.thisYear;
+        mCost.thisYear = 0;
+        knx.getGroupObject(m_GO.lastYear).value(cents(mCost.lastYear));
+        [[fallthrough]];
+    case RTCKnx::Month:
+        mCost.lastMonth = mCost.thisMonth;
+        mCost.thisMonth = 0;
+        knx.getGroupObject(m_GO.lastMonth).value(cents(mCost.lastMonth));
+        [[fallthrough]];
+    case RTCKnx::Day:
+        mCost.yesterday = mCost.today;
+        mCost.today = 0;
+        knx.getGroupObject(m_GO.yesterday).value(cents(mCost.yesterday));
+        break;
+    default:
+        return;
+    }
+    mCost.day = dateTime;
+    resyncGroupObjects();
+}
+
+void TariffCost::validate(const RTCKnx::DateTime &dateTime)
+{
+    RTCKnx::DateChange change = RTCKnx::Same;
+    if (mCost.day.tm_mday == 0)
+    {
+        mCost.day = dateTime;
+    }
+    else if (dateTime.tm_year > mCost.day.tm_year)
+    {
+        change = RTCKnx::Year;
+    }
+    else if (dateTime.tm_year == mCost.day.tm_year && dateTime.tm_mon > mCost.day.tm_mon)
+    {
+        change = RTCKnx::Month;
+    }
+    else if (dateTime.tm_year == mCost.day.tm_year && dateTime.tm_mon == mCost.day.tm_mon && dateTime.tm_mday > mCost.day.tm_mday)
+    {
+        change = RTCKnx::Day;
+    }
+    // Periods missed while powered off are folded into a single rollover: an ended period is only known when it
+    // is the one of the accumulators, the periods in between were not counted (sent as 0, unknown)
+    const RTCKnx::DateTime &day = mCost.day;
+    const int64_t days = (RTCKnx::secondsSinceReference(RTCKnx::DateTime{0, 0, 0, dateTime.tm_mday, dateTime.tm_mon, dateTime.tm_year}) -
+                          RTCKnx::secondsSinceReference(RTCKnx::DateTime{0, 0, 0, day.tm_mday, day.tm_mon, day.tm_year})) /
+                         (24 * 60 * 60);
+    if (change >= RTCKnx::Day && days > 1)
+        mCost.today = 0;
+    if (change >= RTCKnx::Month && (dateTime.tm_year * 12 + dateTime.tm_mon) - (day.tm_year * 12 + day.tm_mon) > 1)
+        mCost.thisMonth = 0;
+    if (change == RTCKnx::Year && dateTime.tm_year - day.tm_year > 1)
+        mCost.thisYear = 0;
+    newDate(change, dateTime);
+}
+
+void TariffCost::emit()
+{
+    const int32_t current = cents(mCost.today);
+    if (current == mLastEmitted)
+        return;
+    mLastEmitted = current;
+    resyncGroupObjects();
+    knx.getGroupObject(m_GO.today).objectWritten();
+    knx.getGroupObject(m_GO.thisMonth).objectWritten();
+    knx.getGroupObject(m_GO.thisYear).objectWritten();
+}
+
+void TariffCost::resyncGroupObjects()
+{
+    knx.getGroupObject(m_GO.today).valueNoSend(cents(mCost.today));
+    knx.getGroupObject(m_GO.yesterday).valueNoSend(cents(mCost.yesterday));
+    knx.getGroupObject(m_GO.thisMonth).valueNoSend(cents(mCost.thisMonth));
+    knx.getGroupObject(m_GO.lastMonth).valueNoSend(cents(mCost.lastMonth));
+    knx.getGroupObject(m_GO.thisYear).valueNoSend(cents(mCost.thisYear));
+    knx.getGroupObject(m_GO.lastYear).valueNoSend(cents(mCost.lastYear));
+}
+
+const TariffCost::State &TariffCost::state() const { return mCost; }
+
+void TariffCost::restore(const State &state)
+{
+    mCost = state;
+    mLastEmitted = cents(mCost.today);
+}
+
+void TariffCost::reset()
+{
+    mCost = {0};
+    mLastEmitted = 0;
+    resyncGroupObjects();
+}
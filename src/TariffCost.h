@@ -0,0 +1,79 @@
+#ifndef TARIFFCOST_H
+#define TARIFFCOST_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "RTCKnx.h"
+
+#define COST_UNITS_PER_CENT 100000ULL // Accumulators are in 1e-7 EUR (1 Wh at 0.0001 EUR/kWh)
+
+class TariffCost
+{
+public:
+    // Same order as the PTEC Group Object encoding
+    enum Period
+    {
+        TH = 0,
+        HC,
+        HP,
+        HN,
+        PM,
+        HCJB,
+        HCJW,
+        HCJR,
+        HPJB,
+        HPJW,
+        HPJR,
+        PERIODCOUNT
+    };
+
+    struct State
+    {
+        RTCKnx::DateTime day; // Date of the "today" window
+        uint64_t today;
+        uint64_t yesterday;
+        uint64_t thisMonth;
+        uint64_t lastMonth;
+        uint64_t thisYear;
+        uint64_t lastYear;
+    };
+
+private:
+    struct
+    {
+        uint32_t price[PERIODCOUNT]; // In 0.0001 EUR per kWh
+    } mParams;
+    struct
+    {
+        uint16_t today;
+        uint16_t yesterday;
+        uint16_t thisMonth;
+        uint16_t lastMonth;
+        uint16_t thisYear;
+        uint16_t lastYear;
+    } m_GO;
+
+    State mCost = {0};
+    int32_t mLastEmitted = 0;
+
+    static inline int32_t cents(uint64_t cost);
+
+public:
+    TariffCost(){};
+    void init(int baseAddr, uint16_t baseGO);
+    void indexChanged(Period period, uint32_t previous, uint32_t index);
+    void newDate(RTCKnx::DateChange change, const RTCKnx::DateTime &dateTime);
+    void validate(const RTCKnx::DateTime &dateTime);
+    void emit();
+    void resyncGroupObjects();
+    const State &state() const;
+    void restore(const State &state);
+    void reset();
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
@@ -1,13 +1,39 @@
 #include <Arduino.h>
 #include <knx.h>
 #include <EEPROM.h>
+#include <hardware/flash.h>
 #include "TeleInfo.h"
+#include "FlashWriter.h"
+
+// EEPROM emulation sector, after the filesystem region: knx library tables (KNX_FLASH_SIZE) and history.
+// The snapshot takes the last sector of the filesystem region, after the energy archive and the capture ring
+extern "C" uint8_t _EEPROM_start[];
+extern "C" uint8_t _FS_start[];
+extern "C" uint8_t _FS_end[];
+
+static_assert(sizeof(TeleInfo::Snapshot) <= SNAPSHOT_SECTOR_SIZE, "Snapshot must fit its flash sector");
+static_assert(SNAPSHOT_SECTOR_SIZE == CAPTURE_SNAPSHOT_SIZE && SNAPSHOT_SECTOR_SIZE == ARCHIVE_SNAPSHOT_SIZE, "Flash layout");
+
+// Address of the snapshot sector, 0 when the filesystem region is too small
+static uintptr_t snapshotAddress()
+{
+    const uintptr_t size = (uintptr_t)_FS_end - (uintptr_t)_FS_start;
+    return size < SNAPSHOT_SECTOR_SIZE ? 0 : (uintptr_t)_FS_end - SNAPSHOT_SECTOR_SIZE;
+}
 
 #define FOURCC(a, b, c, d) (((((uint32_t)(a)) << 24) | (((uint32_t)(b)) << 16) | (((uint32_t)(c)) << 8) | (d)))
 
-TeleInfo::TeleInfo(RTCKnx *_rtc, SerialUART *suart, unsigned long _baud, uint16_t _config) : mSerial(*suart), rtc(*_rtc)
+// Price period of each energy register, from BASE (3) to BBRHPJR (13)
+#define FIRST_ENERGY_REGISTER 3
+static const TariffCost::Period RegisterPeriod[] = {TariffCost::TH, TariffCost::HC, TariffCost::HP, TariffCost::HN, TariffCost::PM,
+                                                    TariffCost::HCJB, TariffCost::HPJB, TariffCost::HCJW, TariffCost::HPJW, TariffCost::HCJR, TariffCost::HPJR};
+
+// Aggregated label of each instantaneous label, from IINST (17) to IINST3 (24)
+#define FIRST_STATS_LABEL 17
+static const int8_t StatsLabel[] = {LabelStats::IINST, -1, -1, LabelStats::PAPP, -1, LabelStats::IINST1, LabelStats::IINST2, LabelStats::IINST3};
+
+TeleInfo::TeleInfo(RTCKnx *_rtc, SerialUART *suart, unsigned long _baud, uint16_t _config) : mSerial(*suart), rtc(*_rtc), mCapture(*_rtc), mMode(_baud), mArchive(*_rtc), mRolling(*_rtc)
 {
-    speed = _baud;
     config = _config;
 }
 
@@ -17,70 +43,183 @@ KNXValue TeleInfo::value(const TeleInfo::TeleInfoDataStruct &val)
     {
     default:
     case TeleInfoDataType::INT:
+        if (val.conf->dpt.mainGroup == 8)
+            return KNXValue((int32_t)MIN(val.value.num, 0x7fffU)); // As encodeS16()
         return KNXValue(val.value.num);
     case TeleInfoDataType::STRING:
         return KNXValue(val.value.str);
     case TeleInfoDataType::OPTARIF:
-        switch (val.value.num & 0xffffff00)
-        {
-        case FOURCC('B', 'A', 'S', 0) /*BASE*/:
-        default:
-            return KNXValue((uint8_t)0);
-        case FOURCC('H', 'C', '.', 0) /*HC..*/:
-            return KNXValue((uint8_t)1);
-        case FOURCC('E', 'J', 'P', 0) /*EJP.*/:
-            return KNXValue((uint8_t)2);
-        case FOURCC('B', 'B', 'R', 0) /*BBRx*/:
-            return KNXValue((uint8_t)(val.value.num & 0x3f));
-            //                                  - Bit 5: toujours 1
-            //                                  - Bit 4-3: programme circuit 1: 01-11 _ programme A-C
-            //                                  - Bit 2-0: programme circuit 2: 000-111 _ programme P0-P7
-        }
+        return KNXValue(optarif(val.value.num));
     case TeleInfoDataType::PTEC:
-        switch (val.value.num)
-        {
-        case FOURCC('T', 'H', '.', '.') /*Toutes les Heures*/:
-        default:
-            return KNXValue((uint8_t)0);
-        case FOURCC('H', 'C', '.', '.') /*Heures Creuses*/:
-            return KNXValue((uint8_t)1);
-        case FOURCC('H', 'P', '.', '.') /*Heures Pleines*/:
-            return KNXValue((uint8_t)2);
-        case FOURCC('H', 'N', '.', '.') /*Heures Normales*/:
-            return KNXValue((uint8_t)3);
-        case FOURCC('P', 'M', '.', '.') /*Heures de Pointe Mobile*/:
-            return KNXValue((uint8_t)4);
-        case FOURCC('H', 'C', 'J', 'B') /*Heures Creuses Jours Bleus*/:
-            return KNXValue((uint8_t)5);
-        case FOURCC('H', 'C', 'J', 'W') /*Heures Creuses Jours Blancs*/:
-            return KNXValue((uint8_t)6);
-        case FOURCC('H', 'C', 'J', 'R') /*Heures Creuses Jours Rouges*/:
-            return KNXValue((uint8_t)7);
-        case FOURCC('H', 'P', 'J', 'B') /*Heures Pleines Jours Bleus*/:
-            return KNXValue((uint8_t)8);
-        case FOURCC('H', 'P', 'J', 'W') /*Heures Pleines Jours Blancs*/:
-            return KNXValue((uint8_t)9);
-        case FOURCC('H', 'P', 'J', 'R') /*Heures Pleines Jours Rouges*/:
-            return KNXValue((uint8_t)10);
-        }
+        return KNXValue(ptec(val.value.num));
     case TeleInfoDataType::DEMAIN:
-        switch (val.value.num)
-        {
-        case FOURCC('-', '-', '-', '-'):
-        default:
-            return KNXValue((uint8_t)0);
-        case FOURCC('B', 'L', 'E', 'U'):
-            return KNXValue((uint8_t)1);
-        case FOURCC('B', 'L', 'A', 'N'):
-            return KNXValue((uint8_t)2);
-        case FOURCC('R', 'O', 'U', 'G'):
-            return KNXValue((uint8_t)3);
-        }
+        return KNXValue(demain(val.value.num));
     case TeleInfoDataType::HHPHC:
         return KNXValue((uint8_t)val.value.num);
     }
 }
 
+uint8_t TeleInfo::optarif(uint32_t num)
+{
+    switch (num & 0xffffff00)
+    {
+    case FOURCC('B', 'A', 'S', 0) /*BASE*/:
+    default:
+        return 0;
+    case FOURCC('H', 'C', '.', 0) /*HC..*/:
+        return 1;
+    case FOURCC('E', 'J', 'P', 0) /*EJP.*/:
+        return 2;
+    case FOURCC('B', 'B', 'R', 0) /*BBRx*/:
+        return num & 0x3f;
+        //                                  - Bit 5: toujours 1
+        //                                  - Bit 4-3: programme circuit 1: 01-11 _ programme A-C
+        //                                  - Bit 2-0: programme circuit 2: 000-111 _ programme P0-P7
+    }
+}
+
+uint8_t TeleInfo::ptec(uint32_t num)
+{
+    switch (num)
+    {
+    case FOURCC('T', 'H', '.', '.') /*Toutes les Heures*/:
+    default:
+        return 0;
+    case FOURCC('H', 'C', '.', '.') /*Heures Creuses*/:
+        return 1;
+    case FOURCC('H', 'P', '.', '.') /*Heures Pleines*/:
+        return 2;
+    case FOURCC('H', 'N', '.', '.') /*Heures Normales*/:
+        return 3;
+    case FOURCC('P', 'M', '.', '.') /*Heures de Pointe Mobile*/:
+        return 4;
+    case FOURCC('H', 'C', 'J', 'B') /*Heures Creuses Jours Bleus*/:
+        return 5;
+    case FOURCC('H', 'C', 'J', 'W') /*Heures Creuses Jours Blancs*/:
+        return 6;
+    case FOURCC('H', 'C', 'J', 'R') /*Heures Creuses Jours Rouges*/:
+        return 7;
+    case FOURCC('H', 'P', 'J', 'B') /*Heures Pleines Jours Bleus*/:
+        return 8;
+    case FOURCC('H', 'P', 'J', 'W') /*Heures Pleines Jours Blancs*/:
+        return 9;
+    case FOURCC('H', 'P', 'J', 'R') /*Heures Pleines Jours Rouges*/:
+        return 10;
+    }
+}
+
+uint8_t TeleInfo::demain(uint32_t num)
+{
+    switch (num)
+    {
+    case FOURCC('-', '-', '-', '-'):
+    default:
+        return 0;
+    case FOURCC('B', 'L', 'E', 'U'):
+        return 1;
+    case FOURCC('B', 'L', 'A', 'N'):
+        return 2;
+    case FOURCC('R', 'O', 'U', 'G'):
+        return 3;
+    }
+}
+
+// Payload bytes of the DPT main groups used by the labels, 0: no direct encoding
+uint8_t TeleInfo::payloadSize(short mainGroup)
+{
+    switch (mainGroup)
+    {
+    case 4:
+    case 5:
+        return 1;
+    case 7:
+    case 8:
+    case 9:
+        return 2;
+    case 12:
+    case 13:
+        return 4;
+    case 16:
+        return 14;
+    default:
+        return 0;
+    }
+}
+
+// Label change: the payload is rewritten in place, the group object lookup and the KNXValue conversion are only
+// used when ETS configured a size that does not match the DPT
+void TeleInfo::encode(const TeleInfoDataStruct &val)
+{
+    if (val.payload)
+        val.conf->encode(val.payload, val);
+    else
+        knx.getGroupObject(val.goSend).valueNoSend(value(val));
+}
+
+// Encoders, one per DPT wire format. Out of range values leave the payload unchanged, as the generic conversion does
+
+// DPT 16.000: 14 characters, zero padded
+void TeleInfo::encodeString(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    unsigned int i = 0;
+    for (; i < sizeof(val.value.str) && val.value.str[i] != '\0'; ++i)
+        payload[i] = val.value.str[i];
+    memset(payload + i, 0, 14 - i);
+}
+
+// DPT 5.010
+void TeleInfo::encodeOptarif(uint8_t *payload, const TeleInfoDataStruct &val) { payload[0] = optarif(val.value.num); }
+void TeleInfo::encodePtec(uint8_t *payload, const TeleInfoDataStruct &val) { payload[0] = ptec(val.value.num); }
+void TeleInfo::encodeDemain(uint8_t *payload, const TeleInfoDataStruct &val) { payload[0] = demain(val.value.num); }
+
+// DPT 4.001
+void TeleInfo::encodeChar(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    if (val.value.num <= 0x7f)
+        payload[0] = val.value.num;
+}
+
+// DPT 7.xxx, big endian
+void TeleInfo::encodeU16(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    if (val.value.num > 0xffff)
+        return;
+    payload[0] = val.value.num >> 8;
+    payload[1] = val.value.num;
+}
+
+// DPT 8.xxx, big endian. PAPP goes over 32767 VA above 30 kVA subscriptions: sent as 32767 rather than left at
+// its last value
+void TeleInfo::encodeS16(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    const uint32_t num = MIN(val.value.num, 0x7fffU);
+    payload[0] = num >> 8;
+    payload[1] = num;
+}
+
+// DPT 12.xxx and 13.xxx (meter indexes stay under 2^31), big endian
+void TeleInfo::encodeU32(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    payload[0] = val.value.num >> 24;
+    payload[1] = val.value.num >> 16;
+    payload[2] = val.value.num >> 8;
+    payload[3] = val.value.num;
+}
+
+// DPT 9.xxx: 0.01 * M * 2^E, smallest exponent and mantissa rounded to nearest, positive values only
+void TeleInfo::encodeFloat16(uint8_t *payload, const TeleInfoDataStruct &val)
+{
+    if (val.value.num > 670760)
+        return;
+    const uint32_t v = val.value.num * 100;
+    uint8_t e = 0;
+    while (v > (2047UL << e))
+        ++e;
+    const uint32_t m = e == 0 ? v : (v + (1UL << (e - 1))) >> e;
+    payload[0] = (e << 3) | (m >> 8);
+    payload[1] = m;
+}
+
 bool TeleInfo::value(TeleInfo::TeleInfoDataStruct &val, const char *begin, const char *end)
 {
     begin += val.conf->keySize;
@@ -99,14 +238,7 @@ bool TeleInfo::value(TeleInfo::TeleInfoDataStruct &val, const char *begin, const
         }
         else if (val.conf->type == TeleInfo::TeleInfoDataType::INT)
         {
-            uint32_t _value = 0;
-            for (; begin != vEnd; ++begin)
-            {
-                const unsigned char v = (const unsigned char)(*begin - '0');
-                if (v > 9)
-                    break;
-                _value = _value * 10 + v;
-            }
+            const uint32_t _value = TicLine::number(begin, vEnd);
             if (val.value.num != _value)
             {
                 val.value.num = _value;
@@ -130,25 +262,22 @@ bool TeleInfo::value(TeleInfo::TeleInfoDataStruct &val, const char *begin, const
     return false;
 }
 
-bool TeleInfo::validChecksum(const char *begin, const char *end)
+// Horodate of the standard mode DATE label: season (E/H, lowercase when the meter clock is degraded), YYMMDDhhmmss
+void TeleInfo::meterDate(const char *begin, const char *end)
 {
-    uint16_t sum = 0;
-    uint8_t spaceFound = 0;
-    for (; begin != end; ++begin)
+    if (end - begin < 13 || !(*begin == 'E' || *begin == 'H' || *begin == ' '))
+        return;
+    uint16_t field[6];
+    for (int i = 0; i < 6; ++i)
     {
-        const char c = *begin;
-        if (c == ' ')
-        {
-            ++spaceFound;
-        }
-        else if (spaceFound == 2)
-        {
-            // checksum after second space
-            return (((uint8_t)(sum - ' ') & 0x3F) + 0x20) == c;
-        }
-        sum += c;
+        const unsigned char d1 = begin[1 + 2 * i] - '0', d2 = begin[2 + 2 * i] - '0';
+        if (d1 > 9 || d2 > 9)
+            return;
+        field[i] = d1 * 10 + d2;
     }
-    return false;
+    if (field[1] < 1 || field[1] > 12 || field[2] < 1 || field[2] > 31 || field[3] > 23 || field[4] > 59 || field[5] > 59)
+        return;
+    rtc.meterTime(RTCKnx::DateTime{field[5], field[4], field[3], field[2], (uint16_t)(field[1] - 1), (uint16_t)(2000 + field[0])});
 }
 
 uint32_t TeleInfo::simpleChecksum(const char *str)
@@ -159,17 +288,61 @@ uint32_t TeleInfo::simpleChecksum(const char *str)
     return result;
 }
 
+uint32_t TeleInfo::crc32(const uint8_t *data, size_t size)
+{
+    static const uint32_t table[16] = {0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+                                       0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+    uint32_t crc = 0xffffffff;
+    for (const uint8_t *end = data + size; data != end; ++data)
+    {
+        crc = table[(crc ^ *data) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (*data >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+void TeleInfo::onRealTime(GroupObject &go, uint8_t)
+{
+    mRealTimeTimer = go.value() ? rtc.millis() | 1 : 0;
+}
+// Period history written from the bus: arg is tariff * HISTORY_PERIODS + period, in mGO.tariff order
+void TeleInfo::onHistory(GroupObject &go, uint8_t arg)
+{
+    const int i = arg / HISTORY_PERIODS;
+    auto &h = mHistory.tariff[i];
+    switch (arg % HISTORY_PERIODS)
+    {
+    case 0: // Today
+        setHistory(h.index, h.yesterday, go.value(), i, RTCKnx::Day);
+        break;
+    case 1: // Yesterday
+        setHistory(h.yesterday, h.dayM2, go.value(), i, RTCKnx::Day);
+        break;
+    case 2: // This month
+        setHistory(h.index, h.lastMonth, go.value(), i, RTCKnx::Month);
+        break;
+    case 3: // Last month
+        setHistory(h.lastMonth, h.monthM2, go.value(), i, RTCKnx::Month);
+        break;
+    case 4: // This year
+        setHistory(h.index, h.lastYear, go.value(), i, RTCKnx::Year);
+        break;
+    case 5: // Last year
+        setHistory(h.lastYear, h.yearM2, go.value(), i, RTCKnx::Year);
+        break;
+    }
+}
+
 void TeleInfo::init(int baseAddr, uint16_t baseGO)
 {
     mParams.period = knx.paramInt(baseAddr) * 1000;                   // In Seconds
     mParams.realTimeTimeout = knx.paramInt(baseAddr + 4) * 60 * 1000; // In Minutes
-    if (mLastReception == 0)
-    { // Cold reset
+    if (!mStarted && !mRestored)
+    { // No snapshot
         restoreHistory();
     }
     knx.getGroupObject(mGO.realTimeOnOff = ++baseGO).dataPointType(DPT_Switch);
-    knx.getGroupObject(mGO.realTimeOnOff).callback([this](GroupObject &go)
-                                                   { mRealTimeTimer = go.value() ? rtc.millis() | 1 : 0; });
+    GroupObjectDispatch::attach<TeleInfo, &TeleInfo::onRealTime>(mGO.realTimeOnOff, this);
     knx.getGroupObject(mGO.realTimeOnOffState = ++baseGO).dataPointType(DPT_Switch);
     knx.getGroupObject(mGO.realTimeOnOffState).valueNoSend(mRealTimeTimer != 0);
     for (int i = 0; i < TARIFCOUNT; ++i)
@@ -180,37 +353,59 @@ void TeleInfo::init(int baseAddr, uint16_t baseGO)
         knx.getGroupObject(mGO.tariff[i].lastMonth = ++baseGO).dataPointType(DPT_ActiveEnergy);
         knx.getGroupObject(mGO.tariff[i].thisYear = ++baseGO).dataPointType(DPT_ActiveEnergy);
         knx.getGroupObject(mGO.tariff[i].lastYear = ++baseGO).dataPointType(DPT_ActiveEnergy);
-        knx.getGroupObject(mGO.tariff[i].today).callback([this, i](GroupObject &go)
-                                                         { setHistory(mHistory.tariff[i].index, mHistory.tariff[i].yesterday, go.value(), i, RTCKnx::Day); });
-        knx.getGroupObject(mGO.tariff[i].yesterday).callback([this, i](GroupObject &go)
-                                                             { setHistory(mHistory.tariff[i].yesterday, mHistory.tariff[i].dayM2, go.value(), i, RTCKnx::Day); });
-        knx.getGroupObject(mGO.tariff[i].thisMonth).callback([this, i](GroupObject &go)
-                                                             { setHistory(mHistory.tariff[i].index, mHistory.tariff[i].lastMonth, go.value(), i, RTCKnx::Month); });
-        knx.getGroupObject(mGO.tariff[i].lastMonth).callback([this, i](GroupObject &go)
-                                                             { setHistory(mHistory.tariff[i].lastMonth, mHistory.tariff[i].monthM2, go.value(), i, RTCKnx::Month); });
-        knx.getGroupObject(mGO.tariff[i].thisYear).callback([this, i](GroupObject &go)
-                                                            { setHistory(mHistory.tariff[i].index, mHistory.tariff[i].lastYear, go.value(), i, RTCKnx::Year); });
-        knx.getGroupObject(mGO.tariff[i].lastYear).callback([this, i](GroupObject &go)
-                                                            { setHistory(mHistory.tariff[i].lastYear, mHistory.tariff[i].yearM2, go.value(), i, RTCKnx::Year); });
+        for (uint8_t period = 0; period < HISTORY_PERIODS; ++period)
+            GroupObjectDispatch::attach<TeleInfo, &TeleInfo::onHistory>(mGO.tariff[i].today + period, this, i * HISTORY_PERIODS + period);
     }
 
     resyncHistoryGroupObjects();
-    const TeleInfoDataType *param = TeleInfoParam;
-    for (TeleInfoDataStruct *data = mTeleInfoData; data != mTeleInfoData + TeleInfoCount; ++data, ++param)
-    {
-        data->conf = param;
-        data->value.num = 0;
-        knx.getGroupObject(data->goSend = ++baseGO).dataPointType(Dpt(data->conf->dpt.mainGroup, data->conf->dpt.subGroup));
-        knx.getGroupObject(data->goSend).valueNoSend(value(*data));
+    const uint16_t labelGO = baseGO;
+    mCost.init(baseAddr += 8, baseGO += TeleInfoCount);
+    mCapture.init(baseAddr += TariffCost::SIZEPARAMS, baseGO += TariffCost::NBGO);
+    mPhases.init(baseAddr += TicCapture::SIZEPARAMS, baseGO += TicCapture::NBGO);
+    mShedding.init(baseAddr += PhaseLoad::SIZEPARAMS, baseGO += PhaseLoad::NBGO, rtc.millis());
+    rtc.timeSource(knx.paramInt(baseAddr += LoadShedding::SIZEPARAMS)); // RTCKnx::TimeSource
+    mStats.init(baseAddr += 4, baseGO += LoadShedding::NBGO);
+    initLabels(knx.paramInt(baseAddr += LabelStats::SIZEPARAMS), labelGO);
+    mMode.init(baseAddr += 4, baseGO += LabelStats::NBGO, rtc.millis());
+    mArchive.init(baseGO += TicMode::NBGO);
+    mSchedule.init(baseAddr += TicMode::SIZEPARAMS);
+    mForecast.init(baseAddr += PublishSchedule::SIZEPARAMS, baseGO += EnergyArchive::NBGO);
+    mRolling.init(baseGO += OverloadForecast::NBGO);
+    mSlice.bytes = knx.paramInt(baseAddr += OverloadForecast::SIZEPARAMS);
+    mSlice.time = knx.paramInt(baseAddr + 4);
+    if (!mStarted)
+    { // Called again after an ETS download: the TIC stream keeps going
+        mBufferLen = 0;
+        mSerial.begin(mMode.speed(), config);
+        mStarted = true;
     }
-    mBufferLen = 0;
-
-    mSerial.begin(speed, config);
-    while (!mSerial)
+}
+// Compact set of the labels selected in ETS (0: all of them). OPTARIF is always kept: it selects the history registers
+void TeleInfo::initLabels(uint32_t labels, uint16_t baseGO)
+{
+    mLabels = labels == 0 ? (1UL << TeleInfoCount) - 1 : labels | (1UL << 1 /* OPTARIF */);
+    mActiveCount = 0;
+    for (unsigned int i = 0; i < TeleInfoCount; ++i)
     {
-        delay(10);
+        TeleInfoDataStruct &data = mTeleInfoData[i];
+        data.conf = &TeleInfoParam[i];
+        data.goSend = baseGO + 1 + i;
+        if (!(mLabels & (1UL << i)))
+        { // Deselected: forget the value so that derived features do not use it
+            memset(&data.value, 0, sizeof(data.value));
+            data.payload = nullptr;
+            data.lastChange = data.lastSend = 0;
+            continue;
+        }
+        mActive[mActiveCount++] = i;
+        GroupObject &go = knx.getGroupObject(data.goSend);
+        go.dataPointType(Dpt(data.conf->dpt.mainGroup, data.conf->dpt.subGroup));
+        go.valueNoSend(value(data));
+        // Group objects are rebuilt by an ETS download, and so is their payload
+        data.payload = go.valueSize() == payloadSize(data.conf->dpt.mainGroup) ? go.valueRef() : nullptr;
     }
 }
+
 void TeleInfo::setHistory(uint32_t ref, uint32_t &dest, uint32_t src, int idxTariff, RTCKnx::DateChange periodToEmit)
 {
     if (ref - dest == src || src == dest)
@@ -241,10 +436,59 @@ void TeleInfo::setHistory(uint32_t ref, uint32_t &dest, uint32_t src, int idxTar
     mLastManualHistoryInit = rtc.millis();
 }
 
+// Overload fast path, run as soon as an IINST line validates (ADPS = MAX(0, IINST - ISOUSC))
+bool TeleInfo::updateAdps(uint32_t current)
+{
+    const TeleInfoDataStruct &isousc = mTeleInfoData[2 /* ISOUSC*/];
+    if (isousc.lastChange == 0 || !(mLabels & (1UL << 18 /* ADPS*/)))
+        return false;
+    TeleInfoDataStruct &adps = mTeleInfoData[18 /* ADPS*/];
+    const uint32_t maxiinst = MAX(MAX(mTeleInfoData[17 /* IINST*/].value.num, mTeleInfoData[22 /* IINST1*/].value.num),
+                                  MAX(mTeleInfoData[23 /* IINST2*/].value.num, mTeleInfoData[24 /* IINST3*/].value.num));
+    const uint32_t adpsValue = maxiinst > isousc.value.num ? maxiinst - isousc.value.num : 0;
+    if (adps.value.num == adpsValue)
+        return false;
+    adps.value.num = adpsValue;
+    adps.lastChange = current;
+    encode(adps);
+    return emitAdps(current);
+}
+
+bool TeleInfo::emitAdps(uint32_t current)
+{
+    TeleInfoDataStruct &adps = mTeleInfoData[18 /* ADPS*/];
+    adps.lastSendValueCheckSum = adps.value.num;
+    knx.getGroupObject(adps.goSend).objectWritten(); // Emit is forced
+    adps.lastSend = current;
+    return true;
+}
+
+// Load shedding on the most loaded phase, run on each IINST/PAPP line
+void TeleInfo::updateShedding(uint32_t current)
+{
+    const uint32_t isousc = mTeleInfoData[2 /* ISOUSC*/].value.num;
+    if (mTeleInfoData[2 /* ISOUSC*/].lastChange == 0)
+        return;
+    const uint32_t phases = MAX(mTeleInfoData[22 /* IINST1*/].value.num, MAX(mTeleInfoData[23 /* IINST2*/].value.num, mTeleInfoData[24 /* IINST3*/].value.num));
+    uint32_t load = MAX(mTeleInfoData[17 /* IINST*/].value.num, phases) * 230; // In VA
+    if (phases == 0)
+        load = MAX(load, mTeleInfoData[20 /* PAPP*/].value.num); // Single phase: PAPP is more accurate
+    mShedding.update(load, isousc * 230, current);
+}
+
 uint32_t TeleInfo::lastReception() const { return mLastReception; }
+uint16_t TeleInfo::adpsGroupObject() const { return mTeleInfoData[18 /* ADPS*/].goSend; }
+TicCapture &TeleInfo::capture() { return mCapture; }
+EnergyArchive &TeleInfo::archive() { return mArchive; }
+const RollingConsumption &TeleInfo::rolling() const { return mRolling; }
+TicMode::Mode TeleInfo::ticMode() const { return mMode.mode(); }
+bool TeleInfo::flashPending() const { return mPendingFlash != 0 || FlashWriter::erasing(); }
 
+// Stages run in turn. With a budget set in ETS, a call returns once it is spent and the next call resumes with the
+// following stage: after a backlog, knx.loop() is not delayed by more than one stage and the bytes of the budget
 void TeleInfo::loop()
 {
+    mSliceStart = micros();
     uint32_t current = rtc.millis() | 1;
     bool isRealTime = knx.getGroupObject(mGO.realTimeOnOffState).value();
     if (mRealTimeTimer && (mParams.realTimeTimeout == 0 || current - mRealTimeTimer < mParams.realTimeTimeout))
@@ -264,21 +508,48 @@ void TeleInfo::loop()
         }
         mRealTimeTimer = 0;
     }
-    if (mLastManualHistoryInit && current - mLastManualHistoryInit > HISTORY_MANUALWRITE_TEMPO)
+    for (uint8_t stage = 0; stage < STAGECOUNT; ++stage)
     {
-        saveHistory();
-        mLastManualHistoryInit = 0;
+        if (stage != 0 && sliceOver())
+            return;
+        switch (mStage)
+        {
+        case StageReceive:
+            if (receive(current))
+                return; // Overload telegram queued: give knx.loop() the hand right away
+            break;
+        case StagePublish:
+            publish(current, isRealTime);
+            break;
+        case StageHistory:
+            updateHistory(current, isRealTime);
+            break;
+        case StageHousekeeping:
+            housekeeping(current);
+            break;
+        }
+        mStage = (mStage + 1) % STAGECOUNT;
     }
-    for (;;)
+}
+
+bool TeleInfo::sliceOver() const { return mSlice.time != 0 && micros() - mSliceStart >= mSlice.time; }
+
+// Reads at most the byte budget and parses the complete lines, at least one per call. Lines left by an urgent
+// telegram or by the time budget stay buffered for the next call. Tells whether an urgent telegram was queued
+bool TeleInfo::receive(uint32_t current)
+{
+    bool urgent = false;
+    bool over = false;
+    unsigned int budget = mSlice.bytes != 0 ? mSlice.bytes : TELEINFO_BUFFERSIZE * 64;
+    while (!urgent && !over)
     {
-        unsigned int pending = mSerial.available();
-        if (pending == 0)
+        unsigned int pending = MIN((unsigned int)mSerial.available(), budget);
+        if (pending == 0 && !mLinesLeft)
             break;
 
-        while (pending > 0)
+        while ((pending > 0 || mLinesLeft) && !urgent && !over)
         {
-            //Serial.println("Serial Data received");
-            if (mBufferLen == TELEINFO_BUFFERSIZE)
+            if (mBufferLen == TELEINFO_BUFFERSIZE && !mLinesLeft)
             {
                 mBufferLen = 0; // Security - Reset buffer if full with dummies
                 break;
@@ -295,13 +566,28 @@ void TeleInfo::loop()
                 *ptr++ = (char)c;
                 ++rcv;
             }
-            if (rcv == 0)
+            if (rcv == 0 && !mLinesLeft)
                 break;
+            mLinesLeft = false;
+            if (rcv != 0)
+            {
+                mCapture.append(mBuffer + mBufferLen, rcv, current);
+                mMode.received(current);
+            }
             pending -= rcv;
+            budget -= rcv;
             mBufferLen += rcv;
             const char *currentBuffer = mBuffer;
-            for (;;)
+            bool parsed = false;
+            while (true)
             {
+                if (urgent || (parsed && sliceOver()))
+                { // Resumed by the next call
+                    over = !urgent;
+                    mLinesLeft = true;
+                    break;
+                }
+                parsed = true;
                 // extract first line if
                 const char *eol = currentBuffer;
                 for (; eol != mBuffer + mBufferLen; ++eol)
@@ -323,17 +609,48 @@ void TeleInfo::loop()
                     }
                 }
                 const unsigned int lineLen = eol - currentBuffer;
-                if (TeleInfo::validChecksum(currentBuffer, eol))
+                const bool valid = lineLen != 0 && mMode.line(currentBuffer, eol, current);
+                if (valid && mMode.probing() == TicMode::Standard)
                 {
                     mLastReception = current;
-                    for (TeleInfoDataStruct *data = mTeleInfoData; data != mTeleInfoData + TeleInfoCount; ++data)
+                    if (const char *date = TicLine::value(currentBuffer, eol, "DATE\t"))
+                        meterDate(date, eol);
+                }
+                else if (valid)
+                {
+                    mLastReception = current;
+                    for (const uint8_t *label = mActive; label != mActive + mActiveCount; ++label)
                     {
-                        if (lineLen > data->conf->keySize && memcmp(currentBuffer, data->conf->key, data->conf->keySize) == 0)
+                        TeleInfoDataStruct *data = &mTeleInfoData[*label];
+                        if (TicLine::value(currentBuffer, eol, data->conf->key, data->conf->keySize))
                         {
+                            if (data == &mTeleInfoData[18 /* ADPS*/])
+                                break; // Derived from IINST and ISOUSC by the fast path
+                            const uint32_t previous = data->value.num;
                             if (TeleInfo::value(*data, currentBuffer, eol))
                             {
                                 data->lastChange = current;
-                                knx.getGroupObject(data->goSend).valueNoSend(TeleInfo::value(*data));
+                                encode(*data);
+                                const unsigned int reg = data - mTeleInfoData - FIRST_ENERGY_REGISTER;
+                                if (reg < sizeof(RegisterPeriod) / sizeof(RegisterPeriod[0]))
+                                    mCost.indexChanged(RegisterPeriod[reg], previous, data->value.num);
+                            }
+                            if (data == &mTeleInfoData[17 /* IINST*/] || (data >= &mTeleInfoData[22 /* IINST1*/] && data <= &mTeleInfoData[24 /* IINST3*/]))
+                            {
+                                urgent = updateAdps(current);
+                                const TeleInfoDataStruct &isousc = mTeleInfoData[2 /* ISOUSC*/];
+                                mForecast.sample(data == &mTeleInfoData[17 /* IINST*/] ? 0 : data - &mTeleInfoData[21], data->value.num,
+                                                 isousc.lastChange != 0 ? isousc.value.num : 0, current);
+                            }
+                            if (data == &mTeleInfoData[17 /* IINST*/] || data == &mTeleInfoData[20 /* PAPP*/] || (data >= &mTeleInfoData[22 /* IINST1*/] && data <= &mTeleInfoData[24 /* IINST3*/]))
+                                updateShedding(current);
+                            const unsigned int stats = data - mTeleInfoData - FIRST_STATS_LABEL;
+                            if (stats < sizeof(StatsLabel) / sizeof(StatsLabel[0]) && StatsLabel[stats] >= 0)
+                                mStats.sample((LabelStats::Label)StatsLabel[stats], data->value.num, current);
+                            if (data == &mTeleInfoData[24 /* IINST3 */])
+                            { // Last phase of a triphase frame
+                                const uint32_t iinst[PHASECOUNT] = {mTeleInfoData[22 /* IINST1*/].value.num, mTeleInfoData[23 /* IINST2*/].value.num, data->value.num};
+                                mPhases.sample(iinst);
                             }
                             break;
                         }
@@ -344,44 +661,39 @@ void TeleInfo::loop()
             mBufferLen -= currentBuffer - mBuffer;
             memmove(mBuffer, currentBuffer, mBufferLen);
         }
+        if (budget == 0)
+            break; // Next bytes are read by the next call
     }
+    if (urgent)
+        return true;
 
-    // Update ADPS (forced) when IINST or ISOUSC changed before ADPS (ADPS = MAX(0, IINST - ISOUSC));
-    const TeleInfoDataStruct &isousc = mTeleInfoData[2 /* ISOUSC*/];
-    if (isousc.lastChange != 0)
+    if (mMode.loop(current))
+    { // Probe the other TIC mode
+        mSerial.end();
+        mSerial.begin(mMode.speed(), config);
+        mBufferLen = 0;
+    }
+    return false;
+}
+
+void TeleInfo::publish(uint32_t current, bool isRealTime)
+{
+    // Repeat ADPS while overloaded
+    TeleInfoDataStruct &adps = mTeleInfoData[18 /* ADPS*/];
+    if (adps.value.num > 0 && current - adps.lastSend > ADPS_REPEAT_PERIOD)
     {
-        TeleInfoDataStruct &adps = mTeleInfoData[18 /* ADPS*/];
-        const TeleInfoDataStruct *iinsts[] = {&mTeleInfoData[17 /* IINST*/], &mTeleInfoData[22 /* IINST1*/], &mTeleInfoData[23 /* IINST2*/], &mTeleInfoData[24 /* IINST3*/]};
-        const TeleInfoDataStruct *maxiinst = nullptr;
-        for (size_t i = 0; i < sizeof(iinsts) / sizeof(iinsts[0]); ++i)
-        {
-            if (!maxiinst || maxiinst->value.num < iinsts[i]->value.num)
-            {
-                maxiinst = iinsts[i];
-            }
-        }
-        if (maxiinst && maxiinst->lastChange != 0 && (current == maxiinst->lastChange || current == isousc.lastChange))
-        {
-            uint32_t adpsValue = maxiinst->value.num > isousc.value.num ? maxiinst->value.num - isousc.value.num : 0;
-            if (adps.value.num != adpsValue)
-            {
-                adps.value.num = adpsValue;
-                adps.lastChange = current;
-                knx.getGroupObject(adps.goSend).valueNoSend(adpsValue);
-            }
-        }
-        if (current == adps.lastChange || (adps.value.num > 0 && current - adps.lastSend > ADPS_REPEAT_PERIOD))
-        {
-            adps.lastSendValueCheckSum = adps.value.num;
-            knx.getGroupObject(adps.goSend).objectWritten(); // Emit is forced
-            adps.lastSend = current;
-        }
+        emitAdps(current);
     }
 
+    mSchedule.loop(rtc);
+    mPhases.loop(current, isRealTime, mSchedule, mParams.period);
+    mStats.loop(current, mSchedule, mParams.period);
+
     // Send if value has changed and period is over
-    for (TeleInfoDataStruct *data = mTeleInfoData; data != mTeleInfoData + TeleInfoCount; ++data)
+    for (const uint8_t *label = mActive; label != mActive + mActiveCount; ++label)
     {
-        if (data->lastChange != data->lastSend && (isRealTime || current - data->lastSend > mParams.period))
+        TeleInfoDataStruct *data = &mTeleInfoData[*label];
+        if (data->lastChange != data->lastSend && (isRealTime || mSchedule.due(data->lastSend, current, mParams.period)))
         {
             uint32_t chksum = data->conf->type == TeleInfoDataType::STRING ? simpleChecksum(data->value.str) : data->value.num;
             if (chksum != data->lastSendValueCheckSum)
@@ -392,11 +704,16 @@ void TeleInfo::loop()
             }
         }
     }
+}
 
+void TeleInfo::updateHistory(uint32_t current, bool isRealTime)
+{
     // Update history
     if (mTeleInfoData[1 /* OPTARIF */].lastChange != 0)
     {
         uint32_t index[TARIFCOUNT] = {0};
+        uint32_t today[TARIFCOUNT] = {0};
+        bool started = false; // A period starts at this index
         currentIndexes(index);
         for (int i = 0; i < TARIFCOUNT; ++i)
         {
@@ -406,23 +723,39 @@ void TeleInfo::loop()
             if (index[i] >= mHistory.tariff[i].yesterday)
             {
                 if (mHistory.tariff[i].yesterday == 0)
+                {
                     mHistory.tariff[i].yesterday = index[i];
-                knx.getGroupObject(mGO.tariff[i].today).valueNoSend(index[i] - mHistory.tariff[i].yesterday);
+                    started = true;
+                }
+                today[i] = index[i] - mHistory.tariff[i].yesterday;
+                knx.getGroupObject(mGO.tariff[i].today).valueNoSend(today[i]);
             }
             if (index[i] >= mHistory.tariff[i].lastMonth)
             {
                 if (mHistory.tariff[i].lastMonth == 0)
+                {
                     mHistory.tariff[i].lastMonth = index[i];
+                    started = true;
+                }
                 knx.getGroupObject(mGO.tariff[i].thisMonth).valueNoSend(index[i] - mHistory.tariff[i].lastMonth);
             }
             if (index[i] >= mHistory.tariff[i].lastYear)
             {
                 if (mHistory.tariff[i].lastYear == 0)
+                {
                     mHistory.tariff[i].lastYear = index[i];
+                    started = true;
+                }
                 knx.getGroupObject(mGO.tariff[i].thisYear).valueNoSend(index[i] - mHistory.tariff[i].lastYear);
             }
         }
-        if (rtc.isValid() && (isRealTime || current - mHistoryLastSent > mParams.period))
+        // Flash copy of the new period starts: a second power cut the same day would otherwise start it again
+        if (started)
+            mPendingFlash |= FlashSnapshot;
+        mArchive.todayConsumption(today);
+        if (rtc.isValid())
+            mRolling.update(index);
+        if (rtc.isValid() && (isRealTime || mSchedule.totalsDue(mHistoryLastSent, current, mParams.period)))
         {
             for (int i = 0; i < TARIFCOUNT; ++i)
             {
@@ -435,25 +768,67 @@ void TeleInfo::loop()
                     mHistoryLastValue[i] = index[i];
                 }
             }
+            mCost.emit();
+            mRolling.emit();
         }
     }
 }
+
+void TeleInfo::housekeeping(uint32_t current)
+{
+    if (mLastManualHistoryInit && current - mLastManualHistoryInit > HISTORY_MANUALWRITE_TEMPO)
+    {
+        mPendingFlash |= FlashHistory;
+        mLastManualHistoryInit = 0;
+    }
+    // Flash writes requested by a day change, one step per call
+    if (mPendingFlash & FlashArchive)
+    {
+        mPendingFlash &= ~FlashArchive;
+        mArchive.dayEnded(mEndedDay); // Records queued for step()
+    }
+    if (mArchive.step())
+        ; // Archive records first
+    else if (mPendingFlash & FlashHistory)
+    {
+        mPendingFlash &= ~FlashHistory;
+        if (putHistory())
+            mPendingFlash |= FlashEeprom;
+    }
+    else if (mPendingFlash & FlashSnapshot)
+    {
+        mPendingFlash &= ~FlashSnapshot;
+        if (putSnapshot())
+            mPendingFlash |= FlashSnapshotSector;
+    }
+    else if ((mPendingFlash & FlashEeprom) && eepromStep())
+        mPendingFlash &= ~FlashEeprom;
+    else if ((mPendingFlash & FlashSnapshotSector) && snapshotStep())
+        mPendingFlash &= ~FlashSnapshotSector;
+
+    mCapture.loop();
+
+    // Left unchanged while the snapshot sector is programmed from it
+    if (mNoInitSnapshot && !(mPendingFlash & FlashSnapshotSector) && current - mLastSnapshot > SNAPSHOT_NOINIT_PERIOD)
+    {
+        snapshot(*mNoInitSnapshot);
+        mLastSnapshot = current;
+    }
+}
 void TeleInfo::currentIndexes(uint32_t index[TARIFCOUNT]) const
 {
     // depending on OPTARIF
-    uint8_t optarif = value(mTeleInfoData[1 /* OPTARIF */]);
-    switch (optarif)
+    switch (optarif(mTeleInfoData[1 /* OPTARIF */].value.num))
     {
-    case 0:
-    case 1 /* Base */:
+    case 0 /* Base */:
         index[Base] = mTeleInfoData[3 /* BASE */].value.num;
         break;
-    case 2 /* HCHP */:
+    case 1 /* HCHP */:
         index[HC] = mTeleInfoData[4 /* HCHC */].value.num;
         index[HP] = mTeleInfoData[5 /* HCHP */].value.num;
         index[Base] = index[HC] + index[HP];
         break;
-    case 3 /* EJP */:
+    case 2 /* EJP */:
         index[HC] = mTeleInfoData[6 /* EJPHN */].value.num;
         index[HP] = mTeleInfoData[7 /* EJPHPM */].value.num;
         index[Base] = index[HC] + index[HP];
@@ -476,8 +851,16 @@ void TeleInfo::newDate(RTCKnx::DateChange change)
     if (change == RTCKnx::Init)
     {
         validateHistory();
+        mCost.validate(rtc.dateTime());
         return;
     }
+    mCost.newDate(change, rtc.dateTime());
+    // Flash writes are left to housekeeping(), one per call
+    if (mPendingFlash & FlashArchive)
+        mArchive.dayEnded(mEndedDay); // Previous day change not queued yet
+    for (int i = 0; i < TARIFCOUNT; ++i)
+        mEndedDay[i] = mHistory.tariff[i].yesterday != 0 && mHistory.tariff[i].index >= mHistory.tariff[i].yesterday ? mHistory.tariff[i].index - mHistory.tariff[i].yesterday : 0;
+    mPendingFlash |= FlashArchive;
     switch (change)
     {
     case RTCKnx::Year:
@@ -497,9 +880,10 @@ void TeleInfo::newDate(RTCKnx::DateChange change)
             if (mHistory.tariff[i].monthM2 != 0)
                 knx.getGroupObject(mGO.tariff[i].lastMonth).value(mHistory.tariff[i].lastMonth - mHistory.tariff[i].monthM2);
         }
-        saveHistory(); // Save only each month (due to flash write cycle limited to 10000)
+        mPendingFlash |= FlashHistory; // Save only each month (due to flash write cycle limited to 10000)
         [[fallthrough]];
     case RTCKnx::Day:
+        mPhases.newDay();
         for (int i = 0; i < TARIFCOUNT; ++i)
         {
             mHistory.tariff[i].dayM2 = mHistory.tariff[i].yesterday;
@@ -510,6 +894,7 @@ void TeleInfo::newDate(RTCKnx::DateChange change)
         [[fallthrough]];
     default:;
     }
+    mPendingFlash |= FlashSnapshot; // Each day, as cost accumulators cannot be rebuilt from indexes (~365 flash writes per year)
 }
 void TeleInfo::validateHistory()
 {
@@ -534,15 +919,19 @@ void TeleInfo::validateHistory()
             mHistory.tariff[i].yesterday = mHistory.tariff[i].dayM2 = 0;
         }
     }
+    else
+        return;
+    resyncHistoryGroupObjects(); // Ended periods unknown, not the values before the power cut
 }
 
 void TeleInfo::restoreHistory()
 {
 
     uint8_t checksum = 0, mask = 0xff, mask2 = 0;
+    EEPROM.get(HISTORY_FLASH_START, mHistory);
     for (size_t i = 0; i < sizeof(mHistory); ++i)
     {
-        const uint8_t v = *((uint8_t *)&mHistory + i) = EEPROM.read(HISTORY_FLASH_START + i);
+        const uint8_t v = *((uint8_t *)&mHistory + i);
         mask &= v;
         mask2 |= v;
         checksum ^= v;
@@ -553,23 +942,26 @@ void TeleInfo::restoreHistory()
     }
 }
 void TeleInfo::saveHistory()
+{
+    if (putHistory())
+        EEPROM.commit(); // No flash write if unchanged
+}
+// History in the RAM copy of the EEPROM, written to flash by EEPROM.commit() or eepromStep()
+bool TeleInfo::putHistory()
 {
 
     if (mHistoryLastValue[Base] == 0)
-        return; // Nothing sent, nothing to store...
+        return false; // Nothing sent, nothing to store...
     const RTCKnx::DateTime &dateTime = rtc.dateTime();
     mHistory.lastSave = dateTime;
     uint8_t checksum = 0;
     for (size_t i = 0; i < sizeof(mHistory); ++i)
     {
-        EEPROM.write(HISTORY_FLASH_START + i, *((uint8_t *)&mHistory + i));
         checksum ^= *((uint8_t *)&mHistory + i);
     }
-    if (checksum != EEPROM.read(HISTORY_FLASH_START + sizeof(mHistory)))
-    {
-        EEPROM.write(HISTORY_FLASH_START + sizeof(mHistory), checksum);
-        EEPROM.commit();
-    }
+    EEPROM.put(HISTORY_FLASH_START, mHistory);
+    EEPROM.write(HISTORY_FLASH_START + sizeof(mHistory), checksum);
+    return true;
 }
 void TeleInfo::resetHistory()
 {
@@ -577,6 +969,9 @@ void TeleInfo::resetHistory()
     mHistory = {0};
     saveHistory();
     resyncHistoryGroupObjects();
+    mCost.reset();
+    mRolling.reset();
+    saveSnapshot();
 }
 void TeleInfo::resyncHistoryGroupObjects()
 {
@@ -591,3 +986,267 @@ void TeleInfo::resyncHistoryGroupObjects()
         knx.getGroupObject(mGO.tariff[i].lastYear).valueNoSend(mHistory.tariff[i].yearM2 != 0 ? mHistory.tariff[i].lastYear - mHistory.tariff[i].yearM2 : (uint32_t)0);
     }
 }
+
+void TeleInfo::snapshot(Snapshot &s)
+{
+    if (rtc.isValid())
+        mHistory.lastSave = rtc.dateTime();
+    s.version = SNAPSHOT_VERSION;
+    s.size = sizeof(Snapshot);
+    for (unsigned int i = 0; i < TeleInfoCount; ++i)
+    {
+        s.data[i].value = mTeleInfoData[i].value;
+        s.data[i].lastSendValueCheckSum = mTeleInfoData[i].lastSendValueCheckSum;
+    }
+    s.history = mHistory;
+    memcpy(s.historyLastValue, mHistoryLastValue, sizeof(mHistoryLastValue));
+    s.cost = mCost.state();
+    s.rolling = mRolling.state();
+    rtc.saveState(s.rtc);
+    s.shedding = mShedding.state(rtc.millis());
+    s.crc = crc32((const uint8_t *)&s, offsetof(Snapshot, crc));
+}
+void TeleInfo::readout(Readout &r)
+{
+    r.version = READOUT_VERSION;
+    r.size = sizeof(Readout);
+    for (unsigned int i = 0; i < TeleInfoCount; ++i)
+    {
+        r.data[i].value = mTeleInfoData[i].value;
+        r.data[i].lastSendValueCheckSum = mTeleInfoData[i].lastSendValueCheckSum;
+    }
+    r.history = mHistory;
+    if (rtc.isValid())
+        r.history.lastSave = rtc.dateTime();
+    memcpy(r.historyLastValue, mHistoryLastValue, sizeof(mHistoryLastValue));
+    r.cost = mCost.state();
+    for (int i = 0; i < ROLLING_TARIFFS; ++i)
+        for (int w = 0; w < ROLLING_WINDOWS; ++w)
+            r.rolling[i][w] = mRolling.consumption(i, w);
+    rtc.saveState(r.rtc);
+    r.crc = crc32((const uint8_t *)&r, offsetof(Readout, crc));
+}
+bool TeleInfo::restore(const Snapshot &s, bool warm)
+{
+    if (s.version != SNAPSHOT_VERSION || s.size != sizeof(Snapshot) || s.crc != crc32((const uint8_t *)&s, offsetof(Snapshot, crc)))
+        return false;
+    // Labels after a reset only: after a power cut, days old indexes would be taken as the current ones by the history
+    for (unsigned int i = 0; i < TeleInfoCount && warm; ++i)
+    {
+        mTeleInfoData[i].value = s.data[i].value;
+        mTeleInfoData[i].lastSendValueCheckSum = s.data[i].lastSendValueCheckSum;
+    }
+    // Never raise an overload from stale instantaneous currents
+    mTeleInfoData[17 /* IINST */].value.num = mTeleInfoData[18 /* ADPS */].value.num = 0;
+    mTeleInfoData[22 /* IINST1 */].value.num = mTeleInfoData[23 /* IINST2 */].value.num = mTeleInfoData[24 /* IINST3 */].value.num = 0;
+    // Known, and already sent: a label that never changes (OPTARIF, ISOUSC) would otherwise stay unknown
+    for (unsigned int i = 0; i < TeleInfoCount; ++i)
+        mTeleInfoData[i].lastChange = mTeleInfoData[i].lastSend = mTeleInfoData[i].value.num != 0 ? 1 : 0;
+    mHistory = s.history;
+    memcpy(mHistoryLastValue, s.historyLastValue, sizeof(mHistoryLastValue));
+    mCost.restore(s.cost);
+    mRolling.restore(s.rolling);
+    rtc.restoreState(s.rtc, warm);
+    mShedding.restore(s.shedding); // Also after a power cut: the outputs are only forced off without a snapshot
+    return true;
+}
+void TeleInfo::restoreSnapshot(Snapshot *noInit)
+{
+    mNoInitSnapshot = noInit;
+    mRestored = restore(*noInit, true);
+    if (!mRestored)
+    { // Cold boot: no-init RAM is garbage, reuse it to load the flash copy in one block
+        const uintptr_t address = snapshotAddress();
+        if (address)
+        {
+            memcpy(noInit, (const void *)address, sizeof(Snapshot));
+            mRestored = restore(*noInit, false);
+        }
+    }
+}
+void TeleInfo::beforeRestart()
+{
+    if (mNoInitSnapshot)
+        snapshot(*mNoInitSnapshot);
+}
+// Bulk readout of the state (see Readout) through a function property, big endian.
+// Command, without data: copies the state to the readout buffer, returns its size (2 bytes), version (2 bytes) and
+// crc (4 bytes), return code 1 when data is given.
+// State read with offset (2 bytes) and length (1 byte): returns the bytes of the readout buffer. The no-init snapshot
+// keeps being refreshed for a warm boot while the copy is read. Reads longer than READOUT_STANDARD_SEGMENT need
+// extended frames, and are cut to the result buffer of the KNX stack
+bool TeleInfo::readoutCommand(uint8_t length, const uint8_t * /* data */, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (resultLength < 9)
+        return false;
+    if (length != 0)
+    {
+        resultData[0] = 1 /* Invalid command */;
+        resultLength = 1;
+        return true;
+    }
+    readout(mReadout);
+    const Readout &s = mReadout;
+    const uint8_t result[9] = {0 /* Success */, (uint8_t)(s.size >> 8), (uint8_t)s.size, (uint8_t)(s.version >> 8), (uint8_t)s.version,
+                               (uint8_t)(s.crc >> 24), (uint8_t)(s.crc >> 16), (uint8_t)(s.crc >> 8), (uint8_t)s.crc};
+    memcpy(resultData, result, sizeof(result));
+    resultLength = sizeof(result);
+    return true;
+}
+bool TeleInfo::readoutState(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (length < 3 || resultLength < 1)
+        return false;
+    const uint16_t offset = (data[0] << 8) | data[1];
+    uint8_t size = MIN(data[2], resultLength - 1);
+    if (offset >= sizeof(mReadout))
+        size = 0;
+    else
+        size = MIN((unsigned int)size, sizeof(mReadout) - offset);
+    resultData[0] = size == 0 ? 1 /* Out of range */ : 0;
+    memcpy(resultData + 1, (const uint8_t *)&mReadout + offset, size);
+    resultLength = size + 1;
+    return true;
+}
+// Bulk history import: the period start indexes (slot tariff * HISTORY_PERIODS + period, in mGO.tariff order, 0: unknown)
+// are staged by ImportWrite commands, then checked together and applied by ImportCommit with a single flash write
+bool TeleInfo::historyImportCommand(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (resultLength < 1)
+        return false;
+    uint8_t result = ImportInvalid;
+    if (length >= 1 && data[0] == ImportBegin)
+    {
+        mImportSlots = 0;
+        result = ImportOk;
+    }
+    else if (length >= 2 && data[0] == ImportWrite && (length - 2) % 4 == 0 && data[1] + (length - 2) / 4 <= TARIFCOUNT * HISTORY_PERIODS)
+    {
+        for (uint8_t slot = data[1], i = 2; i < length; ++slot, i += 4)
+        {
+            mImport[slot / HISTORY_PERIODS][slot % HISTORY_PERIODS] = ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) | (data[i + 2] << 8) | data[i + 3];
+            mImportSlots |= 1UL << slot;
+        }
+        result = ImportOk;
+    }
+    else if (length >= 1 && data[0] == ImportCommit)
+    {
+        result = importHistory();
+    }
+    resultData[0] = result;
+    resultLength = 1;
+    return true;
+}
+uint8_t TeleInfo::importHistory()
+{
+    if (mImportSlots != (1UL << (TARIFCOUNT * HISTORY_PERIODS)) - 1)
+        return ImportIncomplete;
+    if (!rtc.isValid() || mHistoryLastValue[Base] == 0)
+        return ImportNotReady; // The references are only meaningful against the current index and date
+    // Period starts that must not decrease, [older, newer] (6: current index). The first three pairs are the ends of the
+    // previous periods: a known start needs a known end
+    static const uint8_t order[][2] = {{1, 0}, {3, 2}, {5, 4}, {4, 2}, {2, 0}, {5, 3}, {3, 1}, {0, 6}, {2, 6}, {4, 6}};
+    for (int i = 0; i < TARIFCOUNT; ++i)
+    {
+        for (unsigned int k = 0; k < sizeof(order) / sizeof(order[0]); ++k)
+        {
+            const uint32_t older = mImport[i][order[k][0]], newer = order[k][1] == 6 ? mHistory.tariff[i].index : mImport[i][order[k][1]];
+            const bool end = k < 3 || order[k][1] == 6;
+            if (older != 0 && (newer == 0 ? end : older > newer))
+                return ImportInvalid;
+        }
+    }
+    for (int period = 0; period < HISTORY_PERIODS; ++period)
+    {
+        if (mImport[HC][period] != 0 && mImport[HP][period] != 0 && mImport[Base][period] != mImport[HC][period] + mImport[HP][period])
+            return ImportInvalid; // Base is the sum of the HC and HP registers
+    }
+    for (int i = 0; i < TARIFCOUNT; ++i)
+    {
+        auto &h = mHistory.tariff[i];
+        h.yesterday = mImport[i][0];
+        h.dayM2 = mImport[i][1];
+        h.lastMonth = mImport[i][2];
+        h.monthM2 = mImport[i][3];
+        h.lastYear = mImport[i][4];
+        h.yearM2 = mImport[i][5];
+    }
+    mImportSlots = 0;
+    resyncHistoryGroupObjects();
+    for (int i = 0; i < TARIFCOUNT; ++i)
+    {
+        const auto &h = mHistory.tariff[i];
+        const uint32_t starts[HISTORY_PERIODS] = {h.yesterday, h.dayM2, h.lastMonth, h.monthM2, h.lastYear, h.yearM2};
+        for (int period = 0; period < HISTORY_PERIODS; ++period)
+            if (starts[period] != 0)
+                knx.getGroupObject(mGO.tariff[i].today + period).objectWritten();
+    }
+    mLastManualHistoryInit = 0; // Saved now, not after HISTORY_MANUALWRITE_TEMPO
+    mPendingFlash |= FlashHistory;
+    return ImportOk;
+}
+// Written at once, with the history left in the EEPROM RAM copy
+void TeleInfo::saveSnapshot()
+{
+    if (mPendingFlash & FlashEeprom)
+    {
+        EEPROM.commit();
+        mEepromStep = 0;
+    }
+    if (!putSnapshot())
+        return;
+    mSnapshotStep = 0;
+    while (!snapshotStep())
+        ;
+    mPendingFlash &= ~(FlashEeprom | FlashSnapshotSector);
+}
+bool TeleInfo::putSnapshot()
+{
+    if (!mNoInitSnapshot || !snapshotAddress())
+        return false;
+    snapshot(*mNoInitSnapshot);
+    return true;
+}
+
+// One FlashWriter step of the EEPROM sector from its RAM copy: EEPROM.commit() erases and programs it at once
+// with interrupts stopped (~50ms). True once the flash matches the RAM copy, written again if it changed meanwhile
+bool TeleInfo::eepromStep()
+{
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    if (EEPROM.length() != FLASH_SECTOR_SIZE)
+        return EEPROM.commit(); // Partial sector: left to the library
+    if (mEepromStep == 0 && memcmp(_EEPROM_start, data, FLASH_SECTOR_SIZE) == 0)
+        return true; // Unchanged
+    if (!FlashWriter::rewrite((uintptr_t)_EEPROM_start - XIP_BASE, data, FLASH_SECTOR_SIZE, mEepromStep))
+        return false;
+    mEepromStep = 0;
+    return memcmp(_EEPROM_start, data, FLASH_SECTOR_SIZE) == 0;
+}
+// One FlashWriter step of the snapshot sector from the no-init snapshot, taken by putSnapshot() and left unchanged
+// until the sector is written. True once written
+bool TeleInfo::snapshotStep()
+{
+    if (!FlashWriter::rewrite(snapshotAddress() - XIP_BASE, (const uint8_t *)mNoInitSnapshot, sizeof(Snapshot), mSnapshotStep))
+        return false;
+    mSnapshotStep = 0;
+    return true;
+}
+
+// Cost of the label update path (see the "bench encode" USB command): the current value is written again
+// ENCODE_BENCH_ROUNDS times in place, then through KNXValue as before the direct encoders
+bool TeleInfo::encodeCost(unsigned int label, EncodeCost &cost)
+{
+    if (label >= TeleInfoCount || !(mLabels & (1UL << label)))
+        return false;
+    const TeleInfoDataStruct &data = mTeleInfoData[label];
+    cost.key = data.conf->key;
+    uint32_t start = rp2040.getCycleCount();
+    for (int i = 0; i < ENCODE_BENCH_ROUNDS; ++i)
+        encode(data);
+    cost.direct = (rp2040.getCycleCount() - start) / ENCODE_BENCH_ROUNDS;
+    start = rp2040.getCycleCount();
+    for (int i = 0; i < ENCODE_BENCH_ROUNDS; ++i)
+        knx.getGroupObject(data.goSend).valueNoSend(value(data));
+    cost.generic = (rp2040.getCycleCount() - start) / ENCODE_BENCH_ROUNDS;
+    return true;
+}
@@ -3,27 +3,95 @@
 #include <Arduino.h>
 #include <knx.h>
 #include "RTCKnx.h"
+#include "TariffCost.h"
+#include "TicCapture.h"
+#include "PhaseLoad.h"
+#include "LoadShedding.h"
+#include "LabelStats.h"
+#include "TicLine.h"
+#include "TicMode.h"
+#include "EnergyArchive.h"
+#include "PublishSchedule.h"
+#include "OverloadForecast.h"
+#include "RollingConsumption.h"
+#include "GroupObjectDispatch.h"
 
 #define HISTORY_FLASH_START 0
+#define SNAPSHOT_SECTOR_SIZE 4096U // Flash copy of the snapshot: last sector of the filesystem region
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_NOINIT_PERIOD 1000 // Refresh no-init RAM snapshot every 1s
+#define READOUT_OBJECT_INDEX 160 // Manufacturer specific interface object for the bulk readout
+#define READOUT_PROPERTY_ID 201
+#define READOUT_VERSION 1
+#define READOUT_STANDARD_SEGMENT 11  // Readout bytes per state read in a standard frame (15 APDU octets)
+#define HISTORY_IMPORT_PROPERTY_ID 203   // Bulk history import function property, on READOUT_OBJECT_INDEX
 #define TELEINFO_BUFFERSIZE 512U
 #define HISTORY_MANUALWRITE_TEMPO (60 * 60 * 1000) // 1 hour
 #define ADPS_REPEAT_PERIOD (10 * 1000)             // Repeat ADPS > 0 every 10s
+#define HISTORY_PERIODS 6                          // Group objects per tariff, consecutive
+#define ENCODE_BENCH_ROUNDS 64                     // Updates averaged by encodeCost()
 
 class TeleInfo
 {
 private:
-    SerialUART mSerial;
-    unsigned long speed;
+    SerialUART &mSerial;
     uint16_t config;
     char mBuffer[TELEINFO_BUFFERSIZE]; // No '\0'
     int mBufferLen = 0;
-    RTCKnx rtc;
+    RTCKnx &rtc;
+    TariffCost mCost;
+    TicCapture mCapture;
+    PhaseLoad mPhases;
+    LoadShedding mShedding;
+    LabelStats mStats;
+    TicMode mMode;
+    EnergyArchive mArchive;
+    PublishSchedule mSchedule;
+    OverloadForecast mForecast;
+    RollingConsumption mRolling;
 
     struct
     {
         uint32_t period;
         uint32_t realTimeTimeout;
     } mParams;
+    struct
+    {
+        uint32_t bytes; // TIC bytes read per call, 0: no limit
+        uint32_t time;  // In us per call, 0: no limit
+    } mSlice;
+
+    enum Stage
+    {
+        StageReceive = 0,
+        StagePublish,
+        StageHistory,
+        StageHousekeeping,
+        STAGECOUNT
+    };
+    enum PendingFlash
+    {
+        FlashArchive = 1,
+        FlashHistory = 2,
+        FlashSnapshot = 4,
+        FlashEeprom = 8,          // EEPROM sector rewritten from its RAM copy
+        FlashSnapshotSector = 16  // Snapshot sector rewritten from the no-init snapshot
+    };
+
+    // Bulk history import (see historyImportCommand)
+    enum ImportCommand
+    {
+        ImportBegin = 0, // Forget the staged indexes
+        ImportWrite,     // First slot, then indexes on 4 bytes
+        ImportCommit     // Validate the staged set and apply it
+    };
+    enum ImportResult
+    {
+        ImportOk = 0,
+        ImportInvalid,   // Bad command, slot out of range or inconsistent indexes
+        ImportNotReady,  // No meter index or clock yet
+        ImportIncomplete // Some slots not written since ImportBegin
+    };
 
     enum TarifBlock
     {
@@ -53,6 +121,18 @@ private:
     uint32_t mHistoryLastSent = 0;
     uint32_t mLastReception = 0;
     uint32_t mLastManualHistoryInit = 0;
+    uint32_t mLastSnapshot = 0;
+    uint32_t mSliceStart = 0;
+    uint8_t mStage = StageReceive;
+    bool mLinesLeft = false;        // Complete lines left in mBuffer by the previous call
+    uint8_t mPendingFlash = 0;      // PendingFlash bits, written by housekeeping()
+    uint8_t mEepromStep = 0;        // FlashWriter::rewrite() step of the EEPROM sector
+    uint8_t mSnapshotStep = 0;      // FlashWriter::rewrite() step of the snapshot sector
+    uint32_t mEndedDay[TARIFCOUNT]; // Consumption of the last day ended, for the archive
+    uint32_t mImport[TARIFCOUNT][HISTORY_PERIODS]; // Staged period start indexes, in mGO.tariff order
+    uint32_t mImportSlots = 0;                     // Bit per slot written since ImportBegin
+    bool mRestored = false;
+    bool mStarted = false;
     struct
     {
         RTCKnx::DateTime lastSave;
@@ -69,6 +149,10 @@ private:
     } mHistory = {0};
 
 public:
+    struct TeleInfoDataStruct;
+    // Writes a value straight into a group object payload, in the wire format of the label DPT
+    typedef void (*Encoder)(uint8_t *payload, const TeleInfoDataStruct &val);
+
     struct TeleInfoDataType
     {
         const char *key;
@@ -88,6 +172,7 @@ public:
             short mainGroup;
             short subGroup;
         } dpt;
+        Encoder encode;
     };
 
 private:
@@ -97,41 +182,41 @@ private:
     }
 
     const TeleInfoDataType TeleInfoParam[29] PROGMEM = {
-        {PSTR("ADCO "), 5, TeleInfoDataType::STRING, 12, DPT_String_ASCII},
-        {PSTR("OPTARIF "), 8, TeleInfoDataType::OPTARIF, 4, DPT_Value_1_Ucount},
-        {PSTR("ISOUSC "), 7, TeleInfoDataType::INT, 2, DPT_Value_Electric_Current},
-        {PSTR("BASE "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("HCHC "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("HCHP "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("EJPHN "), 6, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("EJPHPM "), 7, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHCJB "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHPJB "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHCJW "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHPJW "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHCJR "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("BBRHPJR "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy},
-        {PSTR("PEJP "), 5, TeleInfoDataType::INT, 2, DPT_TimePeriodMin},
-        {PSTR("PTEC "), 5, TeleInfoDataType::PTEC, 4, DPT_Value_1_Ucount},
-        {PSTR("DEMAIN "), 7, TeleInfoDataType::DEMAIN, 4, DPT_Value_1_Ucount},
-        {PSTR("IINST "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("ADPS "), 5, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IMAX "), 5, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("PAPP "), 5, TeleInfoDataType::INT, 5, DPT_Value_2_Count}, // VA
-        {PSTR("HHPHC "), 6, TeleInfoDataType::HHPHC, 1, DPT_Char_ASCII},
-        {PSTR("IINST1 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IINST2 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IINST3 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IMAX1 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IMAX2 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("IMAX3 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current},
-        {PSTR("PMAX "), 5, TeleInfoDataType::INT, 5, DPT_Value_Power}};
+        {PSTR("ADCO "), 5, TeleInfoDataType::STRING, 12, DPT_String_ASCII, encodeString},
+        {PSTR("OPTARIF "), 8, TeleInfoDataType::OPTARIF, 4, DPT_Value_1_Ucount, encodeOptarif},
+        {PSTR("ISOUSC "), 7, TeleInfoDataType::INT, 2, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("BASE "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("HCHC "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("HCHP "), 5, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("EJPHN "), 6, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("EJPHPM "), 7, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHCJB "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHPJB "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHCJW "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHPJW "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHCJR "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("BBRHPJR "), 8, TeleInfoDataType::INT, 9, DPT_ActiveEnergy, encodeU32},
+        {PSTR("PEJP "), 5, TeleInfoDataType::INT, 2, DPT_TimePeriodMin, encodeU16},
+        {PSTR("PTEC "), 5, TeleInfoDataType::PTEC, 4, DPT_Value_1_Ucount, encodePtec},
+        {PSTR("DEMAIN "), 7, TeleInfoDataType::DEMAIN, 4, DPT_Value_1_Ucount, encodeDemain},
+        {PSTR("IINST "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("ADPS "), 5, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IMAX "), 5, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("PAPP "), 5, TeleInfoDataType::INT, 5, DPT_Value_2_Count, encodeS16}, // VA
+        {PSTR("HHPHC "), 6, TeleInfoDataType::HHPHC, 1, DPT_Char_ASCII, encodeChar},
+        {PSTR("IINST1 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IINST2 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IINST3 "), 7, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IMAX1 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IMAX2 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("IMAX3 "), 6, TeleInfoDataType::INT, 3, DPT_Value_Electric_Current, encodeU16},
+        {PSTR("PMAX "), 5, TeleInfoDataType::INT, 5, DPT_Value_Power, encodeFloat16}};
 
 #undef Dpt
 
+public:
     static const unsigned int TeleInfoCount = sizeof(TeleInfoParam) / sizeof(TeleInfoParam[0]);
 
-public:
     struct TeleInfoDataStruct
     {
         uint16_t goSend;
@@ -141,23 +226,104 @@ public:
             char str[13];
             uint32_t num;
         } value;
+        uint8_t *payload; // Group object value, nullptr when its size does not match the DPT
         uint32_t lastSendValueCheckSum;
         uint32_t lastChange;
         uint32_t lastSend;
     } mTeleInfoData[TeleInfoCount] = {0};
 
+    // State restored at boot to answer reads before the first TIC frame
+    struct Snapshot
+    {
+        uint16_t version;
+        uint16_t size;
+        struct
+        {
+            decltype(TeleInfoDataStruct::value) value;
+            uint32_t lastSendValueCheckSum;
+        } data[TeleInfoCount];
+        decltype(mHistory) history;
+        uint32_t historyLastValue[TARIFCOUNT];
+        TariffCost::State cost;
+        RollingConsumption::State rolling;
+        RTCKnx::State rtc;
+        LoadShedding::State shedding;
+        uint32_t crc;
+    };
+
+    // State served by the bulk readout: the snapshot with the rolling window sums instead of their buckets
+    struct Readout
+    {
+        uint16_t version;
+        uint16_t size;
+        decltype(Snapshot::data) data;
+        decltype(mHistory) history;
+        uint32_t historyLastValue[TARIFCOUNT];
+        TariffCost::State cost;
+        uint32_t rolling[ROLLING_TARIFFS][ROLLING_WINDOWS]; // In Wh, RollingConsumption::consumption() order
+        RTCKnx::State rtc;
+        uint32_t crc;
+    };
+
+    // Cost of one label update, in CPU cycles
+    struct EncodeCost
+    {
+        const char *key;
+        uint32_t direct;  // Value encoded in place into the group object payload
+        uint32_t generic; // Conversion through KNXValue
+    };
+
 private:
+    Snapshot *mNoInitSnapshot = nullptr;
+    Readout mReadout = {0}; // Taken by each readout command, served by the state reads until the next one
+    // Labels selected in ETS, compiled by init() so unused labels are neither matched nor sent
+    uint32_t mLabels = 0;           // Bit i: TeleInfoParam[i]
+    uint8_t mActive[TeleInfoCount]; // Indexes of the active labels, in frame order
+    uint8_t mActiveCount = 0;
+
     // Hold the memory buffer for all teleinfo
-    static inline bool validChecksum(const char *begin, const char *end);
+    void meterDate(const char *begin, const char *end);
     static inline uint32_t simpleChecksum(const char *str);
+    static inline uint32_t crc32(const uint8_t *data, size_t size);
     static inline KNXValue value(const TeleInfoDataStruct &val);
+    static inline uint8_t optarif(uint32_t num);
+    static inline uint8_t ptec(uint32_t num);
+    static inline uint8_t demain(uint32_t num);
+    static inline uint8_t payloadSize(short mainGroup);
+    static inline void encode(const TeleInfoDataStruct &val);
+    static void encodeString(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeOptarif(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodePtec(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeDemain(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeChar(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeU16(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeS16(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeU32(uint8_t *payload, const TeleInfoDataStruct &val);
+    static void encodeFloat16(uint8_t *payload, const TeleInfoDataStruct &val);
     static inline bool value(TeleInfo::TeleInfoDataStruct &val, const char *begin, const char *end);
+    bool updateAdps(uint32_t current);
+    bool emitAdps(uint32_t current);
+    void updateShedding(uint32_t current);
+    void initLabels(uint32_t labels, uint16_t baseGO);
+    bool sliceOver() const;
+    bool receive(uint32_t current);
+    void publish(uint32_t current, bool isRealTime);
+    void updateHistory(uint32_t current, bool isRealTime);
+    void housekeeping(uint32_t current);
+    void onRealTime(GroupObject &go, uint8_t);
+    void onHistory(GroupObject &go, uint8_t arg);
 
 public:
     TeleInfo(RTCKnx *_rtc, SerialUART *suart, unsigned long _baud, uint16_t _config);
     void init(int baseAddr, uint16_t baseGO);
     void setHistory(uint32_t ref, uint32_t &dest, uint32_t src, int idxTariff, RTCKnx::DateChange periodToEmit);
     uint32_t lastReception() const;
+    uint16_t adpsGroupObject() const; // Overload telegram (see updateAdps)
+    TicCapture &capture();
+    EnergyArchive &archive();
+    const RollingConsumption &rolling() const;
+    TicMode::Mode ticMode() const;
+    bool flashPending() const; // Flash writes queued by housekeeping() or in progress
     void loop();
     void currentIndexes(uint32_t index[TARIFCOUNT]) const;
     void newDate(RTCKnx::DateChange change);
@@ -166,5 +332,29 @@ public:
     void saveHistory();
     void resetHistory();
     void resyncHistoryGroupObjects();
+    void restoreSnapshot(Snapshot *noInit);
+    void saveSnapshot();
+    void beforeRestart();
+    bool readoutCommand(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength);
+    bool readoutState(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength);
+    bool historyImportCommand(uint8_t length, const uint8_t *data, uint8_t *resultData, uint8_t &resultLength);
+    bool encodeCost(unsigned int label, EncodeCost &cost);
+    enum
+    {
+        NBGO = 2 + TARIFCOUNT * HISTORY_PERIODS + TeleInfoCount + TariffCost::NBGO + TicCapture::NBGO + PhaseLoad::NBGO + LoadShedding::NBGO +
+               LabelStats::NBGO + TicMode::NBGO + EnergyArchive::NBGO + OverloadForecast::NBGO + RollingConsumption::NBGO,
+        SIZEPARAMS = 8 + TariffCost::SIZEPARAMS + TicCapture::SIZEPARAMS + PhaseLoad::SIZEPARAMS + LoadShedding::SIZEPARAMS + 4 /* Time source */ +
+                     LabelStats::SIZEPARAMS + 4 /* Labels */ + TicMode::SIZEPARAMS + PublishSchedule::SIZEPARAMS + OverloadForecast::SIZEPARAMS + 8 /* Slice */
+    };
+
+private:
+    void snapshot(Snapshot &s);
+    void readout(Readout &r);
+    bool restore(const Snapshot &s, bool warm);
+    bool putHistory();
+    bool putSnapshot();
+    bool eepromStep();
+    bool snapshotStep();
+    uint8_t importHistory();
 };
 #endif
\ No newline at end of file
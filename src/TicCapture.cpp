@@ -0,0 +1,262 @@
+#include <Arduino.h>
+#include <knx.h>
+#include <hardware/flash.h>
+#include "TicCapture.h"
+#include "EnergyArchive.h"
+#include "FlashWriter.h"
+
+// Filesystem region reserved by board_build.filesystem_size, used as a raw ring of pages up to the energy archive
+// and the snapshot sector.
+// Linker symbols, addressed as integers: the region is outside of any object known to the compiler
+extern "C" uint8_t _FS_start[];
+extern "C" uint8_t _FS_end[];
+
+static_assert(sizeof(TicCapture::Page) == CAPTURE_PAGE_SIZE, "Capture page must match a flash page");
+
+uint32_t TicCapture::regionStart() { return (uint32_t)((uintptr_t)_FS_start - XIP_BASE); }
+uint32_t TicCapture::regionSize()
+{
+    const uintptr_t size = (uintptr_t)_FS_end - (uintptr_t)_FS_start;
+    const uintptr_t reserved = ARCHIVE_REGION_SIZE + CAPTURE_SNAPSHOT_SIZE;
+    return size < reserved ? 0 : (uint32_t)(size - reserved) & ~(CAPTURE_SECTOR_SIZE - 1);
+}
+const TicCapture::Page *TicCapture::flashPage(uint32_t offset) { return (const Page *)((uintptr_t)_FS_start + offset); }
+
+void TicCapture::onOnOff(GroupObject &go, uint8_t) { enable(go.value()); }
+
+void TicCapture::init(int baseAddr, uint16_t baseGO)
+{
+    const bool was = enabled();
+    mParams.enabled = knx.paramInt(baseAddr);
+    mOverride = -1; // Downloaded parameter applied again
+    knx.getGroupObject(m_GO.onOff = ++baseGO).dataPointType(DPT_Switch);
+    GroupObjectDispatch::attach<TicCapture, &TicCapture::onOnOff>(m_GO.onOff, this);
+    knx.getGroupObject(m_GO.onOffState = ++baseGO).dataPointType(DPT_Switch);
+    stopped(was);
+    knx.getGroupObject(m_GO.onOffState).valueNoSend(enabled());
+}
+
+void TicCapture::scan()
+{
+    // Resume after the newest page
+    uint32_t newest = 0xffffffff;
+    for (uint32_t offset = 0; offset < regionSize(); offset += CAPTURE_PAGE_SIZE)
+    {
+        const uint32_t sequence = flashPage(offset)->sequence;
+        if (sequence != 0xffffffff && (newest == 0xffffffff || (int32_t)(sequence - mSequence) >= 0))
+        {
+            newest = offset;
+            mSequence = sequence + 1;
+        }
+    }
+    mWriteOffset = newest == 0xffffffff ? 0 : (newest + CAPTURE_PAGE_SIZE) % regionSize();
+    mScanned = true;
+}
+
+void TicCapture::openPage(uint32_t time)
+{
+    Page &page = mPages[mHead];
+    memset(&page, 0xff, sizeof(page));
+    page.sequence = mSequence++;
+    page.time = time;
+    if (rtc.isValid())
+        page.date = rtc.dateTime();
+    else
+        page.date = {0};
+    page.used = 0;
+}
+
+void TicCapture::closePage()
+{
+    mHead = (mHead + 1) % CAPTURE_STAGING_PAGES;
+    mPages[mHead].used = 0;
+}
+
+void TicCapture::append(const char *bytes, unsigned int len, uint32_t time)
+{
+    if (!enabled() || regionSize() == 0 || mClearOffset != 0xffffffff)
+        return;
+    while (len > 0)
+    {
+        Page *page = &mPages[mHead];
+        if (page->used != 0 && (time - page->time > 0xffff || page->used + 3U >= sizeof(page->data)))
+        {
+            if ((mHead + 1) % CAPTURE_STAGING_PAGES == mTail)
+            {
+                mOverruns += len; // Flash is late: drop rather than delay parsing
+                return;
+            }
+            closePage();
+            page = &mPages[mHead];
+        }
+        if (page->used == 0)
+            openPage(time);
+        const unsigned int chunk = MIN(MIN(len, sizeof(page->data) - page->used - 3), 255U);
+        const uint16_t delta = time - page->time;
+        uint8_t *record = page->data + page->used;
+        record[0] = delta & 0xff;
+        record[1] = delta >> 8;
+        record[2] = chunk;
+        memcpy(record + 3, bytes, chunk);
+        page->used += 3 + chunk;
+        bytes += chunk;
+        len -= chunk;
+    }
+}
+
+// Sector erased before the next pages: the one of the write offset when it starts a sector, else the next one
+uint32_t TicCapture::nextSector() const
+{
+    const uint32_t sector = mWriteOffset - mWriteOffset % CAPTURE_SECTOR_SIZE;
+    return sector == mWriteOffset ? sector : (sector + CAPTURE_SECTOR_SIZE) % regionSize();
+}
+
+bool TicCapture::flushOne()
+{
+    if (mTail == mHead)
+        return false;
+    if (mWriteOffset % CAPTURE_SECTOR_SIZE == 0)
+    {
+        if (mErasedSector != mWriteOffset)
+            return false; // Waits for eraseAhead()
+        mErasedSector = 0xffffffff;
+    }
+    FlashWriter::program(regionStart() + mWriteOffset, (const uint8_t *)&mPages[mTail], CAPTURE_PAGE_SIZE);
+    mWriteOffset = (mWriteOffset + CAPTURE_PAGE_SIZE) % regionSize();
+    mTail = (mTail + 1) % CAPTURE_STAGING_PAGES;
+    return true;
+}
+
+// Oldest sector of the ring erased while the current one is filled: pages are programmed without waiting
+bool TicCapture::eraseAhead()
+{
+    const uint32_t sector = nextSector();
+    if (mErasedSector == sector)
+        return false;
+    if (FlashWriter::erase(regionStart() + sector))
+        mErasedSector = sector;
+    return true;
+}
+
+void TicCapture::loop()
+{
+    if (regionSize() == 0)
+        return;
+    const uint32_t current = rtc.millis();
+    if (mClearOffset != 0xffffffff)
+    {
+        if (current - mLastErase >= CAPTURE_ERASE_PERIOD)
+        {
+            mLastErase = current;
+            clearStep();
+        }
+        return;
+    }
+    if (mExportStage == ExportCount || mExportStage == ExportPages)
+    {
+        exportStep();
+        return;
+    }
+    if (mExportStage == ExportFlush && mTail == mHead && !FlashWriter::erasing())
+    {
+        mExportStage = ExportCount; // Flash readable everywhere: no erase suspended
+        mExportOffset = mExportCount = 0;
+        return;
+    }
+    if (mTail == mHead && !enabled() && mExportStage == ExportIdle)
+        return;
+    if (!mScanned)
+        scan();
+    if (current - mLastFlush >= CAPTURE_FLUSH_PERIOD && flushOne())
+        mLastFlush = current;
+    else if (current - mLastErase >= CAPTURE_ERASE_PERIOD && eraseAhead())
+        mLastErase = current;
+}
+
+// Page being filled closed when the capture stops: programmed by loop()
+void TicCapture::stopped(bool was)
+{
+    if (was && !enabled() && mPages[mHead].used != 0 && (mHead + 1) % CAPTURE_STAGING_PAGES != mTail)
+        closePage();
+}
+
+void TicCapture::enable(bool on)
+{
+    const bool was = enabled();
+    mOverride = on;
+    stopped(was);
+    knx.getGroupObject(m_GO.onOffState).value(on);
+}
+
+bool TicCapture::enabled() const { return mOverride >= 0 ? mOverride != 0 : mParams.enabled != 0; }
+uint32_t TicCapture::overruns() const { return mOverruns; }
+
+void TicCapture::exportTo(Stream &out)
+{
+    if (regionSize() == 0 || mClearOffset != 0xffffffff)
+        return;
+    if (mPages[mHead].used != 0 && (mHead + 1) % CAPTURE_STAGING_PAGES != mTail)
+        closePage();
+    mExport = &out;
+    mExportStage = ExportFlush;
+}
+
+bool TicCapture::exporting() const { return mExportStage != ExportIdle; }
+
+void TicCapture::exportStep()
+{
+    if (mExportStage == ExportCount)
+    {
+        for (const uint32_t end = mExportOffset + CAPTURE_SECTOR_SIZE; mExportOffset < end; mExportOffset += CAPTURE_PAGE_SIZE)
+        {
+            if (flashPage(mExportOffset)->sequence != 0xffffffff)
+                ++mExportCount;
+        }
+        if (mExportOffset < regionSize())
+            return;
+        const FileHeader header = {CAPTURE_FILE_MAGIC, 1, CAPTURE_PAGE_SIZE, mExportCount};
+        mExport->write((const uint8_t *)&header, sizeof(header));
+        mExportStage = ExportPages;
+        mExportOffset = 0;
+        return;
+    }
+    // Oldest page is the next one to be overwritten
+    while (mExportOffset < regionSize())
+    {
+        const Page *page = flashPage((mWriteOffset + mExportOffset) % regionSize());
+        mExportOffset += CAPTURE_PAGE_SIZE;
+        if (page->sequence != 0xffffffff)
+        {
+            mExport->write((const uint8_t *)page, CAPTURE_PAGE_SIZE);
+            return;
+        }
+    }
+    mExport->flush();
+    mExport = nullptr;
+    mExportStage = ExportIdle;
+}
+
+void TicCapture::clear()
+{
+    mHead = mTail = 0;
+    mPages[mHead].used = 0;
+    mExport = nullptr;
+    mExportStage = ExportIdle;
+    mClearOffset = 0;
+}
+
+void TicCapture::clearStep()
+{
+    // Pages are programmed whole with their sequence: sectors without any are blank, unless being erased
+    bool blank = !FlashWriter::erasing();
+    for (uint32_t offset = mClearOffset; blank && offset < mClearOffset + CAPTURE_SECTOR_SIZE; offset += CAPTURE_PAGE_SIZE)
+        blank = flashPage(offset)->sequence == 0xffffffff;
+    if (!blank && !FlashWriter::erase(regionStart() + mClearOffset))
+        return;
+    mClearOffset += CAPTURE_SECTOR_SIZE;
+    if (mClearOffset < regionSize())
+        return;
+    mClearOffset = 0xffffffff;
+    mWriteOffset = mErasedSector = 0;
+    mScanned = true;
+}
@@ -0,0 +1,108 @@
+#ifndef TICCAPTURE_H
+#define TICCAPTURE_H
+
+#include <Arduino.h>
+#include <knx.h>
+#include "RTCKnx.h"
+#include "GroupObjectDispatch.h"
+
+#define CAPTURE_PAGE_SIZE 256U      // Flash page
+#define CAPTURE_SECTOR_SIZE 4096U   // Flash erase unit
+#define CAPTURE_STAGING_PAGES 4     // RAM pages waiting to be programmed (~4s of TIC at 1200 bauds)
+#define CAPTURE_FLUSH_PERIOD 100    // At most one page programmed every 100ms
+#define CAPTURE_ERASE_PERIOD 10     // At most one erase step (FlashWriter) every 10ms
+#define CAPTURE_FILE_MAGIC 0x43434954 // "TICC" in little endian
+#define CAPTURE_SNAPSHOT_SIZE 4096U // End of the filesystem region left to the TeleInfo snapshot (SNAPSHOT_SECTOR_SIZE)
+
+// Records raw TIC bytes with their arrival time in a rolling region of the external flash.
+// Bytes are staged in RAM by append() and programmed one page at a time from loop(), while the next
+// sector is erased ahead in steps. Export and clear also run from loop(), a page or a step per call.
+class TicCapture
+{
+public:
+    struct Page
+    {
+        uint32_t sequence; // 0xffffffff: erased page
+        uint32_t time;     // RTCKnx::millis() of the first record
+        RTCKnx::DateTime date;
+        uint16_t used;
+        // Records: uint16_t delta time (ms since page time), uint8_t length, bytes
+        uint8_t data[CAPTURE_PAGE_SIZE - 22];
+    };
+    // Header of an exported capture, followed by pages from the oldest to the newest
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t pageSize;
+        uint32_t pageCount;
+    };
+
+private:
+    RTCKnx &rtc;
+    struct
+    {
+        uint32_t enabled;
+    } mParams;
+    struct
+    {
+        uint16_t onOff;
+        uint16_t onOffState;
+    } m_GO;
+
+    Page mPages[CAPTURE_STAGING_PAGES];
+    uint8_t mHead = 0;  // Page being filled
+    uint8_t mTail = 0;  // Oldest page waiting for flash
+    uint32_t mSequence = 0;
+    uint32_t mWriteOffset = 0; // Next page in region
+    uint32_t mErasedSector = 0xffffffff; // Erased ahead, not written yet
+    uint32_t mLastFlush = 0;
+    uint32_t mLastErase = 0;
+    uint32_t mOverruns = 0;
+    int8_t mOverride = -1; // Group object or USB command: 0 off, 1 on, -1 parameter. Until the next ETS download
+    bool mScanned = false;
+    uint32_t mClearOffset = 0xffffffff; // Next sector erased by clear()
+    enum ExportStage : uint8_t
+    {
+        ExportIdle,
+        ExportFlush, // Staged pages programmed first
+        ExportCount, // Pages counted a sector per call for the header, the ring frozen until the end
+        ExportPages  // One page per call, from the oldest
+    } mExportStage = ExportIdle;
+    Stream *mExport = nullptr;
+    uint32_t mExportOffset = 0;
+    uint32_t mExportCount = 0;
+
+    static uint32_t regionStart();
+    static uint32_t regionSize();
+    static const Page *flashPage(uint32_t offset);
+    void scan();
+    void openPage(uint32_t time);
+    void closePage();
+    void stopped(bool was);
+    uint32_t nextSector() const;
+    bool flushOne();
+    bool eraseAhead();
+    void clearStep();
+    void exportStep();
+    void onOnOff(GroupObject &go, uint8_t);
+
+public:
+    TicCapture(RTCKnx &_rtc) : rtc(_rtc){};
+    void init(int baseAddr, uint16_t baseGO);
+    void append(const char *bytes, unsigned int len, uint32_t time);
+    void loop();
+    void enable(bool on);
+    bool enabled() const;
+    uint32_t overruns() const;
+    void exportTo(Stream &out); // Started here, written by loop()
+    bool exporting() const;
+    void clear(); // Started here, erased by loop()
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <string.h>
+#include "TicLine.h"
+
+// Checksum after the last space, computed up to that space excluded. It may itself be a space (sum & 0x3F == 0)
+bool TicLine::validHistoric(const char *begin, const char *end)
+{
+    if (end - begin < 4 || end[-2] != ' ')
+        return false;
+    uint16_t sum = 0;
+    bool spaceFound = false; // Between label and value
+    for (const char *c = begin; c != end - 2; ++c)
+    {
+        spaceFound |= *c == ' ';
+        sum += *c;
+    }
+    return spaceFound && ((sum & 0x3F) + 0x20) == (uint8_t)end[-1];
+}
+
+// Checksum after the last tab, computed up to and including that tab
+bool TicLine::validStandard(const char *begin, const char *end)
+{
+    if (end - begin < 3 || end[-2] != '\t')
+        return false;
+    uint16_t sum = 0;
+    for (const char *c = begin; c != end - 1; ++c)
+        sum += *c;
+    return ((sum & 0x3F) + 0x20) == (uint8_t)end[-1];
+}
+
+const char *TicLine::value(const char *begin, const char *end, const char *key, uint8_t keySize)
+{
+    return end - begin > keySize && memcmp(begin, key, keySize) == 0 ? begin + keySize : nullptr;
+}
+
+uint32_t TicLine::number(const char *begin, const char *end)
+{
+    uint32_t value = 0;
+    for (; begin != end; ++begin)
+    {
+        const unsigned char v = (unsigned char)(*begin - '0');
+        if (v > 9)
+            break;
+        value = value * 10 + v;
+    }
+    return value;
+}
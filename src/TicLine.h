@@ -0,0 +1,20 @@
+#ifndef TICLINE_H
+#define TICLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// TIC line checks and label matching shared by the firmware and the host tools (no Arduino dependency).
+// A line is given without its LF/CR delimiters.
+class TicLine
+{
+public:
+    static bool validHistoric(const char *begin, const char *end); // "LABEL VALUE C"
+    static bool validStandard(const char *begin, const char *end); // "LABEL\t[DATE\t]VALUE\tC"
+    // Value of the line when it starts with key, the label and its separator ("IINST " or "SINSTS\t"), nullptr otherwise
+    static const char *value(const char *begin, const char *end, const char *key, uint8_t keySize);
+    template <size_t N> static const char *value(const char *begin, const char *end, const char (&key)[N]) { return value(begin, end, key, N - 1); }
+    static uint32_t number(const char *begin, const char *end); // Leading decimal digits, 0 if none
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include <knx.h>
+#include "TicMode.h"
+#include "TicLine.h"
+
+void TicMode::init(int baseAddr, uint16_t baseGO, uint32_t current)
+{
+    mParams.mode = knx.paramInt(baseAddr);
+    knx.getGroupObject(m_GO.mode = ++baseGO).dataPointType(DPT_Value_1_Ucount);
+    knx.getGroupObject(m_GO.mode).valueNoSend((uint8_t)mLocked);
+    if ((mParams.mode == Historic || mParams.mode == Standard) && mParams.mode != mProbe)
+        probe((Mode)mParams.mode, current);
+    else if (mProbeStart == 0)
+        mProbeStart = current;
+}
+
+void TicMode::probe(Mode mode, uint32_t current)
+{
+    mRestart = mode != mProbe;
+    mProbe = mode;
+    mValidLines = mInvalidLines = 0;
+    mProbeStart = current;
+    if (mLocked != Unknown)
+    {
+        mLocked = Unknown;
+        report();
+    }
+}
+
+void TicMode::report()
+{
+    knx.getGroupObject(m_GO.mode).value((uint8_t)mLocked);
+}
+
+void TicMode::received(uint32_t current) { mLastByte = current; }
+
+// One line received at the current speed: true if its checksum is valid in the probed mode
+bool TicMode::line(const char *begin, const char *end, uint32_t current)
+{
+    const bool valid = mProbe == Standard ? TicLine::validStandard(begin, end) : TicLine::validHistoric(begin, end);
+    if (valid)
+    {
+        mLastValid = current;
+        mInvalidLines = 0;
+        if (mLocked == Unknown && ++mValidLines >= TIC_LOCK_LINES)
+        {
+            mLocked = mProbe;
+            report();
+        }
+    }
+    else if (mLocked == Unknown)
+    {
+        mValidLines = 0;
+        ++mInvalidLines;
+    }
+    return valid;
+}
+
+// True when the UART must be restarted at speed()
+bool TicMode::loop(uint32_t current)
+{
+    const bool automatic = mParams.mode != Historic && mParams.mode != Standard;
+    if (mLocked != Unknown)
+    {
+        // Loss of signal: bytes without valid lines mean the meter switched to the other mode, no bytes that it is unplugged
+        if (current - mLastValid > TIC_SIGNAL_TIMEOUT)
+            probe(!automatic ? (Mode)mParams.mode : current - mLastByte < TIC_SIGNAL_TIMEOUT ? (mProbe == Historic ? Standard : Historic) : mProbe, current);
+    }
+    else if (automatic && (mInvalidLines >= TIC_MAX_INVALID_LINES || current - mProbeStart > TIC_PROBE_PERIOD))
+        probe(mProbe == Historic ? Standard : Historic, current);
+    const bool restart = mRestart;
+    mRestart = false;
+    return restart;
+}
+
+unsigned long TicMode::speed() const { return mProbe == Standard ? TIC_STANDARD_SPEED : TIC_HISTORIC_SPEED; }
+TicMode::Mode TicMode::probing() const { return mProbe; }
+TicMode::Mode TicMode::mode() const { return mLocked; }
@@ -0,0 +1,65 @@
+#ifndef TICMODE_H
+#define TICMODE_H
+
+#include <Arduino.h>
+#include <knx.h>
+
+#define TIC_HISTORIC_SPEED 1200
+#define TIC_STANDARD_SPEED 9600
+#define TIC_PROBE_PERIOD (5 * 1000)     // Longest historic frame: ~2s, so 2 frames at least before giving up a speed
+#define TIC_LOCK_LINES 4                // Consecutive valid lines to lock onto a mode
+#define TIC_MAX_INVALID_LINES 8         // Lines failing their checksum before giving up a speed
+#define TIC_SIGNAL_TIMEOUT (10 * 1000)  // No valid line for 10s: probe again
+
+// Detection of the TIC mode of the meter: historic (1200 bauds) or standard (9600 bauds), both 7E1.
+// Lines are scored on their checksum at the current speed, the other speed is probed when no mode
+// locks within TIC_PROBE_PERIOD, at startup and after a loss of signal.
+class TicMode
+{
+public:
+    enum Mode
+    {
+        Unknown = 0,
+        Historic,
+        Standard
+    };
+
+private:
+    struct
+    {
+        uint32_t mode; // Mode: Unknown to detect it
+    } mParams;
+    struct
+    {
+        uint16_t mode;
+    } m_GO;
+
+    Mode mProbe = Historic; // Mode matching the UART speed
+    Mode mLocked = Unknown;
+    uint8_t mValidLines = 0;
+    uint8_t mInvalidLines = 0;
+    uint32_t mProbeStart = 0;
+    uint32_t mLastValid = 0;
+    uint32_t mLastByte = 0;
+    bool mRestart = false;
+
+    void probe(Mode mode, uint32_t current);
+    void report();
+
+public:
+    TicMode(unsigned long speed) : mProbe(speed == TIC_STANDARD_SPEED ? Standard : Historic){};
+    void init(int baseAddr, uint16_t baseGO, uint32_t current);
+    void received(uint32_t current);
+    bool line(const char *begin, const char *end, uint32_t current);
+    bool loop(uint32_t current);
+    unsigned long speed() const;
+    Mode probing() const;
+    Mode mode() const;
+    enum
+    {
+        NBGO = sizeof(m_GO) / sizeof(uint16_t),
+        SIZEPARAMS = sizeof(mParams)
+    };
+};
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "RTCKnx.h"
 #include "TeleInfo.h"
+#include "FlashWriter.h"
 
 #define VERSION_MAJOR 1
 #define VERSION_MINOR 0
@@ -30,7 +31,7 @@
 #define PIN_TPUART_RX 13              // stm32 knx uses Serial2 (pins 16,17)
 #define PIN_TPUART_TX 12
 
-#define TELEINFO_UART_SPEED 1200        //
+#define TELEINFO_UART_SPEED 1200        // First speed probed, see TicMode
 #define TELEINFO_UART_CONFIG SERIAL_7E1 // SERIAL_7E1
 #define TELEINFO_UART_RX 25
 #define TELEINFO_UART_TX 24
@@ -39,16 +40,6 @@
 #define HISTORY_RESET_LED_BLINKING_PERIOD 512 // 0.512s
 #define RECEPTION_LED_BLINKING_PERIOD 512     // 0.512s
 
-// Restore ram after reset (brownout)
-#define INIT_MASK 0x12345678
-volatile uint32_t Inited __attribute__((section(".noinit")));
-
-uint8_t rtcHolder[sizeof(RTCKnx)] __attribute__((section(".noinit")));
-RTCKnx &rtc = *(RTCKnx *)rtcHolder;
-
-uint8_t teleinfoHolder[sizeof(TeleInfo)] __attribute__((section(".noinit")));
-TeleInfo &teleinfo = *(TeleInfo *)teleinfoHolder;
-
 extern "C" void SystemClock_Config(void)
 {
     // Nothing for default 4MHz MSI Clock
@@ -58,6 +49,113 @@ extern "C" void SystemClock_Config(void)
 static SerialUART serialTpuart(uart0, PIN_TPUART_TX, PIN_TPUART_RX);
 static SerialUART serialTeleInfo(uart1, TELEINFO_UART_TX, TELEINFO_UART_RX);
 
+RTCKnx rtc;
+TeleInfo teleinfo(&rtc, &serialTeleInfo, TELEINFO_UART_SPEED, TELEINFO_UART_CONFIG);
+
+// Restore state after reset (brownout), checked by version and CRC
+TeleInfo::Snapshot snapshot __attribute__((section(".noinit")));
+
+static uint32_t longestSlice = 0; // In us
+
+// USB console: one command per line
+static void usbCommand(const char *cmd)
+{
+    if (strcmp(cmd, "capture on") == 0)
+        teleinfo.capture().enable(true);
+    else if (strcmp(cmd, "capture off") == 0)
+        teleinfo.capture().enable(false);
+    else if (strcmp(cmd, "capture dump") == 0)
+        teleinfo.capture().exportTo(Serial); // Binary capture file (see TicCapture::FileHeader), a page per loop
+    else if (strcmp(cmd, "capture clear") == 0)
+        teleinfo.capture().clear();
+    else if (strcmp(cmd, "bench loop") == 0)
+    { // Longest delay of knx.loop() by the TeleInfo and clock calls since the previous command, and longest flash
+        // step among them: outside of the time budget, an erase slice or a page program cannot be interrupted
+        Serial.printf("%lu us, flash step %lu us\r\n", (unsigned long)longestSlice, (unsigned long)FlashWriter::longest(true));
+        longestSlice = 0;
+    }
+    else if (strcmp(cmd, "bench encode") == 0)
+    { // Cycles per label update: direct payload, KNXValue conversion
+        TeleInfo::EncodeCost cost;
+        for (unsigned int i = 0; i < TeleInfo::TeleInfoCount; ++i)
+            if (teleinfo.encodeCost(i, cost))
+                Serial.printf("%s%lu %lu\r\n", cost.key, (unsigned long)cost.direct, (unsigned long)cost.generic);
+    }
+}
+
+static void usbLoop()
+{
+    static char line[32];
+    static uint8_t len = 0;
+    while (Serial.available() > 0)
+    {
+        const int c = Serial.read();
+        if (c == '\r' || c == '\n')
+        {
+            line[len] = '\0';
+            if (len != 0)
+                usbCommand(line);
+            len = 0;
+        }
+        else if (len < sizeof(line) - 1)
+        {
+            line[len++] = (char)c;
+        }
+    }
+}
+
+// Group object table and parameter segment downloaded by ETS: a product database older than the firmware
+// leaves them shorter than what init() reads
+static bool tablesFit()
+{
+    uint8_t mcb[8]; // Segment size (4 bytes, big endian), CRC control, access, CRC
+    uint8_t count = 1;
+    knx.bau().parameters().readProperty(PID_MCB_TABLE, 1, count, mcb);
+    const uint32_t size = (uint32_t)mcb[0] << 24 | (uint32_t)mcb[1] << 16 | mcb[2] << 8 | mcb[3];
+    return knx.bau().groupObjectTable().entryCount() >= RTCKnx::NBGO + TeleInfo::NBGO &&
+           (count == 0 || size >= RTCKnx::SIZEPARAMS + TeleInfo::SIZEPARAMS);
+}
+
+// Reads parameters and binds group objects. Called again when an ETS download reloads the tables:
+// parsed values, history and clock are kept. False when the tables are too short: the application does not run
+static bool configure()
+{
+    if (!tablesFit())
+        return false;
+    rtc.init(0, 0);
+    teleinfo.init(RTCKnx::SIZEPARAMS, RTCKnx::NBGO);
+    rtc.setNotifier<TeleInfo, &TeleInfo::newDate>(&teleinfo);
+    return true;
+}
+
+// The restart requested by ETS after a download becomes a warm boot
+static void beforeRestart()
+{
+    teleinfo.beforeRestart();
+}
+
+static bool ready = false; // Configured with tables large enough
+
+// Bulk readout of the TeleInfo snapshot (see TeleInfo::readoutCommand)
+static bool functionProperty(uint8_t objectIndex, uint8_t propertyId, uint8_t length, uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (objectIndex != READOUT_OBJECT_INDEX || !ready)
+        return false;
+    if (propertyId == ARCHIVE_PROPERTY_ID) // Energy between two dates
+        return teleinfo.archive().queryCommand(length, data, resultData, resultLength);
+    if (propertyId == HISTORY_IMPORT_PROPERTY_ID) // Period start indexes, committed at once
+        return teleinfo.historyImportCommand(length, data, resultData, resultLength);
+    return propertyId == READOUT_PROPERTY_ID && teleinfo.readoutCommand(length, data, resultData, resultLength);
+}
+static bool functionPropertyState(uint8_t objectIndex, uint8_t propertyId, uint8_t length, uint8_t *data, uint8_t *resultData, uint8_t &resultLength)
+{
+    if (objectIndex != READOUT_OBJECT_INDEX || propertyId != READOUT_PROPERTY_ID || !ready)
+        return false;
+    return teleinfo.readoutState(length, data, resultData, resultLength);
+}
+
+bool configured = false;
+
 void setup()
 {
 
@@ -69,12 +167,7 @@ void setup()
     //  delay(300);
     //  Serial.println("Loading ....");
 
-    if (Inited != INIT_MASK)
-    {
-        new (&rtc) RTCKnx();
-        new (&teleinfo) TeleInfo(&rtc, &serialTeleInfo, TELEINFO_UART_SPEED, TELEINFO_UART_CONFIG);
-        Inited = INIT_MASK;
-    }
+    teleinfo.restoreSnapshot(&snapshot);
 
    
 
@@ -94,11 +187,13 @@ void setup()
     // read adress table, association table, groupobject table and parameters from eeprom
     knx.readMemory();
     
-    if (knx.configured())
+    knx.bau().beforeRestartCallback(beforeRestart);
+    knx.bau().functionPropertyCallback(functionProperty);
+    knx.bau().functionPropertyStateCallback(functionPropertyState);
+    configured = knx.configured();
+    if (configured)
     {
-        rtc.init(0, 0);
-        teleinfo.init(RTCKnx::SIZEPARAMS, RTCKnx::NBGO);
-        rtc.setNotifier(std::bind(&TeleInfo::newDate, &teleinfo, std::placeholders::_1));
+        ready = configure();
         // attachInterrupt(PIN_TPUART_SAVE, std::bind(&TeleInfo::saveHistory, &teleinfo), LOW);    // 2ms to save history before shutdown - likely not enough
     }
 
@@ -115,10 +210,18 @@ void loop()
     // don't delay here too much. Otherwise you might loose packages or mess up the timing with ETS
     knx.loop();
     // only run the application code if the device was configured with ETS
-    if (knx.configured())
+    if (knx.configured() != configured)
+    {
+        configured = !configured;
+        ready = configured && configure(); // ETS download completed
+    }
+    if (ready)
     {
+        const uint32_t sliceStart = micros();
         teleinfo.loop();
         rtc.loop();
+        longestSlice = MAX(longestSlice, micros() - sliceStart);
+        usbLoop();
     }
     
 